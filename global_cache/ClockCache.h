@@ -0,0 +1,111 @@
+#ifndef MADFS_CLOCK_CACHE_H
+#define MADFS_CLOCK_CACHE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <folly/concurrent/ConcurrentHashMap.h>
+
+// Bounded map of shared values, looked up without any lock. The hash map
+// is sharded internally; a hit only sets the referenced bit of the entry.
+// Once the cache holds more than max_size entries, the thread inserting
+// sweeps it like a clock: referenced entries get a second chance and the
+// others are dropped, until clear_size entries are gone. The hand stays
+// where the last sweep stopped. Values handed out stay valid after being
+// evicted.
+template <typename Value>
+class ClockCache {
+public:
+    ClockCache(size_t max_size, size_t clear_size)
+            : max_size_(std::max<size_t>(max_size, 1)),
+              clear_size_(std::max<size_t>(std::min(clear_size, max_size_), 1)) {}
+
+    // return the value of key, created by factory() if there was none
+    template <typename Factory>
+    std::shared_ptr<Value> GetOrCreate(const std::string &key, Factory factory) {
+        auto iter = map_.find(key);
+        if (iter != map_.cend()) {
+            Touch(*iter->second);
+            return iter->second->value;
+        }
+        auto result = map_.try_emplace(key, std::make_shared<Node>(factory()));
+        if (result.second && ++size_ > int64_t(max_size_)) {
+            Evict();
+        }
+        return result.first->second->value;
+    }
+
+    void Erase(const std::string &key) {
+        if (map_.erase(key)) {
+            size_--;
+        }
+    }
+
+    void Clear() {
+        for (auto iter = map_.cbegin(); iter != map_.cend(); ++iter) {
+            if (map_.erase_if_equal(iter->first, iter->second)) {
+                size_--;
+            }
+        }
+    }
+
+    size_t Size() const {
+        return std::max<int64_t>(size_.load(), 0);
+    }
+
+private:
+    struct Node {
+        explicit Node(std::shared_ptr<Value> value) : value(std::move(value)) {}
+
+        const std::shared_ptr<Value> value;
+        std::atomic<bool> referenced{true};
+    };
+
+    static void Touch(Node &node) {
+        // skip the store on hot entries, it would bounce their cache line
+        if (!node.referenced.load(std::memory_order_relaxed)) {
+            node.referenced.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    void Evict() {
+        std::unique_lock<std::mutex> lock(evict_mutex_, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;     // another thread is sweeping
+        }
+        const int64_t target = int64_t(max_size_ - clear_size_);
+        // resume where the last sweep stopped, from the start if that
+        // entry is gone meanwhile
+        auto iter = map_.find(hand_);
+        if (iter == map_.cend()) {
+            iter = map_.cbegin();
+        }
+        // two rounds at most: the first may only clear referenced bits
+        for (int64_t steps = 2 * size_.load() + 2; steps > 0 && size_ > target; --steps) {
+            if (iter == map_.cend()) {
+                iter = map_.cbegin();
+                if (iter == map_.cend()) {
+                    break;
+                }
+            }
+            auto &node = iter->second;
+            if (!node->referenced.exchange(false, std::memory_order_relaxed)
+                    && map_.erase_if_equal(iter->first, node)) {
+                size_--;
+            }
+            ++iter;
+        }
+        hand_ = iter != map_.cend() ? iter->first : "";
+    }
+
+private:
+    const size_t max_size_;
+    const size_t clear_size_;
+    folly::ConcurrentHashMap<std::string, std::shared_ptr<Node>> map_;
+    std::atomic<int64_t> size_{0};
+    std::mutex evict_mutex_;
+    std::string hand_;          // key the next sweep starts at, under evict_mutex_
+};
+
+#endif // MADFS_CLOCK_CACHE_H
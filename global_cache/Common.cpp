@@ -31,14 +31,26 @@ DEFINE_uint64(read_page_meta_size, 1024, "Read cache page meta size");
 DEFINE_bool(read_cas, true, "Read cache enable CAS");
 DEFINE_bool(read_nvm_cache, false, "Read cache enable NVM cache");
 
-DEFINE_bool(use_meta_cache, true, "Enable meta cache");
+DEFINE_bool(use_meta_cache, true, "Enable meta cache, kept coherent by watching the etcd records");
 DEFINE_uint64(meta_cache_max_size, 1024 * 1024, "Max size of meta cache");
 DEFINE_uint64(meta_cache_clear_size, 512 * 1024, "Read cache burst flow limit");
 
 DEFINE_uint64(write_chunk_size, 16 * 1024 * 1024, "Granularity of global write cache");
+DEFINE_string(fs_io_engine, "psync", "I/O engine of file system caches: psync | io_uring");
+DEFINE_uint32(fs_fd_cache_size, 512, "Open files kept by each file system cache, 0 to disable");
 DEFINE_uint64(max_inflight_payload_size, 256 * 1024 * 1024, "Max inflight payload size in bytes");
 
 DEFINE_string(etcd_prefix, "/madfs/", "Etcd directory prefix");
+DEFINE_string(etcd_member_prefix, "/madfs_members/", "Etcd directory of registered global cache servers");
+DEFINE_uint32(etcd_connections, 4, "Connections to the etcd server of each etcd client");
+DEFINE_uint32(etcd_threads, 16, "Threads issuing etcd requests of each etcd client");
+DEFINE_bool(etcd_binary_meta, false, "Store object metadata in etcd as compact protobuf instead of JSON. "
+                                     "Both are always read; enable only once every client is upgraded");
+DEFINE_uint32(etcd_max_txn_ops, 128, "Max records put by one etcd transaction, see --max-txn-ops of etcd");
+
+DEFINE_int32(placement_virtual_nodes, 128, "Virtual nodes per unit of weight on the placement ring");
+DEFINE_string(server_weights, "", "Placement weights of global cache servers, comma separated and aligned with the server list, 1 if omitted");
+DEFINE_uint64(placement_weight_unit_mb, 4096, "Registered capacity per unit of placement weight in MB");
 
 DEFINE_bool(verbose, false, "Print debug logging");
 
@@ -81,6 +93,7 @@ void InitGlobalConfig() {
     g_cfg.write_cache_dir = FLAGS_write_cache_dir;
 
     g_cfg.etcd_prefix = FLAGS_etcd_prefix;
+    g_cfg.etcd_member_prefix = FLAGS_etcd_member_prefix;
     g_cfg.max_inflight_payload_size = FLAGS_max_inflight_payload_size;
 
     if (FLAGS_write_cache_type == "nocache") {
@@ -103,6 +103,7 @@ struct GlobalConfig {
     std::string write_cache_dir;
 
     std::string etcd_prefix;
+    std::string etcd_member_prefix;
 };
 
 GlobalConfig &GetGlobalConfig();
@@ -0,0 +1,325 @@
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "ErasureCode.h"
+
+DEFINE_uint64(ec_buffer_pool_mb, 256, "Memory kept for reuse by the erasure coder in MB");
+
+// x^8 + x^4 + x^3 + x^2 + 1
+#define GF_POLY 0x11d
+
+struct GaloisField {
+    GaloisField() {
+        int x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = exp[i + 255] = x;
+            log[x] = i;
+            x <<= 1;
+            if (x & 0x100)
+                x ^= GF_POLY;
+        }
+        log[0] = 0;
+    }
+
+    uint8_t Mul(uint8_t a, uint8_t b) const {
+        return (a && b) ? exp[log[a] + log[b]] : 0;
+    }
+
+    uint8_t Inv(uint8_t a) const {
+        return exp[255 - log[a]];
+    }
+
+    uint8_t exp[510];
+    uint8_t log[256];
+};
+
+static const GaloisField gf;
+
+// dst[d] = sum of tables(d, s) * src[s], tables(d, s) being the products
+// of a coefficient with the low and the high nibbles
+using DotProductFunc = void (*)(size_t begin, size_t len, int srcs, int dsts, const uint8_t *tables,
+                                const uint8_t *const *src, uint8_t *const *dst);
+
+static void DotProductScalar(size_t begin, size_t len, int srcs, int dsts, const uint8_t *tables,
+                             const uint8_t *const *src, uint8_t *const *dst) {
+    for (int d = 0; d < dsts; ++d) {
+        for (size_t i = begin; i < len; ++i) {
+            uint8_t acc = 0;
+            for (int s = 0; s < srcs; ++s) {
+                const uint8_t *table = tables + (d * srcs + s) * 32;
+                const uint8_t v = src[s][i];
+                acc ^= table[v & 0x0f] ^ table[16 + (v >> 4)];
+            }
+            dst[d][i] = acc;
+        }
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void DotProductAvx2(size_t begin, size_t len, int srcs, int dsts, const uint8_t *tables,
+                           const uint8_t *const *src, uint8_t *const *dst) {
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = begin;
+    for (; i + 32 <= len; i += 32) {
+        // the source bytes stay in L1 across the parity blocks
+        for (int d = 0; d < dsts; ++d) {
+            __m256i acc = _mm256_setzero_si256();
+            for (int s = 0; s < srcs; ++s) {
+                const uint8_t *table = tables + (d * srcs + s) * 32;
+                const __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) table));
+                const __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (table + 16)));
+                const __m256i v = _mm256_loadu_si256((const __m256i *) (src[s] + i));
+                const __m256i lo = _mm256_and_si256(v, mask);
+                const __m256i hi = _mm256_and_si256(_mm256_srli_epi64(v, 4), mask);
+                acc = _mm256_xor_si256(acc, _mm256_shuffle_epi8(lo_table, lo));
+                acc = _mm256_xor_si256(acc, _mm256_shuffle_epi8(hi_table, hi));
+            }
+            _mm256_storeu_si256((__m256i *) (dst[d] + i), acc);
+        }
+    }
+    DotProductScalar(i, len, srcs, dsts, tables, src, dst);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void DotProductAvx512(size_t begin, size_t len, int srcs, int dsts, const uint8_t *tables,
+                             const uint8_t *const *src, uint8_t *const *dst) {
+    const __m512i mask = _mm512_set1_epi8(0x0f);
+    size_t i = begin;
+    for (; i + 64 <= len; i += 64) {
+        for (int d = 0; d < dsts; ++d) {
+            __m512i acc = _mm512_setzero_si512();
+            for (int s = 0; s < srcs; ++s) {
+                const uint8_t *table = tables + (d * srcs + s) * 32;
+                const __m512i lo_table = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) table));
+                const __m512i hi_table = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) (table + 16)));
+                const __m512i v = _mm512_loadu_si512((const void *) (src[s] + i));
+                const __m512i lo = _mm512_and_si512(v, mask);
+                const __m512i hi = _mm512_and_si512(_mm512_srli_epi64(v, 4), mask);
+                acc = _mm512_xor_si512(acc, _mm512_shuffle_epi8(lo_table, lo));
+                acc = _mm512_xor_si512(acc, _mm512_shuffle_epi8(hi_table, hi));
+            }
+            _mm512_storeu_si512((void *) (dst[d] + i), acc);
+        }
+    }
+    DotProductAvx2(i, len, srcs, dsts, tables, src, dst);
+}
+#endif
+
+struct Kernel {
+    Kernel() : func(DotProductScalar), name("scalar") {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            func = DotProductAvx512;
+            name = "avx512";
+        } else if (__builtin_cpu_supports("avx2")) {
+            func = DotProductAvx2;
+            name = "avx2";
+        }
+#endif
+    }
+
+    DotProductFunc func;
+    const char *name;
+};
+
+static const Kernel &GetKernel() {
+    static const Kernel kernel;
+    return kernel;
+}
+
+static void BuildTables(const uint8_t *coefficients, size_t count, std::vector<uint8_t> &tables) {
+    tables.resize(count * 32);
+    for (size_t i = 0; i < count; ++i) {
+        for (int x = 0; x < 16; ++x) {
+            tables[i * 32 + x] = gf.Mul(coefficients[i], x);
+            tables[i * 32 + 16 + x] = gf.Mul(coefficients[i], x << 4);
+        }
+    }
+}
+
+// Gauss-Jordan elimination of the n x n matrix, in place
+static bool Invert(std::vector<uint8_t> &matrix, int n) {
+    std::vector<uint8_t> inverse(n * n, 0);
+    for (int i = 0; i < n; ++i) {
+        inverse[i * n + i] = 1;
+    }
+    for (int col = 0; col < n; ++col) {
+        int pivot = col;
+        while (pivot < n && !matrix[pivot * n + col]) {
+            pivot++;
+        }
+        if (pivot == n) {
+            return false;
+        }
+        if (pivot != col) {
+            for (int j = 0; j < n; ++j) {
+                std::swap(matrix[pivot * n + j], matrix[col * n + j]);
+                std::swap(inverse[pivot * n + j], inverse[col * n + j]);
+            }
+        }
+        const uint8_t scale = gf.Inv(matrix[col * n + col]);
+        for (int j = 0; j < n; ++j) {
+            matrix[col * n + j] = gf.Mul(matrix[col * n + j], scale);
+            inverse[col * n + j] = gf.Mul(inverse[col * n + j], scale);
+        }
+        for (int row = 0; row < n; ++row) {
+            const uint8_t factor = matrix[row * n + col];
+            if (row == col || !factor) {
+                continue;
+            }
+            for (int j = 0; j < n; ++j) {
+                matrix[row * n + j] ^= gf.Mul(factor, matrix[col * n + j]);
+                inverse[row * n + j] ^= gf.Mul(factor, inverse[col * n + j]);
+            }
+        }
+    }
+    matrix.swap(inverse);
+    return true;
+}
+
+class BufferPool {
+public:
+    char *Acquire(size_t size) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto &free_list = free_lists_[size];
+            if (!free_list.empty()) {
+                char *data = free_list.back();
+                free_list.pop_back();
+                pooled_bytes_ -= size;
+                return data;
+            }
+        }
+        void *data = nullptr;
+        if (posix_memalign(&data, 64, std::max<size_t>(size, 1))) {
+            throw std::bad_alloc();
+        }
+        return (char *) data;
+    }
+
+    void Release(char *data, size_t size) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pooled_bytes_ + size <= FLAGS_ec_buffer_pool_mb * 1024 * 1024) {
+                free_lists_[size].push_back(data);
+                pooled_bytes_ += size;
+                return;
+            }
+        }
+        free(data);
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<size_t, std::vector<char *>> free_lists_;
+    size_t pooled_bytes_ = 0;
+};
+
+static BufferPool &GetBufferPool() {
+    // never destroyed, buffers may be released during exit
+    static BufferPool *pool = new BufferPool();
+    return *pool;
+}
+
+std::shared_ptr<const ErasureCode> ErasureCode::Get(int k, int m) {
+    if (k < 1 || m < 0 || k + m > 256) {
+        return nullptr;
+    }
+    static std::mutex mutex;
+    static std::map<std::pair<int, int>, std::shared_ptr<const ErasureCode>> codes;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &code = codes[std::make_pair(k, m)];
+    if (!code) {
+        code.reset(new ErasureCode(k, m));
+        LOG(INFO) << "Reed-Solomon code created, k: " << k << ", m: " << m
+                  << ", kernel: " << KernelName();
+    }
+    return code;
+}
+
+ErasureCode::ErasureCode(int k, int m) : k_(k), m_(m), matrix_(m * k) {
+    // rows k..k+m-1 of the Cauchy matrix 1 / (i ^ j), every square
+    // submatrix of which is invertible
+    for (int i = 0; i < m; ++i) {
+        for (int j = 0; j < k; ++j) {
+            matrix_[i * k + j] = gf.Inv((k + i) ^ j);
+        }
+    }
+    BuildTables(matrix_.data(), matrix_.size(), tables_);
+}
+
+void ErasureCode::Encode(char *const *data, char *const *parity, size_t len) const {
+    if (!m_) {
+        return;
+    }
+    GetKernel().func(0, len, k_, m_, tables_.data(),
+                     (const uint8_t *const *) data, (uint8_t *const *) parity);
+}
+
+int ErasureCode::Decode(char *const *blocks, const std::vector<int> &erasures, size_t len) const {
+    std::vector<bool> erased(k_ + m_, false);
+    for (auto id : erasures) {
+        if (id >= 0 && id < k_ + m_) {
+            erased[id] = true;
+        }
+    }
+
+    std::vector<int> lost_data;
+    for (int id = 0; id < k_; ++id) {
+        if (erased[id]) {
+            lost_data.push_back(id);
+        }
+    }
+    if (lost_data.empty()) {
+        return OK;
+    }
+
+    // the rows of the generator matrix for the first k surviving blocks
+    std::vector<int> survivors;
+    std::vector<uint8_t> matrix;
+    matrix.reserve(k_ * k_);
+    for (int id = 0; id < k_ + m_ && (int) survivors.size() < k_; ++id) {
+        if (erased[id]) {
+            continue;
+        }
+        survivors.push_back(id);
+        for (int j = 0; j < k_; ++j) {
+            matrix.push_back(id < k_ ? (id == j) : matrix_[(id - k_) * k_ + j]);
+        }
+    }
+    if ((int) survivors.size() < k_ || !Invert(matrix, k_)) {
+        return IO_ERROR;
+    }
+
+    std::vector<uint8_t> coefficients;
+    std::vector<uint8_t *> dst;
+    for (auto id : lost_data) {
+        coefficients.insert(coefficients.end(), &matrix[id * k_], &matrix[(id + 1) * k_]);
+        dst.push_back((uint8_t *) blocks[id]);
+    }
+    std::vector<const uint8_t *> src;
+    for (auto id : survivors) {
+        src.push_back((const uint8_t *) blocks[id]);
+    }
+    std::vector<uint8_t> tables;
+    BuildTables(coefficients.data(), coefficients.size(), tables);
+    GetKernel().func(0, len, k_, dst.size(), tables.data(), src.data(), dst.data());
+    return OK;
+}
+
+const char *ErasureCode::KernelName() {
+    return GetKernel().name;
+}
+
+CodingBuffer::CodingBuffer(size_t size) : size_(size), data_(GetBufferPool().Acquire(size)) {}
+
+CodingBuffer::~CodingBuffer() {
+    GetBufferPool().Release(data_, size_);
+}
@@ -0,0 +1,71 @@
+#ifndef MADFS_ERASURE_CODE_H
+#define MADFS_ERASURE_CODE_H
+
+#include <memory>
+#include <vector>
+
+#include "Common.h"
+
+DECLARE_uint64(ec_buffer_pool_mb);
+
+// Systematic Reed-Solomon code over GF(2^8) with a Cauchy coding matrix,
+// so any k of the k + m blocks rebuild the data. Encoding multiplies by
+// nibble lookup tables with pshufb, 64 or 32 bytes at a time on AVX-512BW
+// or AVX2 CPUs, selected at runtime, with a scalar fallback. Instances
+// are immutable and shared per (k, m).
+class ErasureCode {
+public:
+    static const int kWordSize = 8;
+
+    // nullptr unless 1 <= k and k + m <= 256
+    static std::shared_ptr<const ErasureCode> Get(int k, int m);
+
+    int DataBlocks() const { return k_; }
+
+    int ParityBlocks() const { return m_; }
+
+    // data and parity point to k and m blocks of len bytes. Data blocks
+    // are only read, so they may point into the caller's buffer
+    void Encode(char *const *data, char *const *parity, size_t len) const;
+
+    // blocks point to the k + m blocks of len bytes, rebuild the data
+    // blocks listed in erasures from the others. Return IO_ERROR if fewer
+    // than k blocks are left
+    int Decode(char *const *blocks, const std::vector<int> &erasures, size_t len) const;
+
+    // name of the SIMD kernel in use, for logging
+    static const char *KernelName();
+
+private:
+    ErasureCode(int k, int m);
+
+private:
+    const int k_;
+    const int m_;
+    std::vector<uint8_t> matrix_;       // m x k coefficients of the parity blocks
+    std::vector<uint8_t> tables_;       // 32 bytes of nibble tables per coefficient
+};
+
+// Scratch memory of the coder, aligned for SIMD. Freed memory is kept in
+// a pool of at most ec_buffer_pool_mb, as every chunk put needs blocks of
+// the same size
+class CodingBuffer {
+public:
+    explicit CodingBuffer(size_t size);
+
+    ~CodingBuffer();
+
+    CodingBuffer(const CodingBuffer &) = delete;
+
+    CodingBuffer &operator=(const CodingBuffer &) = delete;
+
+    char *data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+private:
+    const size_t size_;
+    char *data_;
+};
+
+#endif // MADFS_ERASURE_CODE_H
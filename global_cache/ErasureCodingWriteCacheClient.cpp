@@ -1,4 +1,5 @@
 #include "ErasureCodingWriteCacheClient.h"
+#include "ErasureCode.h"
 #include "GlobalDataAdaptor.h"
 
 // #define CONFIG_JERASURE
@@ -6,6 +7,13 @@
 #ifdef CONFIG_JERASURE
 #include <jerasure.h>
 #include <jerasure/reed_sol.h>
+#endif
+
+// objects written before ErasureCode have no "w" in their metadata and
+// were encoded by jerasure with w = 32, which only the Jerasure build
+// decodes. Both lay out the blocks the same way
+#define JERASURE_WORD_SIZE 32
+#define BLOCK_ALIGNMENT 32
 
 static int _roundup(int a, int b) {
     if (a % b == 0) return a;
@@ -29,35 +37,43 @@ folly::Future<PutResult> ErasureCodingWriteCacheClient::Put(const std::string &k
     auto &policy = parent_->GetCachePolicy(key);
     const int k = policy.write_data_blocks;
     const int m = policy.write_parity_blocks;
-    const int w = 32;
-    auto matrix = reed_sol_vandermonde_coding_matrix(k, m, w);
-    std::vector<char *> data_buf_list;
+    auto code = ErasureCode::Get(k, m);
+    if (!code || replicas.size() != k + m) {
+        LOG(ERROR) << "Failed to put data, reason: invalid coding, key: " << key
+                   << ", k: " << k << ", m: " << m << ", servers: " << replicas.size();
+        return folly::makeFuture(PutResult { INVALID_ARGUMENT, root });
+    }
     auto rpc_client = parent_->GetRpcClient();
     auto write_chunk_size = GetGlobalConfig().write_chunk_size;
+    const size_t unit_size = _roundup((write_chunk_size + k - 1) / k, BLOCK_ALIGNMENT);
     for (uint64_t offset = 0; offset < size; offset += write_chunk_size) {
-        const auto unit_size = _roundup((write_chunk_size + k - 1) / k, w);
-        const auto region_size = std::min(write_chunk_size, size - offset);
-        char *data_buf = new char[(k + m) * unit_size];
-        data_buf_list.push_back(data_buf);
-        memcpy(data_buf, &buffer.data[offset], region_size);
-        memset(data_buf + region_size, 0, k * unit_size - region_size);
-        char *data_ptrs[k] = { nullptr }, *coding_ptrs[m] = { nullptr };
+        const size_t region_size = std::min(write_chunk_size, size - offset);
+        // data blocks lying in the buffer are encoded in place, only the
+        // zero padded tail and the parity need scratch blocks
+        const int full_blocks = std::min<size_t>(region_size / unit_size, k);
+        CodingBuffer scratch((k - full_blocks + m) * unit_size);
+        std::vector<char *> block_ptrs(k + m);
         for (int i = 0; i < k + m; ++i) {
+            if (i < full_blocks) {
+                block_ptrs[i] = &buffer.data[offset + i * unit_size];
+                continue;
+            }
+            block_ptrs[i] = scratch.data() + (i - full_blocks) * unit_size;
             if (i < k) {
-                data_ptrs[i] = &data_buf[i * unit_size];
-            } else {
-                coding_ptrs[i - k] = &data_buf[i * unit_size];
+                const size_t block_start = std::min(i * unit_size, region_size);
+                const size_t copied = std::min(unit_size, region_size - block_start);
+                memcpy(block_ptrs[i], &buffer.data[offset + block_start], copied);
+                memset(block_ptrs[i] + copied, 0, unit_size - copied);
             }
         }
-        jerasure_matrix_encode(k, m, w, matrix, data_ptrs, coding_ptrs, unit_size);
-        auto cur_data_buf = data_buf;
-        for (auto server_id: replicas) {
-            ByteBuffer region_buffer(cur_data_buf, unit_size);
-            cur_data_buf += unit_size;
-            std::string partial_key = key
-                                      + "-" + std::to_string(offset / write_chunk_size)
-                                      + "-" + std::to_string(write_chunk_size);
-            future_list.emplace_back(rpc_client->PutEntryFromWriteCache(server_id, partial_key, region_buffer, unit_size));
+        code->Encode(&block_ptrs[0], &block_ptrs[k], unit_size);
+        std::string partial_key = key
+                                  + "-" + std::to_string(offset / write_chunk_size)
+                                  + "-" + std::to_string(write_chunk_size);
+        // the request copies the block, scratch returns to the pool
+        for (int i = 0; i < k + m; ++i) {
+            ByteBuffer region_buffer(block_ptrs[i], unit_size);
+            future_list.emplace_back(rpc_client->PutEntryFromWriteCache(replicas[i], partial_key, region_buffer, unit_size));
         }
     }
     for (auto iter = headers.begin(); iter != headers.end(); ++iter) {
@@ -65,16 +81,13 @@ folly::Future<PutResult> ErasureCodingWriteCacheClient::Put(const std::string &k
     }
 
     root["type"] = "reed-solomon";
+    root["w"] = ErasureCode::kWordSize;
     root["size"] = size;
     root["replica"] = json_replica;
     root["headers"] = json_headers;
 
     return folly::collectAll(future_list).via(parent_->executor_.get()).thenValue(
-        [this, root, data_buf_list, matrix](std::vector <folly::Try<PutOutput>> output) -> PutResult {
-            free(matrix);
-            for (auto &entry : data_buf_list) {
-                delete []entry;
-            }
+        [this, root](std::vector <folly::Try<PutOutput>> output) -> PutResult {
             Json::Value res_root;
             Json::Value json_path(Json::arrayValue);
             for (auto &entry: output) {
@@ -115,9 +128,7 @@ folly::Future<int> ErasureCodingWriteCacheClient::Get(const std::string &key,
     for (auto &entry: requests) {
         auto &policy = parent_->GetCachePolicy(key);
         const int k = policy.write_data_blocks;
-        const int m = policy.write_parity_blocks;
-        const int w = 32;
-        const auto unit_size = _roundup((write_chunk_size + k - 1) / k, w);
+        const auto unit_size = _roundup((write_chunk_size + k - 1) / k, BLOCK_ALIGNMENT);
         const auto start_replica_id = entry.chunk_start / unit_size;
         const auto end_replica_id = (entry.chunk_start + entry.chunk_len + unit_size - 1) / unit_size;
         size_t dest_buf_pos = 0;
@@ -181,29 +192,34 @@ folly::Future<int> ErasureCodingWriteCacheClient::GetDecode(const std::string &k
     if (requests.empty())
         return folly::makeFuture(OK);
 
-    std::vector <folly::Future<GetOutput>> future_list;
+    auto &policy = parent_->GetCachePolicy(key);
+    const int k = policy.write_data_blocks;
+    const int m = policy.write_parity_blocks;
+    const int w = root.isMember("w") ? root["w"].asInt() : JERASURE_WORD_SIZE;
+    auto code = ErasureCode::Get(k, m);
+    if (!code || replicas.size() != k + m) {
+        return folly::makeFuture(INVALID_ARGUMENT);
+    }
+#ifdef CONFIG_JERASURE
+    if (w != ErasureCode::kWordSize && w != JERASURE_WORD_SIZE) {
+#else
+    if (w != ErasureCode::kWordSize) {
+#endif
+        LOG(ERROR) << "Failed to decode data, reason: unsupported word size, key: " << key << ", w: " << w;
+        return folly::makeFuture(UNSUPPORTED_TYPE);
+    }
+
+    const size_t unit_size = _roundup((write_chunk_size + k - 1) / k, BLOCK_ALIGNMENT);
+    CodingBuffer data_buf((k + m) * unit_size);
+    std::vector<char *> block_ptrs(k + m);
+    for (int i = 0; i < k + m; ++i) {
+        block_ptrs[i] = data_buf.data() + i * unit_size;
+    }
 
     for (auto &entry: requests) {
-        auto &policy = parent_->GetCachePolicy(key);
-        const int k = policy.write_data_blocks;
-        const int m = policy.write_parity_blocks;
-        const int w = 32;
-        auto matrix = reed_sol_vandermonde_coding_matrix(k, m, w);
-        const auto unit_size = _roundup((write_chunk_size + k - 1) / k, w);
         const auto start_replica_id = entry.chunk_start / unit_size;
         const auto end_replica_id = (entry.chunk_start + entry.chunk_len + unit_size - 1) / unit_size;
-        int erasures[k + m + 1] = { 0 };
-        int erasures_idx = 0;
-
-        char *data_buf = new char[(k + m) * unit_size];
-        char *data_ptrs[k] = { nullptr }, *coding_ptrs[m] = { nullptr };
-        for (int i = 0; i < k + m; ++i) {
-            if (i < k) {
-                data_ptrs[i] = &data_buf[i * unit_size];
-            } else {
-                coding_ptrs[i - k] = &data_buf[i * unit_size];
-            }
-        }
+        std::vector<int> erasures;
 
         // rarely occurred, can be synchronized
         for (auto replica_id = 0; replica_id < k + m; ++replica_id) {
@@ -211,49 +227,47 @@ folly::Future<int> ErasureCodingWriteCacheClient::GetDecode(const std::string &k
 	        std::string internal_key = internal_keys[entry.chunk_id * replicas.size() + replica_id];
             auto output = parent_->GetRpcClient()->GetEntryFromWriteCache(server_id, internal_key, 0, unit_size).get();
             if (output.status == OK) {
-                if (replica_id < k) {
-                    output.buf.copy_to(data_ptrs[replica_id], unit_size);
-                } else {
-                    output.buf.copy_to(coding_ptrs[replica_id - k], unit_size);
-                }
+                output.buf.copy_to(block_ptrs[replica_id], unit_size);
             } else {
-                erasures[erasures_idx++] = replica_id;
+                erasures.push_back(replica_id);
             }
         }
 
-        erasures[erasures_idx] = -1;
-
-        int rc = jerasure_matrix_decode(k, m, w, matrix, 1, erasures, data_ptrs, coding_ptrs, unit_size);
-        if (rc == -1) {
-            LOG(FATAL) << "Unable to decode RS matrix";
-            return IO_ERROR;
+        int rc = OK;
+#ifdef CONFIG_JERASURE
+        if (w == JERASURE_WORD_SIZE) {
+            auto matrix = reed_sol_vandermonde_coding_matrix(k, m, w);
+            erasures.push_back(-1);
+            if (jerasure_matrix_decode(k, m, w, matrix, 1, &erasures[0], &block_ptrs[0], &block_ptrs[k], unit_size) == -1) {
+                rc = IO_ERROR;
+            }
+            free(matrix);
+        } else
+#endif
+        rc = code->Decode(&block_ptrs[0], erasures, unit_size);
+        if (rc) {
+            LOG(ERROR) << "Unable to decode RS matrix, key: " << key
+                       << ", chunk id: " << entry.chunk_id
+                       << ", erasures: " << erasures.size();
+            return folly::makeFuture(rc);
         }
 
         auto cur_pos = 0;
         for (auto replica_id = start_replica_id; replica_id < end_replica_id; ++replica_id) {
             auto start_pos = (replica_id == start_replica_id) ? entry.chunk_start % unit_size : 0;
             auto end_pos = (replica_id + 1 == end_replica_id) ? (entry.chunk_start + entry.chunk_len) - replica_id * unit_size : unit_size;
-            memcpy(entry.buffer.data + cur_pos, data_ptrs[replica_id] + start_pos, end_pos - start_pos);
+            memcpy(entry.buffer.data + cur_pos, block_ptrs[replica_id] + start_pos, end_pos - start_pos);
             cur_pos += end_pos - start_pos;
         }
-
-        delete []data_buf;
-        free(matrix);
     }
 
     return OK;
 }
 
 std::vector<int> ErasureCodingWriteCacheClient::GetReplica(const std::string &key) {
-    const int num_available = parent_->server_list_.size();
     auto &policy = parent_->GetCachePolicy(key);
     const int num_choose = policy.write_data_blocks + policy.write_parity_blocks;
-    uint64_t seed = std::hash < std::string > {}(key);
-    std::vector<int> output;
-    // for (int i = 0; i < std::min(num_available, num_choose); ++i)
-    for (int i = 0; i < num_choose; ++i)
-        output.push_back((seed + i) % num_available);
-    return output;
+    return parent_->GetPlacement()->Locate(key, num_choose);
 }
 
 void ErasureCodingWriteCacheClient::GenerateGetChunkRequestsV2(const std::string &key, 
@@ -290,44 +304,3 @@ void ErasureCodingWriteCacheClient::GenerateGetChunkRequestsV2(const std::string
     }
     LOG_ASSERT(buffer_offset == size);
 }
-#else
-folly::Future<PutResult> ErasureCodingWriteCacheClient::Put(const std::string &key,
-                                                            size_t size,
-                                                            const ByteBuffer &buffer,
-                                                            const std::map <std::string, std::string> &headers,
-                                                            size_t off) {
-    PutResult res;
-    res.status = UNSUPPORTED_OPERATION;
-    return res;
-}
-
-folly::Future<int> ErasureCodingWriteCacheClient::Get(const std::string &key,
-                                                      size_t start,
-                                                      size_t size,
-                                                      ByteBuffer &buffer, 
-                                                      Json::Value &root) {
-    return UNSUPPORTED_OPERATION;
-}
-
-
-folly::Future<int> ErasureCodingWriteCacheClient::GetDecode(const std::string &key,
-                                                            size_t start,
-                                                            size_t size,
-                                                            ByteBuffer &buffer, 
-                                                            Json::Value &root) {
-    return UNSUPPORTED_OPERATION;
-}
-
-std::vector<int> ErasureCodingWriteCacheClient::GetReplica(const std::string &key) {
-    return std::vector<int>{};
-}
-
-void ErasureCodingWriteCacheClient::GenerateGetChunkRequestsV2(const std::string &key, 
-                                                               size_t start, 
-                                                               size_t size, 
-                                                               ByteBuffer &buffer, 
-                                                               std::vector<GetChunkRequestV2> &requests,
-                                                               size_t chunk_size) {
-    
-}
-#endif
\ No newline at end of file
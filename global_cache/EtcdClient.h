@@ -2,100 +2,486 @@
 #define ETCD_CLIENT_H
 
 #include <etcd/SyncClient.hpp>
+#include <etcd/KeepAlive.hpp>
+#include <etcd/Watcher.hpp>
+#include <etcd/v3/Transaction.hpp>
 #include <json/json.h>
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <map>
 #include <mutex>
+#include <thread>
+#include <unordered_set>
 
 #include "WriteCacheClient.h"
+#include "MetaCodec.h"
 
+DECLARE_uint32(etcd_connections);
+DECLARE_uint32(etcd_threads);
+DECLARE_uint32(etcd_max_txn_ops);
+
+static const std::chrono::seconds REGISTER_RETRY_INTERVAL(1);
+
+// Requests run on a pool of etcd_threads threads over etcd_connections
+// connections, so concurrent callers no longer queue behind each other.
+// Puts and deletes of records are queued in one shard per connection,
+// chosen by key, so the updates of a key commit in call order. Concurrent
+// PutJson calls of a shard are merged into transactions of up to
+// etcd_max_txn_ops records, one in flight per shard.
 class EtcdClient {
 public:
-    EtcdClient(const std::string &etcd_url) : client_(etcd_url) {};
+    EtcdClient(const std::string &etcd_url) : etcd_url_(etcd_url) {
+        for (uint32_t i = 0; i < std::max(FLAGS_etcd_connections, 1u); ++i) {
+            clients_.push_back(std::make_shared<etcd::SyncClient>(etcd_url));
+            update_shards_.emplace_back(new UpdateShard());
+        }
+        executor_ = std::make_shared<folly::CPUThreadPoolExecutor>(std::max(FLAGS_etcd_threads, 1u));
+    };
 
-    ~EtcdClient() {}
+    ~EtcdClient() {
+        {
+            // stops a registration retried on the executor
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++registration_generation_;
+        }
+        if (watcher_)
+            watcher_->Cancel();
+        StopWatchRecords();
+        executor_->join();
+    }
 
     struct GetResult {
         int status;
         Json::Value root;
     };
 
+    struct ServerInfo {
+        std::string address;
+        uint64_t capacity;
+    };
+
     folly::Future<GetResult> GetJson(const std::string &key) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        Json::Reader reader;
-        Json::Value root;
-        auto resp = client_.get(PathJoin(GetGlobalConfig().etcd_prefix, key));
+        return folly::via(executor_.get(), [this, key] { return DoGetJson(key); });
+    }
+
+    folly::Future<int> PutJson(const std::string &key, const Json::Value &root) {
+        auto update = std::make_shared<PendingUpdate>();
+        update->key = PathJoin(GetGlobalConfig().etcd_prefix, key);
+        ObjectMetaCodec::Encode(key, root, update->value);
+        return EnqueueUpdate(update);
+    }
+
+    // committed after the puts of key queued before
+    folly::Future<int> DeleteJson(const std::string &key) {
+        auto update = std::make_shared<PendingUpdate>();
+        update->key = PathJoin(GetGlobalConfig().etcd_prefix, key);
+        update->remove = true;
+        return EnqueueUpdate(update);
+    }
+
+    folly::Future<int> ListJson(const std::string &key_prefix, std::vector<std::string> &key_list) {
+        return folly::via(executor_.get(), [this, key_prefix, &key_list] { return DoListJson(key_prefix, key_list); });
+    }
+
+    // Register a global cache server under a lease. The record disappears
+    // once the server stops refreshing the lease, so clients drop it. If the
+    // keepalive fails, e.g. the lease expired while etcd was unreachable, a
+    // new lease is granted and the record put again, retried every
+    // REGISTER_RETRY_INTERVAL until it succeeds
+    int RegisterServer(int server_id, const std::string &address, uint64_t capacity, int ttl) {
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            registration_ = ServerRegistration{ server_id, address, capacity, ttl };
+            generation = ++registration_generation_;
+        }
+        return DoRegisterServer(generation);
+    }
+
+    // records whose key is not a server id are skipped
+    int ListServers(std::map<int, ServerInfo> &servers) {
+        const std::string member_prefix = PathJoin(GetGlobalConfig().etcd_member_prefix, "");
+        auto resp = GetClient().ls(member_prefix);
         if (!resp.is_ok()) {
             if (resp.error_code() != 100) {
                 LOG(ERROR) << "Error from etcd client: " << resp.error_code()
                            << ", message: " << resp.error_message();
-                return folly::makeFuture(GetResult{ METADATA_ERROR, root });
-            } else {
-                LOG(WARNING) << "Record not found in the etcd storage: key " << key;
-                return folly::makeFuture(GetResult{ NOT_FOUND, root });
+                return METADATA_ERROR;
             }
+            return OK;  // no registered server
         }
-        if (!reader.parse(resp.value().as_string(), root)) {
-            LOG(ERROR) << "Error from etcd client: failed to parse record: " << resp.value().as_string();
-            return folly::makeFuture(GetResult{ METADATA_ERROR, root });
+        Json::Reader reader;
+        for (size_t i = 0; i < resp.keys().size(); ++i) {
+            Json::Value root;
+            const std::string &key = resp.keys()[i];
+            int server_id;
+            if (!ParseServerId(key.substr(member_prefix.length()), server_id)) {
+                LOG(WARNING) << "Skip malformed member record: " << key;
+                continue;
+            }
+            if (!reader.parse(resp.value(i).as_string(), root)) {
+                LOG(ERROR) << "Error from etcd client: failed to parse record: " << key;
+                continue;
+            }
+            servers[server_id] = ServerInfo{ root["address"].asString(), root["capacity"].asUInt64() };
         }
-        LOG(INFO) << "Record get: " << key;
-        return folly::makeFuture(GetResult{ OK, root });
+        return OK;
     }
 
-    folly::Future<int> PutJson(const std::string &key, const Json::Value &root) {
+    // on_change runs in the watcher thread after any membership change
+    void WatchServers(std::function<void()> on_change) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        watcher_ = std::make_shared<etcd::Watcher>(etcd_url_, GetGlobalConfig().etcd_member_prefix,
+                                                   [on_change](etcd::Response resp) { on_change(); },
+                                                   true);
+    }
+
+    void StopWatchServers() {
+        std::shared_ptr<etcd::Watcher> watcher;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            watcher.swap(watcher_);
+        }
+        // cancel without mutex_, it waits for a running callback
+        if (watcher)
+            watcher->Cancel();
+    }
+
+    // on_change runs in the watcher thread with the key of each record put
+    // or deleted under etcd_prefix, by any client. Once the watch breaks,
+    // events may be lost: on_lost runs and RecordsWatched() stays false
+    // until RewatchRecords() starts it again
+    void WatchRecords(std::function<void(const std::string &)> on_change, std::function<void()> on_lost) {
         std::lock_guard<std::mutex> lock(mutex_);
+        on_record_change_ = on_change;
+        on_records_lost_ = on_lost;
+        StartRecordWatcher();
+    }
+
+    bool RecordsWatched() const {
+        return records_watched_;
+    }
+
+    // return true if a broken watch of records was started again
+    bool RewatchRecords() {
+        std::shared_ptr<etcd::Watcher> broken;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (records_watched_ || !on_record_change_) {
+                return false;
+            }
+            broken.swap(record_watcher_);
+            StartRecordWatcher();
+        }
+        LOG(INFO) << "Watch of etcd records restarted";
+        return true;
+    }
+
+    void StopWatchRecords() {
+        std::shared_ptr<etcd::Watcher> watcher;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            on_record_change_ = nullptr;
+            records_watched_ = false;
+            watcher.swap(record_watcher_);
+        }
+        if (watcher)
+            watcher->Cancel();
+    }
+
+private:
+    struct PendingUpdate {
+        std::string key;        // with etcd_prefix
+        std::string value;
+        bool remove = false;
+        folly::Promise<int> promise;
+    };
+
+    struct UpdateShard {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<PendingUpdate>> updates;
+        bool flushing = false;
+    };
+
+    struct ServerRegistration {
+        int server_id;
+        std::string address;
+        uint64_t capacity;
+        int ttl;
+    };
+
+    static bool ParseServerId(const std::string &str, int &server_id) {
+        if (str.empty() || !isdigit(str[0])) {
+            return false;
+        }
+        char *end = nullptr;
+        errno = 0;
+        long value = strtol(str.c_str(), &end, 10);
+        if (errno || *end != '\0' || value > INT_MAX) {
+            return false;
+        }
+        server_id = (int) value;
+        return true;
+    }
+
+    // return OK without registering once generation is replaced
+    int DoRegisterServer(uint64_t generation) {
+        ServerRegistration registration;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (generation != registration_generation_) {
+                return OK;
+            }
+            registration = registration_;
+        }
+        auto &client = GetClient();
+        auto lease = client.leasegrant(registration.ttl);
+        if (!lease.is_ok()) {
+            LOG(ERROR) << "Error from etcd client: " << lease.error_code()
+                       << ", message: " << lease.error_message();
+            return METADATA_ERROR;
+        }
+        const int64_t lease_id = lease.value().lease();
+
+        Json::Value root;
         Json::FastWriter writer;
-        const std::string json_file = writer.write(root);
-        auto resp = client_.put(PathJoin(GetGlobalConfig().etcd_prefix, key), json_file);
+        root["address"] = registration.address;
+        root["capacity"] = (Json::UInt64) registration.capacity;
+        const std::string member_key = PathJoin(GetGlobalConfig().etcd_member_prefix,
+                                                std::to_string(registration.server_id));
+        auto resp = client.set(member_key, writer.write(root), lease_id);
         if (!resp.is_ok()) {
             LOG(ERROR) << "Error from etcd client: " << resp.error_code()
-                       << ", message: " << resp.error_message(); 
-            return folly::makeFuture(METADATA_ERROR);
+                       << ", message: " << resp.error_message();
+            return METADATA_ERROR;
         }
-        LOG(INFO) << "Record put: " << key;
-        return folly::makeFuture(OK);
+        std::shared_ptr<etcd::KeepAlive> keepalive;
+        try {
+            keepalive = std::make_shared<etcd::KeepAlive>(etcd_url_,
+                [this, generation](std::exception_ptr) { OnKeepAliveFailed(generation); },
+                registration.ttl, lease_id);
+        } catch (const std::exception &e) {
+            LOG(ERROR) << "Error from etcd client: failed to keep lease alive: " << e.what();
+            return METADATA_ERROR;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (generation == registration_generation_) {
+                keepalive.swap(keepalive_);
+            }
+        }
+        // the replaced keepalive is released without mutex_, its destructor
+        // waits for a running failure handler
+        keepalive.reset();
+        LOG(INFO) << "Server registered: " << member_key << ", address: " << registration.address
+                  << ", capacity: " << registration.capacity;
+        return OK;
     }
 
-    folly::Future<int> DeleteJson(const std::string &key) {
+    // runs in the keepalive thread, which must not release the keepalive
+    void OnKeepAliveFailed(uint64_t generation) {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto resp = client_.rm(PathJoin(GetGlobalConfig().etcd_prefix, key));
+        if (generation != registration_generation_) {
+            return;
+        }
+        LOG(WARNING) << "Keepalive of the etcd registration failed, register again";
+        folly::via(executor_.get(), [this, generation] {
+            while (DoRegisterServer(generation) != OK) {
+                std::this_thread::sleep_for(REGISTER_RETRY_INTERVAL);
+            }
+        });
+    }
+
+    // with mutex_ held
+    void StartRecordWatcher() {
+        const std::string etcd_prefix = GetGlobalConfig().etcd_prefix;
+        auto on_change = on_record_change_;
+        auto on_lost = on_records_lost_;
+        const uint64_t generation = ++record_watch_generation_;
+        // a watcher replaced already must not report the current one lost
+        auto lost = [this, on_lost, generation]() {
+            if (record_watch_generation_ == generation && records_watched_.exchange(false)) {
+                LOG(WARNING) << "Watch of etcd records broken";
+                on_lost();
+            }
+        };
+        records_watched_ = true;
+        record_watcher_ = std::make_shared<etcd::Watcher>(etcd_url_, etcd_prefix,
+            [etcd_prefix, on_change, lost](etcd::Response resp) {
+                if (!resp.is_ok()) {
+                    lost();
+                    return;
+                }
+                for (auto &event : resp.events()) {
+                    on_change(event.kv().key().substr(etcd_prefix.length()));
+                }
+            }, true);
+        record_watcher_->Wait([lost](bool cancelled) {
+            if (!cancelled)
+                lost();
+        });
+    }
+
+    etcd::SyncClient &GetClient() {
+        return *clients_[next_client_.fetch_add(1) % clients_.size()];
+    }
+
+    GetResult DoGetJson(const std::string &key) {
+        Json::Value root;
+        auto resp = GetClient().get(PathJoin(GetGlobalConfig().etcd_prefix, key));
+        if (!resp.is_ok()) {
+            if (resp.error_code() != 100) {
+                LOG(ERROR) << "Error from etcd client: " << resp.error_code()
+                           << ", message: " << resp.error_message();
+                return GetResult{ METADATA_ERROR, root };
+            } else {
+                LOG(WARNING) << "Record not found in the etcd storage: key " << key;
+                return GetResult{ NOT_FOUND, root };
+            }
+        }
+        if (ObjectMetaCodec::Decode(key, resp.value().as_string(), root)) {
+            LOG(ERROR) << "Error from etcd client: failed to parse record: " << key;
+            return GetResult{ METADATA_ERROR, root };
+        }
+        LOG(INFO) << "Record get: " << key;
+        return GetResult{ OK, root };
+    }
+
+    folly::Future<int> EnqueueUpdate(std::shared_ptr<PendingUpdate> update) {
+        const size_t index = std::hash<std::string>()(update->key) % update_shards_.size();
+        auto &shard = *update_shards_[index];
+        auto future = update->promise.getFuture();
+        bool start_flusher = false;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.updates.push_back(update);
+            if (!shard.flushing) {
+                shard.flushing = true;
+                start_flusher = true;
+            }
+        }
+        if (start_flusher) {
+            executor_->add([this, index] { FlushUpdates(index); });
+        }
+        return future;
+    }
+
+    int DoDeleteJson(etcd::SyncClient &client, const std::string &key) {
+        auto resp = client.rm(key);
         if (!resp.is_ok()) {
             if (resp.error_code() != 100) {
                 LOG(ERROR) << "Error from etcd client: " << resp.error_code()
                            << ", message: " << resp.error_message();       
-                return folly::makeFuture(METADATA_ERROR);
+                return METADATA_ERROR;
             } else {
                 LOG(WARNING) << "Record not found in the etcd storage: key " << key;
-                return folly::makeFuture(NOT_FOUND);
+                return NOT_FOUND;
             }
-            return folly::makeFuture(METADATA_ERROR);
         }
-        return folly::makeFuture(OK);
+        return OK;
     }
 
-    folly::Future<int> ListJson(const std::string &key_prefix, std::vector<std::string> &key_list) {
-        std::lock_guard<std::mutex> lock(mutex_);
+    int DoListJson(const std::string &key_prefix, std::vector<std::string> &key_list) {
         const std::string etcd_prefix = GetGlobalConfig().etcd_prefix;
-        auto resp = client_.keys(PathJoin(etcd_prefix, key_prefix));
+        auto resp = GetClient().keys(PathJoin(etcd_prefix, key_prefix));
         if (!resp.is_ok()) {
             if (resp.error_code() != 100) {
                 LOG(ERROR) << "Error from etcd client: " << resp.error_code()
                            << ", message: " << resp.error_message();       
-                return folly::makeFuture(METADATA_ERROR);
+                return METADATA_ERROR;
             } else {
                 LOG(WARNING) << "Record not found in the etcd storage: key " << key_prefix;
-                return folly::makeFuture(NOT_FOUND);
+                return NOT_FOUND;
             }
-            return folly::makeFuture(METADATA_ERROR);
         }
         for (auto &entry : resp.keys()) {
             key_list.push_back(entry.substr(etcd_prefix.length()));
         }
-        return folly::makeFuture(OK);
+        return OK;
+    }
+
+    // Drain the updates of a shard a batch at a time over its connection.
+    // A batch stops before a key it already holds, since a transaction may
+    // not put a key twice, and a delete is sent alone to report NOT_FOUND
+    void FlushUpdates(size_t index) {
+        auto &shard = *update_shards_[index];
+        auto &client = *clients_[index];
+        while (true) {
+            std::vector<std::shared_ptr<PendingUpdate>> batch;
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                std::unordered_set<std::string> keys;
+                while (!shard.updates.empty()
+                       && batch.size() < std::max(FLAGS_etcd_max_txn_ops, 1u)
+                       && !(shard.updates.front()->remove && !batch.empty())
+                       && keys.insert(shard.updates.front()->key).second) {
+                    batch.push_back(shard.updates.front());
+                    shard.updates.pop_front();
+                    if (batch.back()->remove) {
+                        break;
+                    }
+                }
+                if (batch.empty()) {
+                    shard.flushing = false;
+                    return;
+                }
+            }
+
+            if (batch[0]->remove) {
+                batch[0]->promise.setValue(DoDeleteJson(client, batch[0]->key));
+                continue;
+            }
+
+            etcd::Response resp;
+            if (batch.size() == 1) {
+                resp = client.put(batch[0]->key, batch[0]->value);
+            } else {
+                etcdv3::Transaction txn;
+                for (auto &put : batch) {
+                    txn.setup_put(put->key, put->value);
+                }
+                resp = client.txn(txn);
+            }
+            int status = OK;
+            if (!resp.is_ok()) {
+                LOG(ERROR) << "Error from etcd client: " << resp.error_code()
+                           << ", message: " << resp.error_message()
+                           << ", records: " << batch.size();
+                status = METADATA_ERROR;
+            } else {
+                LOG(INFO) << "Record put: " << batch[0]->key << ", records: " << batch.size();
+            }
+            for (auto &put : batch) {
+                put->promise.setValue(status);
+            }
+        }
     }
 
 private:
-    std::mutex mutex_;
-    etcd::SyncClient client_;
+    const std::string etcd_url_;
+    std::vector<std::shared_ptr<etcd::SyncClient>> clients_;
+    std::atomic<uint64_t> next_client_{0};
+    std::shared_ptr<folly::CPUThreadPoolExecutor> executor_;
+
+    std::vector<std::unique_ptr<UpdateShard>> update_shards_;     // one per connection
+
+    std::mutex mutex_;      // protects the registration, watcher_ and the record watch
+    ServerRegistration registration_;
+    uint64_t registration_generation_ = 0;
+    std::shared_ptr<etcd::KeepAlive> keepalive_;
+    std::shared_ptr<etcd::Watcher> watcher_;
+    std::shared_ptr<etcd::Watcher> record_watcher_;
+    std::function<void(const std::string &)> on_record_change_;
+    std::function<void()> on_records_lost_;
+    std::atomic<bool> records_watched_{false};
+    std::atomic<uint64_t> record_watch_generation_{0};
 };
 
-#endif // ETCD_CLIENT_H
\ No newline at end of file
+#endif // ETCD_CLIENT_H
@@ -0,0 +1,137 @@
+#ifndef MADFS_FD_CACHE_H
+#define MADFS_FD_CACHE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <folly/container/EvictingCacheMap.h>
+
+#include "Common.h"
+
+DECLARE_uint32(fs_fd_cache_size);
+
+// An open file shared by the cache and the I/O using it, closed by
+// whichever releases it last
+struct OpenFile {
+    explicit OpenFile(int fd) : fd(fd) {}
+
+    ~OpenFile() {
+        close(fd);
+    }
+
+    const int fd;
+};
+
+using OpenFilePtr = std::shared_ptr<OpenFile>;
+
+// LRU of open file descriptors keyed by path, plus the set of directories
+// known to exist, so that steady-state I/O on cached files is one
+// pread/pwrite instead of access + open + close (+ mkdir) each time.
+// Files must be invalidated after they are removed, or the cache keeps
+// their space allocated until eviction. A file opened while an
+// invalidation runs is not cached, it may be the removed one.
+class FdCache {
+public:
+    FdCache(size_t capacity = FLAGS_fs_fd_cache_size)
+            : capacity_(capacity), files_(std::max<size_t>(capacity, 1)) {}
+
+    // flags is O_RDONLY or O_RDWR | O_CREAT, optionally with O_DIRECT.
+    // A writable file serves reads too. Return nullptr with errno set if
+    // the file can not be opened
+    OpenFilePtr Open(const std::string &path, int flags) {
+        const bool writable = (flags & O_ACCMODE) != O_RDONLY;
+        const auto key = BuildKey(path, flags & O_DIRECT);
+        uint64_t generation = 0;
+        if (capacity_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            generation = generation_;
+            auto iter = files_.find(key);
+            if (iter != files_.end() && (iter->second.writable || !writable)) {
+                return iter->second.file;
+            }
+        }
+
+        int fd = open(path.c_str(), flags, 0644);
+        if (fd < 0) {
+            return nullptr;
+        }
+        auto file = std::make_shared<OpenFile>(fd);
+        if (capacity_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (generation == generation_) {
+                files_.set(key, Entry{ file, writable });
+            }
+        }
+        return file;
+    }
+
+    void Invalidate(const std::string &path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation_++;
+        files_.erase(BuildKey(path, false));
+        files_.erase(BuildKey(path, true));
+    }
+
+    int CreateParentDirectories(const std::string &path) {
+        auto pos = path.rfind('/');
+        if (pos == path.npos) {
+            return 0;
+        }
+        auto parent = path.substr(0, pos);
+        {
+            std::lock_guard<std::mutex> lock(dir_mutex_);
+            if (dirs_.count(parent)) {
+                return 0;
+            }
+        }
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(parent, ec);
+        if (ec) {
+            LOG(ERROR) << "Fail to create directory: " << parent << ", " << ec.message();
+            return -1;
+        }
+        std::lock_guard<std::mutex> lock(dir_mutex_);
+        if (dirs_.size() >= kMaxKnownDirectories) {
+            dirs_.clear();
+        }
+        dirs_.insert(parent);
+        return 0;
+    }
+
+    // the directory was removed behind the cache
+    void ForgetParentDirectory(const std::string &path) {
+        auto pos = path.rfind('/');
+        if (pos == path.npos) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(dir_mutex_);
+        dirs_.erase(path.substr(0, pos));
+    }
+
+private:
+    struct Entry {
+        OpenFilePtr file;
+        bool writable;
+    };
+
+    static std::string BuildKey(const std::string &path, bool direct) {
+        // '\0' never appears in a path
+        return direct ? path + std::string(1, '\0') + "D" : path;
+    }
+
+private:
+    static const size_t kMaxKnownDirectories = 1 << 20;
+
+    const size_t capacity_;
+    std::mutex mutex_;
+    folly::EvictingCacheMap<std::string, Entry> files_;
+    uint64_t generation_ = 0;           // bumped by every Invalidate
+
+    std::mutex dir_mutex_;
+    std::unordered_set<std::string> dirs_;
+};
+
+#endif // MADFS_FD_CACHE_H
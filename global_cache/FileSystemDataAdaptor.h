@@ -9,18 +9,21 @@
 #include <string>
 
 #include "Common.h"
+#include "FdCache.h"
+#include "IoUringEngine.h"
 #include "data_adaptor.h"
 
 #include <folly/File.h>
 #include <folly/futures/Future.h>
 #include <folly/futures/Promise.h>
-#include <folly/experimental/io/SimpleAsyncIO.h>
 
 #include <sys/statvfs.h>
 
 using HybridCache::ByteBuffer;
 using HybridCache::DataAdaptor;
 
+DECLARE_string(fs_io_engine);
+
 static inline ssize_t fully_pread(int fd, void* buf, size_t n, size_t offset) {
     ssize_t total_read = 0;
     ssize_t bytes_read;
@@ -61,6 +64,8 @@ class FileSystemDataAdaptor : public DataAdaptor {
     bool use_optimized_path_;
     std::shared_ptr<folly::CPUThreadPoolExecutor> executor_;
     bool fsync_required_;
+    std::shared_ptr<IoUringEngine> io_engine_;
+    FdCache fd_cache_;
 
 public:
     FileSystemDataAdaptor(const std::string &prefix = "", 
@@ -72,7 +77,11 @@ public:
           base_adaptor_(base_adaptor), 
           use_optimized_path_(use_optimized_path), 
           executor_(executor), 
-          fsync_required_(fsync_required) {}
+          fsync_required_(fsync_required) {
+        if (FLAGS_fs_io_engine == "io_uring") {
+            io_engine_ = IoUringEngine::GetInstance();
+        }
+    }
 
     ~FileSystemDataAdaptor() {}
 
@@ -89,82 +98,28 @@ public:
         }
 
         auto path = BuildPath(prefix_, key);
-        if (access(path.c_str(), F_OK)) {
-            if (base_adaptor_) {
-            #if 1
-                size_t full_size;
-                std::map<std::string, std::string> headers;
-                if (base_adaptor_->Head(key, full_size, headers).get()) {
-                    LOG(ERROR) << "Fail to retrive metadata of key: " << key;
-                    return folly::makeFuture(IO_ERROR);
-                }
-                ByteBuffer tmp_buffer(new char[full_size], full_size);
-                return base_adaptor_->DownLoad(key, 0, full_size, tmp_buffer).thenValue([buffer, tmp_buffer, start, size, key](int rc) -> int {
-                    if (rc) {
-                        LOG(ERROR) << "Fail to retrive data of key: " << key;
-                        return IO_ERROR;
-                    }
-                    memcpy(buffer.data, tmp_buffer.data + start, size);
-                    delete []tmp_buffer.data;
-                    return OK;
-                });
-            #else 
-                return base_adaptor_->DownLoad(key, start, size, buffer);
-            #endif
-            } else if (errno == ENOENT) {
-                LOG_IF(ERROR, FLAGS_verbose) << "File not found: " << path;
-                return folly::makeFuture(NOT_FOUND);
-            } else {
-                PLOG(ERROR) << "Fail inaccessible: " << path;
-                return folly::makeFuture(IO_ERROR);
-            }
+        if (io_engine_) {
+            return DownLoadAsync(path, key, start, size, buffer);
         }
 
         butil::Timer t;
         t.start();
 
-        const bool kUseDirectIO = false; // ((uint64_t) buffer.data & 4095) == 0 && (size & 4095) == 0;
-        int flags = O_RDONLY;
-        flags |= kUseDirectIO ? O_DIRECT : 0;
-        int fd = open(path.c_str(), flags);
-        if (fd < 0) {
-            PLOG(ERROR) << "Fail to open file: " << path;
-            return folly::makeFuture(IO_ERROR);
+        auto file = fd_cache_.Open(path, O_RDONLY);
+        if (!file) {
+            return OnOpenFailure(path, key, start, size, buffer);
         }
 
-#ifdef ASYNC_IO
-        if (kUseDirectIO) {
-            thread_local folly::SimpleAsyncIO aio(folly::SimpleAsyncIO::Config().setCompletionExecutor(executor_.get()));
-            auto promise = std::make_shared<folly::Promise<int>>();
-            aio.pread(fd, buffer.data, size, start, [key, size, promise, fd](int rc) {
-                if (rc != size) {
-                    PLOG(ERROR) << "Fail to read file: " << key 
-                                << ", expected read " << size 
-                                << ", actual read " << rc;
-                    close(fd);
-                    promise->setValue(IO_ERROR);
-                } else {
-                    close(fd);
-                    promise->setValue(OK);
-                }
-            });
-            return promise->getFuture();
-        }
-#endif 
-
-        ssize_t nbytes = fully_pread(fd, buffer.data, size, start);
+        ssize_t nbytes = fully_pread(file->fd, buffer.data, size, start);
         if (nbytes != size) {
             PLOG(ERROR) << "Fail to read file: " << key 
                         << ", expected read " << size 
                         << ", actual read " << nbytes;
-            close(fd);
             return folly::makeFuture(IO_ERROR);
         }
 
         t.stop();
         // LOG_EVERY_N(INFO, 1) << t.u_elapsed() << " " << size;
-
-        close(fd);
         return folly::makeFuture(OK);
     }
 
@@ -182,81 +137,44 @@ public:
         }
 
         auto path = BuildPath(prefix_, key);
-        if (CreateParentDirectories(path)) {
+        if (fd_cache_.CreateParentDirectories(path)) {
             return folly::makeFuture(IO_ERROR);
         }
 
+        if (io_engine_) {
+            return UpLoadAsync(path, key, size, buffer, headers);
+        }
+
         t.stop();
         //LOG(INFO) << "Upload P0: " << key << " " << t.u_elapsed() << " " << size;
-        const bool kUseDirectIO = false; // ((uint64_t) buffer.data & 4095) == 0 && (size & 4095) == 0;
-        int flags = O_WRONLY | O_CREAT;
-        flags |= kUseDirectIO ? O_DIRECT : 0;
-        int fd = open(path.c_str(), flags, 0644);
-        if (fd < 0) {
+        auto file = OpenForWrite(path, O_RDWR | O_CREAT);
+        if (!file) {
             PLOG(ERROR) << "Fail to open file: " << path;
             return folly::makeFuture(IO_ERROR);
         }
 
-#ifdef ASYNC_IO
-        if (kUseDirectIO) {
-            thread_local folly::SimpleAsyncIO aio(folly::SimpleAsyncIO::Config().setCompletionExecutor(executor_.get()));
-            auto promise = std::make_shared<folly::Promise<int>>();
-            aio.pwrite(fd, buffer.data, size, 0, [key, size, promise, fd](int rc) {
-                if (rc != size) {
-                    PLOG(ERROR) << "Fail to write file: " << key 
-                                << ", expected " << size 
-                                << ", actual " << rc;
-                    close(fd);
-                    promise->setValue(IO_ERROR);
-                }
-                
-                if (ftruncate64(fd, size) < 0) {
-                    PLOG(ERROR) << "Fail to truncate file: " << key;
-                    close(fd);
-                    return folly::makeFuture(IO_ERROR);
-                }
-
-                if (fsync_required_ && fsync(fd) < 0) {
-                    PLOG(ERROR) << "Fail to sync file: " << key;
-                    close(fd);
-                    return folly::makeFuture(IO_ERROR);
-                }
-
-                close(fd);
-                promise->setValue(OK);
-                
-            });
-            return promise->getFuture();
-        }
-#endif 
-
-        ssize_t nbytes = fully_pwrite(fd, buffer.data, size, 0);
+        ssize_t nbytes = fully_pwrite(file->fd, buffer.data, size, 0);
         if (nbytes != size) {
             PLOG(ERROR) << "Fail to write file: " << key 
                         << ", expected read " << size 
                         << ", actual read " << nbytes;
-            close(fd);
             return folly::makeFuture(IO_ERROR);
         }
 
         t.stop();
         //LOG(INFO) << "Upload P2: " << key << " " << t.u_elapsed() << " " << size;
-        if (ftruncate64(fd, size) < 0) {
+        if (ftruncate64(file->fd, size) < 0) {
             PLOG(ERROR) << "Fail to truncate file: " << key;
-            close(fd);
             return folly::makeFuture(IO_ERROR);
         }
 
         t.stop();
         //LOG(INFO) << "Upload P3: " << key << " " << t.u_elapsed() << " " << size;
-        if (fsync_required_ && fsync(fd) < 0) {
+        if (fsync_required_ && fsync(file->fd) < 0) {
             PLOG(ERROR) << "Fail to sync file: " << key;
-            close(fd);
             return folly::makeFuture(IO_ERROR);
         }
 
-        close(fd);
-
         if (base_adaptor_) {
             return base_adaptor_->UpLoad(key, size, buffer, headers);
         } 
@@ -268,7 +186,11 @@ public:
     virtual folly::Future<int> Delete(const std::string &key) {
         LOG_IF(INFO, FLAGS_verbose) << "Delete key: " << key;
         auto path = BuildPath(prefix_, key);
-        if (remove(path.c_str())) {
+        // after the remove, so that no reader caches the old file again
+        const int err = remove(path.c_str()) ? errno : 0;
+        fd_cache_.Invalidate(path);
+        if (err) {
+            errno = err;
             if (errno == ENOENT) {
                 LOG_IF(ERROR, FLAGS_verbose) << "File not found: " << path;
                 return folly::makeFuture(NOT_FOUND);
@@ -309,6 +231,174 @@ public:
         return folly::makeFuture(OK);
     }
 
+private:
+    // Requests fitting a registered buffer go through it with O_DIRECT,
+    // widened to the alignment; larger ones are buffered I/O on the user
+    // buffer. Completions continue on the executor when there is one.
+    folly::Future<int> DownLoadAsync(const std::string &path,
+                                     const std::string &key,
+                                     size_t start,
+                                     size_t size,
+                                     ByteBuffer &buffer) {
+        const size_t kAlign = IoUringEngine::kDirectIOAlign;
+        const size_t align_start = start & ~(kAlign - 1);
+        const size_t align_len = ((start + size + kAlign - 1) & ~(kAlign - 1)) - align_start;
+        char *bounce = nullptr;
+        int buf_index = -1;
+        if (align_len <= io_engine_->GetBufferSize()) {
+            buf_index = io_engine_->AcquireBuffer(bounce);
+        }
+
+        auto file = OpenForAsync(path, O_RDONLY, buf_index);
+        if (!file) {
+            return OnOpenFailure(path, key, start, size, buffer);
+        }
+
+        auto engine = io_engine_;
+        auto future = buf_index >= 0 ? engine->Read(file->fd, bounce, align_len, align_start, buf_index)
+                                     : engine->Read(file->fd, buffer.data, size, start);
+        if (executor_) {
+            future = std::move(future).via(executor_.get());
+        }
+        ByteBuffer user_buffer = buffer;
+        return std::move(future).thenValue([engine, file, key, start, size, align_start, bounce, buf_index, user_buffer](ssize_t res) -> int {
+            // the range must be complete, an O_DIRECT read may stop short at end of file
+            const ssize_t expected = buf_index >= 0 ? start + size - align_start : size;
+            if (res >= expected && buf_index >= 0) {
+                memcpy(user_buffer.data, bounce + (start - align_start), size);
+            }
+            if (buf_index >= 0) {
+                engine->ReleaseBuffer(buf_index);
+            }
+            if (res < expected) {
+                LOG(ERROR) << "Fail to read file: " << key
+                           << ", expected read " << expected
+                           << ", actual read " << res;
+                return IO_ERROR;
+            }
+            return OK;
+        });
+    }
+
+    folly::Future<int> UpLoadAsync(const std::string &path,
+                                   const std::string &key,
+                                   size_t size,
+                                   const ByteBuffer &buffer,
+                                   const std::map <std::string, std::string> &headers) {
+        const size_t kAlign = IoUringEngine::kDirectIOAlign;
+        const size_t align_len = (size + kAlign - 1) & ~(kAlign - 1);
+        char *bounce = nullptr;
+        int buf_index = -1;
+        if (align_len <= io_engine_->GetBufferSize()) {
+            buf_index = io_engine_->AcquireBuffer(bounce);
+        }
+
+        auto file = OpenForAsync(path, O_RDWR | O_CREAT, buf_index);
+        if (!file) {
+            PLOG(ERROR) << "Fail to open file: " << path;
+            return folly::makeFuture(IO_ERROR);
+        }
+        const int fd = file->fd;
+
+        auto engine = io_engine_;
+        folly::Future<ssize_t> future = folly::makeFuture<ssize_t>(0);
+        ssize_t expected;
+        if (buf_index >= 0) {
+            memcpy(bounce, buffer.data, size);
+            memset(bounce + size, 0, align_len - size);
+            expected = align_len;
+            future = engine->Write(fd, bounce, align_len, 0, buf_index);
+        } else {
+            expected = size;
+            future = engine->Write(fd, buffer.data, size, 0);
+        }
+
+        const bool fsync_required = fsync_required_;
+        auto f = std::move(future).thenValue([engine, fd, key, size, expected, buf_index, fsync_required](ssize_t res) -> folly::Future<ssize_t> {
+            if (buf_index >= 0) {
+                engine->ReleaseBuffer(buf_index);
+            }
+            if (res != expected) {
+                LOG(ERROR) << "Fail to write file: " << key
+                           << ", expected " << expected
+                           << ", actual " << res;
+                return folly::makeFuture<ssize_t>(-EIO);
+            }
+            // drop the alignment padding
+            if (ftruncate64(fd, size) < 0) {
+                PLOG(ERROR) << "Fail to truncate file: " << key;
+                return folly::makeFuture<ssize_t>(-errno);
+            }
+            if (fsync_required) {
+                return engine->Fsync(fd);
+            }
+            return folly::makeFuture<ssize_t>(0);
+        });
+        if (executor_) {
+            f = std::move(f).via(executor_.get());
+        }
+        auto base_adaptor = base_adaptor_;
+        return std::move(f).thenValue([file, key, size, buffer, headers, base_adaptor](ssize_t res) -> folly::Future<int> {
+            if (res < 0) {
+                LOG(ERROR) << "Fail to persist file: " << key << ", error: " << strerror(-res);
+                return folly::makeFuture(IO_ERROR);
+            }
+            if (base_adaptor) {
+                return base_adaptor->UpLoad(key, size, buffer, headers);
+            }
+            return folly::makeFuture(OK);
+        });
+    }
+
+    // O_DIRECT when a bounce buffer is held, falls back to buffered I/O
+    // on file systems without O_DIRECT
+    OpenFilePtr OpenForAsync(const std::string &path, int flags, int &buf_index) {
+        if (buf_index >= 0) {
+            auto file = (flags & O_CREAT) ? OpenForWrite(path, flags | O_DIRECT)
+                                          : fd_cache_.Open(path, flags | O_DIRECT);
+            if (file || errno != EINVAL) {
+                if (!file) {
+                    io_engine_->ReleaseBuffer(buf_index);
+                    buf_index = -1;
+                }
+                return file;
+            }
+            io_engine_->ReleaseBuffer(buf_index);
+            buf_index = -1;
+        }
+        return (flags & O_CREAT) ? OpenForWrite(path, flags) : fd_cache_.Open(path, flags);
+    }
+
+    // the parent directory may have been removed behind the known set
+    OpenFilePtr OpenForWrite(const std::string &path, int flags) {
+        auto file = fd_cache_.Open(path, flags);
+        if (!file && errno == ENOENT) {
+            fd_cache_.ForgetParentDirectory(path);
+            if (fd_cache_.CreateParentDirectories(path) == 0) {
+                file = fd_cache_.Open(path, flags);
+            }
+        }
+        return file;
+    }
+
+    folly::Future<int> OnOpenFailure(const std::string &path,
+                                     const std::string &key,
+                                     size_t start,
+                                     size_t size,
+                                     ByteBuffer &buffer) {
+        if (errno == ENOENT) {
+            if (base_adaptor_) {
+                // only the requested range, nothing is persisted
+                return base_adaptor_->DownLoad(key, start, size, buffer);
+            }
+            LOG_IF(ERROR, FLAGS_verbose) << "File not found: " << path;
+            return folly::makeFuture(NOT_FOUND);
+        }
+        PLOG(ERROR) << "Fail to open file: " << path;
+        return folly::makeFuture(IO_ERROR);
+    }
+
+public:
     std::string BuildPath(const std::string &prefix, const std::string &key) {
         if (use_optimized_path_) {
             std::size_t h1 = std::hash<std::string>{}(key);
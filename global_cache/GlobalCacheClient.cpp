@@ -163,6 +163,95 @@ Future<GetOutput> GlobalCacheClient::GetEntry(int server_id,
     return std::move(future);
 }
 
+Future<std::vector<GetOutput>> GlobalCacheClient::BatchGetEntryFromReadCache(int server_id,
+                                                                            const std::vector<GetEntryArgs> &entries) {
+    uint64_t total_length = 0;
+    for (auto &entry : entries) {
+        total_length += entry.length;
+    }
+    inflight_payload_size_.fetch_add(total_length);
+
+    auto channel = GetChannelByServerId(server_id);
+    if (!channel) {
+        inflight_payload_size_.fetch_sub(total_length);
+        std::vector<GetOutput> output(entries.size());
+        for (auto &entry : output) {
+            entry.status = RPC_FAILED;
+        }
+        return folly::makeFuture(std::move(output));
+    }
+
+    gcache::GlobalCacheService_Stub stub(channel);
+    gcache::BatchGetEntryRequest request;
+    for (auto &entry : entries) {
+        auto item = request.add_entries();
+        item->set_key(entry.key);
+        item->set_start(entry.start);
+        item->set_length(entry.length);
+    }
+
+    struct OnRPCDone : public google::protobuf::Closure {
+        virtual void Run() {
+            std::vector<GetOutput> output(entries.size());
+            bool failed = cntl.Failed();
+            if (failed) {
+                LOG(WARNING) << "RPC error: " << cntl.ErrorText()
+                             << ", server id: " << server_id
+                             << ", entries: " << entries.size();
+            } else if ((size_t) response.status_code_size() != entries.size()) {
+                LOG(WARNING) << "Received " << response.status_code_size() << " status codes"
+                             << " for " << entries.size() << " entries"
+                             << ", server id: " << server_id;
+                failed = true;
+            }
+
+            auto &attachment = cntl.response_attachment();
+            for (size_t i = 0; i < entries.size() && !failed; ++i) {
+                output[i].status = response.status_code(i);
+                if (output[i].status != OK) {
+                    continue;
+                }
+                if (attachment.cutn(&output[i].buf, entries[i].length) != entries[i].length) {
+                    LOG(WARNING) << "Received truncated attachment"
+                                 << ", server id: " << server_id
+                                 << ", key: " << entries[i].key
+                                 << ", start: " << entries[i].start
+                                 << ", length: " << entries[i].length;
+                    failed = true;
+                }
+            }
+            if (failed) {
+                for (auto &entry : output) {
+                    entry.status = RPC_FAILED;
+                    entry.buf.clear();
+                }
+            }
+            promise.setValue(std::move(output));
+            parent->inflight_payload_size_.fetch_sub(total_length);
+            delete this;
+        }
+
+        brpc::Controller cntl;
+        gcache::BatchGetEntryResponse response;
+        Promise<std::vector<GetOutput>> promise;
+
+        int server_id;
+        std::vector<GetEntryArgs> entries;
+        uint64_t total_length;
+        GlobalCacheClient *parent;
+    };
+
+    auto done = new OnRPCDone();
+    done->parent = this;
+    done->server_id = server_id;
+    done->entries = entries;
+    done->total_length = total_length;
+
+    auto future = done->promise.getFuture();
+    stub.BatchGetEntryFromReadCache(&done->cntl, &request, &done->response, done);
+    return std::move(future);
+}
+
 Future<PutOutput> GlobalCacheClient::PutEntry(int server_id, 
                                               const std::string &key, 
                                               const ByteBuffer &buf, 
@@ -12,6 +12,12 @@
 
 using HybridCache::ByteBuffer;
 
+struct GetEntryArgs {
+    std::string key;
+    uint64_t start;
+    uint64_t length;
+};
+
 class GlobalCacheClient {
 public:
     GlobalCacheClient(const std::string &group = "");
@@ -24,6 +30,10 @@ public:
         return GetEntry(server_id, key, start, length, true);
     }
 
+    // One RPC for many entries of the same server. The outputs are in the
+    // order of the entries; all of them are RPC_FAILED if the RPC fails.
+    Future<std::vector<GetOutput>> BatchGetEntryFromReadCache(int server_id, const std::vector<GetEntryArgs> &entries);
+
     Future<PutOutput> PutEntryFromReadCache(int server_id, const std::string &key, const ByteBuffer &buf, uint64_t length) {
         return PutEntry(server_id, key, buf, length, true);
     }
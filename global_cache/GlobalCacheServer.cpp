@@ -25,6 +25,35 @@ namespace gcache {
         });
     }
 
+    void GlobalCacheServiceImpl::BatchGetEntryFromReadCache(google::protobuf::RpcController *cntl_base,
+                                                            const BatchGetEntryRequest *request,
+                                                            BatchGetEntryResponse *response,
+                                                            google::protobuf::Closure *done) {
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(cntl_base);
+        std::vector<folly::Future<GetOutput>> future_list;
+        for (auto &entry : request->entries()) {
+            future_list.emplace_back(read_cache_->Get(entry.key(), entry.start(), entry.length()));
+        }
+        folly::collectAll(std::move(future_list)).via(executor_.get())
+                .thenValue([cntl, request, response, done](std::vector<folly::Try<GetOutput>> &&output) {
+            for (size_t i = 0; i < output.size(); ++i) {
+                if (!output[i].hasValue()) {
+                    response->add_status_code(FOLLY_ERROR);
+                    continue;
+                }
+                auto &entry = output[i].value();
+                if (entry.status == OK && entry.buf.length() != request->entries(i).length()) {
+                    entry.status = IO_ERROR;
+                }
+                response->add_status_code(entry.status);
+                if (entry.status == OK) {
+                    cntl->response_attachment().append(entry.buf);
+                }
+            }
+            done->Run();
+        });
+    }
+
     void GlobalCacheServiceImpl:: PutEntryFromReadCache(google::protobuf::RpcController *cntl_base,
                                                         const PutEntryRequest *request,
                                                         PutEntryResponse *response,
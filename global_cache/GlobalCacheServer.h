@@ -29,6 +29,11 @@ namespace gcache {
                                            GetEntryResponse *response,
                                            google::protobuf::Closure *done);
 
+        virtual void BatchGetEntryFromReadCache(google::protobuf::RpcController *cntl_base,
+                                                const BatchGetEntryRequest *request,
+                                                BatchGetEntryResponse *response,
+                                                google::protobuf::Closure *done);
+
         virtual void PutEntryFromReadCache(google::protobuf::RpcController *cntl_base,
                                            const PutEntryRequest *request,
                                            PutEntryResponse *response,
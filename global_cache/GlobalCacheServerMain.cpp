@@ -1,10 +1,16 @@
 #include "GlobalCacheServer.h"
 #include "S3DataAdaptor.h"
+#include "EtcdClient.h"
 
 #include <folly/Singleton.h>
+#include <unistd.h>
 
 DEFINE_int32(port, 8000, "TCP Port of global cache server");
-DEFINE_bool(fetch_s3_if_miss, false, "Allow fetch data from S3 if cache miss");
+DEFINE_bool(fetch_s3_if_miss, true, "Fill read cache misses from S3, clients never fill the read cache themselves");
+DEFINE_string(etcd_server, "", "Register this server in etcd for dynamic membership, disabled if empty");
+DEFINE_int32(server_id, -1, "Server id in the cluster, required by etcd registration");
+DEFINE_string(server_address, "", "Address advertised to clients, <hostname>:<port> if empty");
+DEFINE_int32(etcd_lease_ttl, 10, "TTL of the etcd registration in seconds");
 
 int main(int argc, char *argv[]) {
     LOG(INFO) << "MADFS Global Cache Server";
@@ -36,6 +42,27 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    std::shared_ptr<EtcdClient> etcd_client;
+    if (!FLAGS_etcd_server.empty()) {
+        if (FLAGS_server_id < 0) {
+            LOG(ERROR) << "Server id is required by etcd registration";
+            return -1;
+        }
+        std::string address = FLAGS_server_address;
+        if (address.empty()) {
+            char hostname[256] = { 0 };
+            gethostname(hostname, sizeof(hostname) - 1);
+            address = std::string(hostname) + ":" + std::to_string(FLAGS_port);
+        }
+        etcd_client = std::make_shared<EtcdClient>(FLAGS_etcd_server);
+        if (etcd_client->RegisterServer(FLAGS_server_id, address,
+                                        GetGlobalConfig().read_cache.CacheCfg.MaxCacheSize,
+                                        FLAGS_etcd_lease_ttl)) {
+            LOG(ERROR) << "Failed to register global cache server in etcd";
+            return -1;
+        }
+    }
+
     server.RunUntilAskedToQuit();
     return 0;
 }
@@ -1,13 +1,27 @@
+#include <boost/algorithm/string.hpp>
+
 #include "GlobalDataAdaptor.h"
 #include "ReadCacheClient.h"
 #include "ReplicationWriteCacheClient.h"
 #include "ErasureCodingWriteCacheClient.h"
+#include "SlidingWindow.h"
+#include "S3DataAdaptor.h"
 
 using HybridCache::ByteBuffer;
 
 #define CONFIG_GC_ON_EXCEEDING_DISKSPACE
 
 DEFINE_uint32(bg_execution_period, 10, "Background execution period in seconds");
+DEFINE_uint32(gc_interval_sec, 0, "Period of the background GC in seconds, 0 to run it only when disks are full");
+DEFINE_uint64(gc_flush_window, 1024 * 1024 * 1024, "Bytes of objects flushed to the base adaptor concurrently by GC");
+DEFINE_uint32(gc_meta_concurrency, 64, "Metadata records loaded concurrently by GC");
+DEFINE_uint64(gc_reclaim_bytes, 4ull * 1024 * 1024 * 1024, "Bytes flushed by GC between two reclamations of write cache space");
+DEFINE_uint32(gc_backpressure_ms, 1000, "Time an upload to full disks waits for GC before retrying");
+DEFINE_uint64(deep_flush_part_size, 16 * 1024 * 1024, "Part size of the multipart uploads of DeepFlush");
+DEFINE_uint32(deep_flush_parts, 4, "Parts of an object held in memory by DeepFlush");
+DEFINE_uint32(gc_backpressure_retries, 30, "Retries of an upload to full disks before it fails");
+DECLARE_string(server_weights);
+DECLARE_uint64(placement_weight_unit_mb);
 
 GlobalDataAdaptor::GlobalDataAdaptor(std::shared_ptr<DataAdaptor> base_adaptor,
                                      const std::vector<std::string> &server_list,
@@ -22,53 +36,153 @@ GlobalDataAdaptor::GlobalDataAdaptor(std::shared_ptr<DataAdaptor> base_adaptor,
         executor_ = std::make_shared<folly::CPUThreadPoolExecutor>(GetGlobalConfig().folly_threads);
     } 
     
+    replica_selector_ = std::make_shared<ReplicaSelector>(executor_);
+
     read_cache_ = std::make_shared<ReadCacheClient>(this);
     write_caches_[WC_TYPE_REPLICATION] = std::make_shared<ReplicationWriteCacheClient>(this);
     write_caches_[WC_TYPE_REEDSOLOMON] = std::make_shared<ErasureCodingWriteCacheClient>(this);
 
     for (int conn_id = 0; conn_id < GetGlobalConfig().rpc_connections; conn_id++) {
-        auto client = std::make_shared<GlobalCacheClient>(std::to_string(conn_id));
-        int server_id = 0;
-        for (auto &entry: server_list_) {
-            if (client->RegisterServer(server_id, entry.c_str())) {
-                // TODO 周期性尝试重连
-                LOG(WARNING) << "Failed to connect with server id: " << server_id
-                             << ", address: " << entry;
-                bg_mutex_.lock();
-                bg_tasks_.push_back([client,server_id, entry]() -> int { 
-                    return client->RegisterServer(server_id, entry.c_str()); 
-                });
-                bg_mutex_.unlock();
-            }
-            server_id++;
+        rpc_client_.push_back(std::make_shared<GlobalCacheClient>(std::to_string(conn_id)));
+    }
+
+    placement_ = BuildStaticPlacement();
+    for (auto &entry : placement_->GetServers()) {
+        ConnectServer(entry.first, entry.second);
+    }
+
+    // servers registered in etcd join and leave without restarting the client
+    if (etcd_client_) {
+        RefreshMembership();
+        etcd_client_->WatchServers([this]() { RefreshMembership(); });
+        // records put or deleted by other clients drop the cached metadata
+        if (GetGlobalConfig().use_meta_cache) {
+            etcd_client_->WatchRecords([this](const std::string &key) { InvalidateMetaCacheEntry(key); },
+                                       [this]() { InvalidateMetaCache(); });
         }
-        rpc_client_.push_back(client);
     }
+
     srand48(time(nullptr));
     bg_running_ = true;
     bg_thread_ = std::thread(std::bind(&GlobalDataAdaptor::BackgroundWorker, this));
+    if (etcd_client_) {
+        gc_thread_ = std::thread(std::bind(&GlobalDataAdaptor::GarbageCollectionWorker, this));
+    }
 }
 
 GlobalDataAdaptor::~GlobalDataAdaptor() {
+    if (etcd_client_) {
+        etcd_client_->StopWatchServers();
+        etcd_client_->StopWatchRecords();
+    }
     bg_running_ = false;
     bg_cv_.notify_all();
     bg_thread_.join();
+    if (gc_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(gc_mutex_);
+            gc_cv_.notify_all();
+        }
+        gc_thread_.join();
+    }
 }
 
 void GlobalDataAdaptor::BackgroundWorker() {
     while (bg_running_) {
-        std::unique_lock<std::mutex> lock(bg_mutex_);
+        std::vector<std::function<int()>> bg_tasks_now;
+        {
+            std::lock_guard<std::mutex> lock(bg_mutex_);
+            bg_tasks_now.swap(bg_tasks_);
+        }
+        // tasks may queue new tasks, run them without bg_mutex_
         std::vector<std::function<int()>> bg_tasks_next;
-        for (auto &entry : bg_tasks_) {
+        for (auto &entry : bg_tasks_now) {
             if (entry()) {
                 bg_tasks_next.push_back(entry);
             }
         }
-        bg_tasks_ = bg_tasks_next;
+        // catch up with the membership changes of a broken watch
+        if (etcd_client_) {
+            RefreshMembership();
+            // drop what was cached before the new watch took over
+            if (etcd_client_->RewatchRecords()) {
+                InvalidateMetaCache();
+            }
+        }
+        std::unique_lock<std::mutex> lock(bg_mutex_);
+        bg_tasks_.insert(bg_tasks_.end(), bg_tasks_next.begin(), bg_tasks_next.end());
         bg_cv_.wait_for(lock, std::chrono::seconds(FLAGS_bg_execution_period));
     }
 }
 
+std::shared_ptr<PlacementRing> GlobalDataAdaptor::BuildStaticPlacement() const {
+    std::vector<std::string> weights;
+    boost::split(weights, FLAGS_server_weights, boost::is_any_of(","), boost::token_compress_on);
+    auto placement = std::make_shared<PlacementRing>();
+    for (int server_id = 0; server_id < server_list_.size(); ++server_id) {
+        int weight = 1;
+        if (server_id < weights.size() && !weights[server_id].empty())
+            weight = std::stoi(weights[server_id]);
+        placement->AddServer(server_id, server_list_[server_id], weight);
+    }
+    return placement;
+}
+
+void GlobalDataAdaptor::ConnectServer(int server_id, const std::string &address) {
+    for (auto &client : rpc_client_) {
+        if (!client->RegisterServer(server_id, address.c_str())) {
+            continue;
+        }
+        LOG(WARNING) << "Failed to connect with server id: " << server_id
+                     << ", address: " << address;
+        std::lock_guard<std::mutex> lock(bg_mutex_);
+        bg_tasks_.push_back([this, client, server_id, address]() -> int {
+            // the server left or re-registered with another address
+            auto placement = GetPlacement();
+            auto iter = placement->GetServers().find(server_id);
+            if (iter == placement->GetServers().end() || iter->second != address) {
+                return OK;
+            }
+            return client->RegisterServer(server_id, address.c_str());
+        });
+    }
+}
+
+int GlobalDataAdaptor::RefreshMembership() {
+    std::map<int, EtcdClient::ServerInfo> members;
+    int rc = etcd_client_->ListServers(members);
+    if (rc) {
+        return rc;
+    }
+
+    std::lock_guard<std::mutex> lock(membership_mutex_);
+    auto current = GetPlacement();
+    auto placement = BuildStaticPlacement();
+    const uint64_t weight_unit = FLAGS_placement_weight_unit_mb * 1024 * 1024;
+    for (auto &entry : members) {
+        const int server_id = entry.first;
+        const std::string &address = entry.second.address;
+        const int weight = std::max<uint64_t>(1, entry.second.capacity / std::max<uint64_t>(weight_unit, 1));
+        auto iter = current->GetServers().find(server_id);
+        if (iter == current->GetServers().end() || iter->second != address) {
+            LOG(INFO) << "Server joined, server id: " << server_id
+                      << ", address: " << address
+                      << ", weight: " << weight;
+            // connect before the server is visible to placement
+            ConnectServer(server_id, address);
+        }
+        placement->AddServer(server_id, address, weight);
+    }
+    for (auto &entry : current->GetServers()) {
+        if (!placement->Contains(entry.first)) {
+            LOG(INFO) << "Server left, server id: " << entry.first
+                      << ", address: " << entry.second;
+        }
+    }
+    std::atomic_store(&placement_, std::shared_ptr<const PlacementRing>(placement));
+    return OK;
+}
+
 struct DownloadArgs {
     DownloadArgs(const std::string &key, size_t start, size_t size, ByteBuffer &buffer)
             : key(key), start(start), size(size), buffer(buffer) {}
@@ -131,7 +245,7 @@ folly::Future<int> GlobalDataAdaptor::DownLoadFromGlobalCache(const std::string
                 return read_cache_->Get(key, start, size, buffer);
             }
         } else {
-            return etcd_client_->GetJson(key).then(
+            return etcd_client_->GetJson(key).via(executor_.get()).then(
                     [this, args, meta_cache_entry](folly::Try<EtcdClient::GetResult> &&output) -> folly::Future<int> {
                 if (!output.hasValue()) {                   // 当 GetJson 函数抛出异常时执行这部分代码
                     LOG(ERROR) << "Failed to download data, reason: internal error, key: " << args->key
@@ -142,7 +256,7 @@ folly::Future<int> GlobalDataAdaptor::DownLoadFromGlobalCache(const std::string
 
                 auto &status = output.value().status;
                 if (status == NOT_FOUND) {
-                    if (GetGlobalConfig().use_meta_cache) {
+                    if (UseMetaCache()) {
                         return base_adaptor_->Head(args->key, meta_cache_entry->size, meta_cache_entry->headers).then(
                                 [this, meta_cache_entry, args](folly::Try<int> &&output) -> folly::Future<int> {
                             int res = output.value_or(FOLLY_ERROR);
@@ -164,7 +278,7 @@ folly::Future<int> GlobalDataAdaptor::DownLoadFromGlobalCache(const std::string
                 }
 
                 auto &root = output.value().root;
-                if (GetGlobalConfig().use_meta_cache) {
+                if (UseMetaCache()) {
                     meta_cache_entry->present = true;
                     meta_cache_entry->existed = true;
                     meta_cache_entry->write_cached = true;
@@ -199,18 +313,9 @@ folly::Future<int> GlobalDataAdaptor::UpLoad(const std::string &key,
                                              const ByteBuffer &buffer,
                                              const std::map <std::string, std::string> &headers) {
 #ifdef CONFIG_GC_ON_EXCEEDING_DISKSPACE
-    return DoUpLoad(key, size, buffer, headers).thenValue([this, key, size, &buffer, &headers](int &&res) -> int {
-        if (res != NO_ENOUGH_DISKSPACE) {
-            return res;
-        }
-        LOG(INFO) << "Disk limit exceeded - perform GC immediately";
-        res = PerformGarbageCollection();
-        if (res) {
-            LOG(WARNING) << "GC failed";
-            return res;
-        }
-        LOG(INFO) << "Disk limit exceeded - GC completed, now retry";
-        return DoUpLoad(key, size, buffer, headers).get();
+    // headers are copied, the retries may run after the caller returns
+    return RetryOnFullDisk(key, [this, key, size, &buffer, headers]() {
+        return DoUpLoad(key, size, buffer, headers);
     });
 #else
     return DoUpLoad(key, size, buffer, headers);
@@ -238,24 +343,31 @@ folly::Future<int> GlobalDataAdaptor::DoUpLoad(const std::string &key,
             .then(std::bind(&WriteCacheClient::Put, write_cache.get(), key, size, buffer, headers, 0))
             .then([this, key, meta_cache_entry, t] (folly::Try<WriteCacheClient::PutResult> output) -> folly::Future<int> {
                 int status = output.hasValue() ? output.value().status : FOLLY_ERROR;
-                if (status == OK) {
-                    status = etcd_client_->PutJson(key, output.value().root).get();
-                    if (status == OK && GetGlobalConfig().use_meta_cache) {
-                        meta_cache_entry->root = output.value().root;
-                        meta_cache_entry->write_cached = true;
-                        meta_cache_entry->present = true;
-                    }
-                    t->stop();
-                    LOG(INFO) << "JSON: " << t->u_elapsed();
+                if (status != OK) {
                     delete t;
+                    return folly::makeFuture(status);
                 }
-                return folly::makeFuture(status);
+                // the put is batched with others by the etcd client, do
+                // not hold a thread of the executor meanwhile
+                auto root = std::move(output.value().root);
+                return etcd_client_->PutJson(key, root)
+                    .thenValue([this, meta_cache_entry, root, t](int &&res) -> int {
+                        if (res == OK && UseMetaCache()) {
+                            meta_cache_entry->root = root;
+                            meta_cache_entry->write_cached = true;
+                            meta_cache_entry->present = true;
+                        }
+                        t->stop();
+                        LOG(INFO) << "JSON: " << t->u_elapsed();
+                        delete t;
+                        return res;
+                    });
             });
     } else if (policy.write_cache_type == NOCACHE) {
         return std::move(pre_op)
             .then(std::bind(&DataAdaptor::UpLoad, base_adaptor_.get(), key, size, buffer, headers))
-            .thenValue([meta_cache_entry](int &&res) -> int {
-                if (res == OK && GetGlobalConfig().use_meta_cache) {
+            .thenValue([this, meta_cache_entry](int &&res) -> int {
+                if (res == OK && UseMetaCache()) {
                     meta_cache_entry->write_cached = false;
                     meta_cache_entry->present = true;
                 }
@@ -314,43 +426,53 @@ struct DeepFlushArgs {
     std::string key;
     std::map <std::string, std::string> headers;
     ByteBuffer buffer;
+    Json::Value root;
+    std::string upload_id;
+    std::vector<std::string> etags;
 };
 
+// S3 rejects parts smaller than this, except the last one
+static const size_t kMinPartSize = 5 * 1024 * 1024;
+
 folly::Future<int> GlobalDataAdaptor::DeepFlush(const std::string &key) {
     butil::Timer *t = new butil::Timer();
     t->start();
     auto &policy = GetCachePolicy(key);
     if (policy.write_cache_type == REPLICATION || policy.write_cache_type == REED_SOLOMON) {
         auto args = std::make_shared<DeepFlushArgs>(key);
-        return etcd_client_->GetJson(key).then([this, t, args](folly::Try<EtcdClient::GetResult> &&output) -> folly::Future<int> {
+        return etcd_client_->GetJson(key).via(executor_.get()).then([this, t, args](folly::Try<EtcdClient::GetResult> &&output) -> folly::Future<int> {
             if (!output.hasValue()) {
                 return folly::makeFuture(FOLLY_ERROR);
             }
             if (output.value().status != OK) {
                 return folly::makeFuture(output.value().status);
             }
-            auto &root = output.value().root;
+            args->root = output.value().root;
+            auto &root = args->root;
             args->buffer.len = root["size"].asInt64();
-            args->buffer.data = new char[args->buffer.len];
             for (auto iter = root["headers"].begin(); iter != root["headers"].end(); iter++) {
                 args->headers[iter.key().asString()] = (*iter).asString();
             }
             t->stop();
             LOG(INFO) << "DeepFlush phase 1: " << t->u_elapsed();
 
-            return DownLoad(args->key, 0, args->buffer.len, args->buffer);
-        }).then([this, t, args](folly::Try<int> &&output) -> folly::Future<int> {
-            int res = output.value_or(FOLLY_ERROR);
-            t->stop();
-            LOG(INFO) << "DeepFlush phase 2: " << t->u_elapsed();
-            if (res != OK) {
-                return folly::makeFuture(res);
-            } else {
-                return base_adaptor_->UpLoad(args->key, args->buffer.len, args->buffer, args->headers);
+            auto s3_adaptor = std::dynamic_pointer_cast<S3DataAdaptor>(base_adaptor_);
+            if (s3_adaptor && args->buffer.len > std::max<size_t>(FLAGS_deep_flush_part_size, kMinPartSize)) {
+                return DeepFlushByParts(args, s3_adaptor);
             }
+
+            args->buffer.data = new char[args->buffer.len];
+            return DownLoad(args->key, 0, args->buffer.len, args->buffer).then([this, args](folly::Try<int> &&output) -> folly::Future<int> {
+                int res = output.value_or(FOLLY_ERROR);
+                if (res != OK) {
+                    return folly::makeFuture(res);
+                }
+                return base_adaptor_->UpLoad(args->key, args->buffer.len, args->buffer, args->headers);
+            });
         }).then([this, t, key, args](folly::Try<int> &&output) -> folly::Future<int> {
             t->stop();
-            LOG(INFO) << "DeepFlush phase 3: " << t->u_elapsed();
+            LOG(INFO) << "DeepFlush phase 2: " << t->u_elapsed();
+            delete t;
             int res = output.value_or(FOLLY_ERROR);
             if (res != OK) {
                 return folly::makeFuture(res);
@@ -361,11 +483,65 @@ folly::Future<int> GlobalDataAdaptor::DeepFlush(const std::string &key) {
         });
     } else {
         t->stop();
-        LOG(INFO) << "DeepFlush phase 4: " << t->u_elapsed();
+        LOG(INFO) << "DeepFlush phase 3: " << t->u_elapsed();
+        delete t;
         return folly::makeFuture(OK);
     }
 }
 
+struct DeepFlushPart {
+    DeepFlushPart(size_t len) : buffer(new char[len], len) {}
+    ~DeepFlushPart() { delete []buffer.data; }
+
+    ByteBuffer buffer;
+    Json::Value root;
+};
+
+// Stream the object part by part into a multipart upload: a part is
+// read from the write cache, then uploaded while the following parts
+// are read, so at most deep_flush_parts parts are held in memory
+folly::Future<int> GlobalDataAdaptor::DeepFlushByParts(std::shared_ptr<DeepFlushArgs> args,
+                                                       std::shared_ptr<S3DataAdaptor> s3_adaptor) {
+    return s3_adaptor->CreateMultipartUpload(args->key, args->headers, args->upload_id)
+            .thenValue([this, args, s3_adaptor](int &&res) -> folly::Future<int> {
+        if (res != OK) {
+            return folly::makeFuture(res);
+        }
+        const size_t size = args->buffer.len;
+        const size_t part_size = std::max<size_t>(FLAGS_deep_flush_part_size, kMinPartSize);
+        std::vector<size_t> part_sizes;
+        for (size_t off = 0; off < size; off += part_size) {
+            part_sizes.push_back(std::min(part_size, size - off));
+        }
+        args->etags.resize(part_sizes.size());
+
+        auto write_cache = args->root["type"] == "reed-solomon"
+                           ? write_caches_[WC_TYPE_REEDSOLOMON]
+                           : write_caches_[WC_TYPE_REPLICATION];
+        return SlidingWindow::Run(part_sizes, part_size * std::max(FLAGS_deep_flush_parts, 1u),
+                                  [args, s3_adaptor, write_cache, part_size, part_sizes](size_t index) -> folly::Future<int> {
+            auto part = std::make_shared<DeepFlushPart>(part_sizes[index]);
+            part->root = args->root;    // Get() may touch it, one copy per part
+            return write_cache->Get(args->key, index * part_size, part_sizes[index], part->buffer, part->root)
+                    .thenValue([args, s3_adaptor, part, index](int &&res) -> folly::Future<int> {
+                if (res != OK) {
+                    return folly::makeFuture(res);
+                }
+                return s3_adaptor->UpLoadPart(args->key, args->upload_id, index + 1, part->buffer, args->etags[index])
+                        .ensure([args, part] {});   // buffers and etag outlive the upload
+            });
+        }).thenValue([args, s3_adaptor](int &&res) -> folly::Future<int> {
+            if (res == OK) {
+                return s3_adaptor->CompleteMultipartUpload(args->key, args->upload_id, args->etags);
+            }
+            LOG(ERROR) << "Failed to flush key " << args->key << " by parts, status: " << res;
+            return s3_adaptor->AbortMultipartUpload(args->key, args->upload_id).thenValue([res](int &&) {
+                return res;
+            });
+        });
+    });
+}
+
 struct HeadArgs {
     HeadArgs(const std::string &key, size_t &size, std::map <std::string, std::string> &headers)
             : key(key), size(size), headers(headers) {}
@@ -392,7 +568,7 @@ folly::Future<int> GlobalDataAdaptor::Head(const std::string &key,
 
     if (policy.write_cache_type == REPLICATION || policy.write_cache_type == REED_SOLOMON) {
         auto args = std::make_shared<HeadArgs>(key, size, headers);
-        return etcd_client_->GetJson(key).then([this, args, meta_cache_entry](folly::Try<EtcdClient::GetResult> &&output) -> folly::Future<int> {
+        return etcd_client_->GetJson(key).via(executor_.get()).then([this, args, meta_cache_entry](folly::Try<EtcdClient::GetResult> &&output) -> folly::Future<int> {
             if (!output.hasValue()) {
                 return folly::makeFuture(FOLLY_ERROR);
             }
@@ -405,7 +581,7 @@ folly::Future<int> GlobalDataAdaptor::Head(const std::string &key,
                 args->headers[iter.key().asString()] = (*iter).asString();
             }
 
-            if (GetGlobalConfig().use_meta_cache) {
+            if (UseMetaCache()) {
                 meta_cache_entry->present = true;
                 meta_cache_entry->existed = true;
                 meta_cache_entry->write_cached = true;
@@ -420,8 +596,8 @@ folly::Future<int> GlobalDataAdaptor::Head(const std::string &key,
             if (res != NOT_FOUND) {
                 return folly::makeFuture(res);
             } else {
-                return base_adaptor_->Head(args->key, args->size, args->headers).thenValue([args, meta_cache_entry](int &&res) -> int {
-                    if (GetGlobalConfig().use_meta_cache && (res == OK || res == NOT_FOUND)) {
+                return base_adaptor_->Head(args->key, args->size, args->headers).thenValue([this, args, meta_cache_entry](int &&res) -> int {
+                    if (UseMetaCache() && (res == OK || res == NOT_FOUND)) {
                         meta_cache_entry->present = true;
                         meta_cache_entry->existed = (res == OK);
                         meta_cache_entry->write_cached = false;
@@ -433,8 +609,8 @@ folly::Future<int> GlobalDataAdaptor::Head(const std::string &key,
             }
         });
     } else {
-        return base_adaptor_->Head(key, size, headers).thenValue([meta_cache_entry, &size, &headers](int &&res) -> int {
-            if (GetGlobalConfig().use_meta_cache && (res == OK || res == NOT_FOUND)) {
+        return base_adaptor_->Head(key, size, headers).thenValue([this, meta_cache_entry, &size, &headers](int &&res) -> int {
+            if (UseMetaCache() && (res == OK || res == NOT_FOUND)) {
                 meta_cache_entry->present = true;
                 meta_cache_entry->existed = (res == OK);
                 meta_cache_entry->write_cached = false;
@@ -446,26 +622,20 @@ folly::Future<int> GlobalDataAdaptor::Head(const std::string &key,
     }
 }
 
+bool GlobalDataAdaptor::UseMetaCache() const {
+    return GetGlobalConfig().use_meta_cache && (!etcd_client_ || etcd_client_->RecordsWatched());
+}
+
 void GlobalDataAdaptor::InvalidateMetaCache() {
-    std::lock_guard<std::mutex> lock(meta_cache_mutex_);
-    meta_cache_.clear();
+    meta_cache_.Clear();
 }
 
 void GlobalDataAdaptor::InvalidateMetaCacheEntry(const std::string &key) {
-    std::lock_guard<std::mutex> lock(meta_cache_mutex_);
-    meta_cache_.erase(key);
+    meta_cache_.Erase(key);
 }
 
 std::shared_ptr<GlobalDataAdaptor::MetaCacheEntry> GlobalDataAdaptor::GetMetaCacheEntry(const std::string &key) {
-    std::lock_guard<std::mutex> lock(meta_cache_mutex_);
-    auto iter = meta_cache_.find(key);
-    if (iter == meta_cache_.end()) {
-        auto entry = std::make_shared<MetaCacheEntry>(key);
-        meta_cache_.insert(key, entry);
-        return entry;
-    } else {
-        return iter->second;
-    }
+    return meta_cache_.GetOrCreate(key, [&key] { return std::make_shared<MetaCacheEntry>(key); });
 }
 
 
@@ -481,116 +651,251 @@ std::shared_ptr<GlobalCacheClient> GlobalDataAdaptor::GetRpcClient() const {
     return rpc_client_[lrand48() % rpc_client_.size()];
 }
 
+// GC runs in steps so that space comes back early: the keys are flushed
+// largest first and the write caches are reclaimed every gc_reclaim_bytes.
+// A flushed key loses its etcd record, so an interrupted GC resumes from
+// the last step. Every reclamation lists the records again, as those put
+// after the first list may own chunks older than the ts queried.
 int GlobalDataAdaptor::PerformGarbageCollection(const std::string &prefix) {
+    std::lock_guard<std::mutex> run_lock(gc_run_mutex_);
     LOG(INFO) << "==================GC START===================";
     butil::Timer t;
     t.start();
 
-    std::vector<uint64_t> write_cache_ts;
-    std::set<int> skipped_server_id_list;
-    for (int server_id = 0; server_id < server_list_.size(); ++server_id) {
-        auto res = GetRpcClient()->QueryTsFromWriteCache(server_id).get();
-        if (res.status != OK) {
-            std::cerr << RED << "Skip recycling write cache data in server " << server_id << WHITE << std::endl;
-            skipped_server_id_list.insert(server_id);
+    auto placement = GetPlacement();
+    std::vector<int> server_ids;
+    std::vector<Future<QueryTsOutput>> ts_futures;
+    for (auto &server : placement->GetServers()) {
+        server_ids.push_back(server.first);
+        ts_futures.push_back(GetRpcClient()->QueryTsFromWriteCache(server.first));
+    }
+    // chunks written from now on are newer than these and never reclaimed
+    std::map<int, uint64_t> write_cache_ts;
+    auto ts_outputs = folly::collectAll(ts_futures).get();
+    for (size_t i = 0; i < server_ids.size(); ++i) {
+        if (!ts_outputs[i].hasValue() || ts_outputs[i].value().status != OK) {
+            std::cerr << RED << "Skip recycling write cache data in server " << server_ids[i] << WHITE << std::endl;
+            continue;
         }
-        write_cache_ts.push_back(res.timestamp);
-        LOG(INFO) << "TS for server " << server_id << ": " << res.timestamp;
+        write_cache_ts[server_ids[i]] = ts_outputs[i].value().timestamp;
+        LOG(INFO) << "TS for server " << server_ids[i] << ": " << ts_outputs[i].value().timestamp;
     }
 
     t.stop();
     LOG(INFO) << "Flush stage 1: " << t.u_elapsed();
 
-    if (server_list_.size() == skipped_server_id_list.size()) {
+    if (write_cache_ts.empty()) {
         std::cerr << RED << "All servers are not available." << WHITE << std::endl;
         return RPC_FAILED;
     }
 
-    std::vector<std::string> key_list;
-    int rc = etcd_client_->ListJson(prefix, key_list).get();
+    std::vector<std::shared_ptr<GcRecord>> records;
+    int rc = LoadGcRecords(prefix, records);
     if (rc) {
-        std::cerr << RED << "Failed to list metadata in write cache. "
-                  << "Check the availability of etcd server." << WHITE << std::endl;
         return rc;
     }
-
-    for (auto &key : key_list) {
-        LOG(INFO) << "Found entry: " << key;
-    }
+    std::sort(records.begin(), records.end(), [](const std::shared_ptr<GcRecord> &lhs,
+                                                 const std::shared_ptr<GcRecord> &rhs) {
+        return lhs->size > rhs->size;
+    });
 
     t.stop();
-    LOG(INFO) << "Flush stage 2: " << t.u_elapsed();
-    
-    std::vector<folly::Future<int>> future_list;
-    for (auto &key : key_list) {
-        future_list.emplace_back(DeepFlush(key));
-    }
+    LOG(INFO) << "Flush stage 2: " << t.u_elapsed() << ", keys: " << records.size();
+
+    size_t next = 0, flushed = 0, failed = 0;
+    do {
+        std::vector<std::shared_ptr<GcRecord>> step;
+        uint64_t step_bytes = 0;
+        while (next < records.size() && (step.empty() || step_bytes < FLAGS_gc_reclaim_bytes)) {
+            step_bytes += records[next]->size;
+            step.push_back(records[next++]);
+        }
 
-    auto output = folly::collectAll(future_list).get();
-    for (auto &entry: output)
-        if (entry.value_or(FOLLY_ERROR) != OK) {
-            LOG(ERROR) << "Cannot flush data to S3 storage";
+        // each flush holds the whole object in memory, the window bounds
+        // both the memory and the load on the base adaptor
+        std::vector<size_t> sizes;
+        for (auto &record : step) {
+            sizes.push_back(std::max<size_t>(record->size, 1));
+        }
+        SlidingWindow::Run(sizes, FLAGS_gc_flush_window, [this, &step](size_t index) -> folly::Future<int> {
+            auto record = step[index];
+            return DeepFlush(record->key).thenValue([record](int &&res) -> int {
+                if (res == OK || res == NOT_FOUND) {
+                    record->flushed = true;
+                } else {
+                    LOG(ERROR) << "Cannot flush data to S3 storage, key: " << record->key;
+                }
+                return OK;      // keep flushing the others
+            });
+        }).get();
+        for (auto &record : step) {
+            record->flushed ? flushed++ : failed++;
         }
 
-    t.stop();
-    LOG(INFO) << "Flush stage 3: " << t.u_elapsed();
+        ReclaimWriteCache(prefix, write_cache_ts);
+        t.stop();
+        LOG(INFO) << "Flush stage 3: " << t.u_elapsed()
+                  << ", flushed: " << flushed
+                  << ", failed: " << failed
+                  << ", remaining: " << records.size() - next;
+    } while (next < records.size());
 
-    // Recheck the JSON metadata from etcd server
-    rc = etcd_client_->ListJson(prefix, key_list).get();
-    if (rc != 0 && rc != NOT_FOUND) {
+    LOG(INFO) << "==================GC END===================";
+    return 0;
+}
+
+int GlobalDataAdaptor::LoadGcRecords(const std::string &prefix,
+                                     std::vector<std::shared_ptr<GcRecord>> &records) {
+    std::vector<std::string> key_list;
+    int rc = etcd_client_->ListJson(prefix, key_list).get();
+    if (rc == NOT_FOUND) {
+        key_list.clear();
+    } else if (rc) {
+        std::cerr << RED << "Failed to list metadata in write cache. "
+                  << "Check the availability of etcd server." << WHITE << std::endl;
         return rc;
     }
 
-    t.stop();
-    LOG(INFO) << "Flush stage 4: " << t.u_elapsed();
+    records.assign(key_list.size(), nullptr);
+    rc = SlidingWindow::Run(std::vector<size_t>(key_list.size(), 1),
+                            FLAGS_gc_meta_concurrency,
+                            [this, &key_list, &records](size_t index) -> folly::Future<int> {
+        return etcd_client_->GetJson(key_list[index]).thenValue([&key_list, &records, index](EtcdClient::GetResult &&resp) -> int {
+            if (resp.status == NOT_FOUND) {
+                return OK;      // flushed or deleted meanwhile
+            } else if (resp.status) {
+                return resp.status;
+            }
+            auto record = std::make_shared<GcRecord>();
+            record->key = key_list[index];
+            record->size = resp.root["size"].asInt64();
+            for (auto &entry : resp.root["replica"]) {
+                record->replicas.push_back(entry.asInt());
+            }
+            for (auto &entry : resp.root["path"]) {
+                record->internal_keys.push_back(entry.asString());
+            }
+            records[index] = record;
+            return OK;
+        });
+    }).get();
+    if (rc) {
+        // the chunks of an unknown record can not be told apart from garbage
+        LOG(ERROR) << "Failed to load metadata for GC, prefix: " << prefix << ", status: " << rc;
+        return rc;
+    }
+    records.erase(std::remove(records.begin(), records.end(), nullptr), records.end());
+    return OK;
+}
+
+void GlobalDataAdaptor::ReclaimWriteCache(const std::string &prefix,
+                                          const std::map<int, uint64_t> &write_cache_ts) {
+    // the chunks of a record missed here would be deleted, so nothing is
+    // reclaimed unless all of them are loaded
+    std::vector<std::shared_ptr<GcRecord>> records;
+    if (LoadGcRecords(prefix, records)) {
+        LOG(WARNING) << "Skip reclaiming write cache, prefix: " << prefix;
+        std::lock_guard<std::mutex> lock(gc_mutex_);
+        gc_reclaimed_++;
+        gc_cv_.notify_all();
+        return;
+    }
 
     std::unordered_map<int, std::vector<std::string>> preserve_chunk_keys_map;
-    for (auto &key : key_list) {
-        auto resp = etcd_client_->GetJson(key).get();
-        if (resp.status) {
+    for (auto &record : records) {
+        if (record->replicas.empty()) {
             continue;
         }
-
-        std::vector<int> replicas;
-        for (auto &entry : resp.root["replica"]) {
-            replicas.push_back(entry.asInt());
-        }
-
-        std::vector<std::string> internal_keys;
-        for (auto &entry : resp.root["path"]) {
-            internal_keys.push_back(entry.asString());
+        auto &replicas = record->replicas;
+        for (int i = 0; i < record->internal_keys.size(); ++i) {
+            preserve_chunk_keys_map[replicas[i % replicas.size()]].push_back(record->internal_keys[i]);
         }
+    }
 
-        assert(!replicas.empty() && !internal_keys.empty());
-        for (int i = 0; i < internal_keys.size(); ++i) {
-            preserve_chunk_keys_map[replicas[i % replicas.size()]].push_back(internal_keys[i]);
+    std::vector<int> server_ids;
+    std::vector<Future<int>> futures;
+    for (auto &entry : write_cache_ts) {
+        server_ids.push_back(entry.first);
+        futures.push_back(GetRpcClient()->DeleteEntryFromWriteCache(entry.first,
+                                                                    prefix,
+                                                                    entry.second,
+                                                                    preserve_chunk_keys_map[entry.first]));
+    }
+    auto outputs = folly::collectAll(futures).get();
+    for (size_t i = 0; i < server_ids.size(); ++i) {
+        if (outputs[i].value_or(FOLLY_ERROR)) {
+            LOG(WARNING) << "Cannot delete unused entries from write cache. Server id: " << server_ids[i];
         }
     }
 
-    for (int server_id = 0; server_id < server_list_.size(); ++server_id) {
-        if (skipped_server_id_list.count(server_id)) {
-            continue;
-        }
+    std::lock_guard<std::mutex> lock(gc_mutex_);
+    gc_reclaimed_++;
+    gc_cv_.notify_all();
+}
 
-        std::vector<std::string> except_keys;
-        if (preserve_chunk_keys_map.count(server_id)) {
-            except_keys = preserve_chunk_keys_map[server_id];
+void GlobalDataAdaptor::GarbageCollectionWorker() {
+    std::unique_lock<std::mutex> lock(gc_mutex_);
+    while (bg_running_) {
+        auto woken = [this] { return gc_requested_ || !bg_running_; };
+        if (FLAGS_gc_interval_sec) {
+            gc_cv_.wait_for(lock, std::chrono::seconds(FLAGS_gc_interval_sec), woken);
+        } else {
+            gc_cv_.wait(lock, woken);
         }
-
-        int rc = GetRpcClient()->DeleteEntryFromWriteCache(server_id, 
-                                                           prefix, 
-                                                           write_cache_ts[server_id],
-                                                           except_keys).get();
-        if (rc) {
-            LOG(WARNING) << "Cannot delete unused entries from write cache. Server id: " << server_id;
+        if (!bg_running_) {
+            break;
         }
+        gc_requested_ = false;
+        lock.unlock();
+        if (PerformGarbageCollection()) {
+            LOG(WARNING) << "GC failed";
+        }
+        lock.lock();
+        // a round that reclaimed nothing still wakes the waiters up, they
+        // retry and fail by themselves
+        gc_reclaimed_++;
+        gc_cv_.notify_all();
     }
+}
 
-    t.stop();
-    LOG(INFO) << "Flush stage 5: " << t.u_elapsed();
+// back off while the background GC frees space, instead of running a
+// whole GC per failed upload
+folly::Future<int> GlobalDataAdaptor::RetryOnFullDisk(const std::string &key,
+                                                      std::function<folly::Future<int>()> upload,
+                                                      uint32_t retry) {
+    return upload().thenValue([this, key, upload, retry](int &&res) -> folly::Future<int> {
+        if (res != NO_ENOUGH_DISKSPACE || retry >= FLAGS_gc_backpressure_retries) {
+            return folly::makeFuture(res);
+        }
+        LOG_EVERY_SECOND(INFO) << "Disk limit exceeded - wait for GC, key: " << key;
+        RequestGarbageCollection();
+        return folly::futures::sleep(std::chrono::milliseconds(FLAGS_gc_backpressure_ms), &timekeeper_)
+            .via(executor_.get())
+            .thenValue([this, key, upload, retry](folly::Unit) {
+                return RetryOnFullDisk(key, upload, retry + 1);
+            });
+    });
+}
 
-    LOG(INFO) << "==================GC END===================";
-    return 0;
+void GlobalDataAdaptor::RequestGarbageCollection() {
+    std::lock_guard<std::mutex> lock(gc_mutex_);
+    gc_requested_ = true;
+    gc_cv_.notify_all();
+}
+
+int GlobalDataAdaptor::WaitForGarbageCollection(uint64_t timeout_ms) {
+    if (!gc_thread_.joinable()) {
+        return UNSUPPORTED_OPERATION;
+    }
+    std::unique_lock<std::mutex> lock(gc_mutex_);
+    const uint64_t target = gc_reclaimed_ + 1;
+    gc_requested_ = true;
+    gc_cv_.notify_all();
+    if (gc_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                        [this, target] { return gc_reclaimed_ >= target || !bg_running_; })) {
+        return gc_reclaimed_ >= target ? OK : NO_ENOUGH_DISKSPACE;
+    }
+    return NO_ENOUGH_DISKSPACE;
 }
 
 folly::Future<int> GlobalDataAdaptor::UpLoadPart(const std::string &key,
@@ -600,19 +905,8 @@ folly::Future<int> GlobalDataAdaptor::UpLoadPart(const std::string &key,
                                                  const std::map<std::string, std::string> &headers,
                                                  Json::Value& root) {
 #ifdef CONFIG_GC_ON_EXCEEDING_DISKSPACE
-    return DoUpLoadPart(key, off, size, buffer, headers, root)
-            .thenValue([this, key, off, size, &buffer, &headers, &root](int &&res) -> int {
-        if (res != NO_ENOUGH_DISKSPACE) {
-            return res;
-        }
-        LOG(INFO) << "Disk limit exceeded - perform GC immediately";
-        res = PerformGarbageCollection();
-        if (res) {
-            LOG(WARNING) << "GC failed";
-            return res;
-        }
-        LOG(INFO) << "Disk limit exceeded - GC completed, now retry";
-        return DoUpLoadPart(key, off, size, buffer, headers, root).get();
+    return RetryOnFullDisk(key, [this, key, off, size, &buffer, headers, &root]() {
+        return DoUpLoadPart(key, off, size, buffer, headers, root);
     });
 #else
     return DoUpLoadPart(key, off, size, buffer, headers, root);
@@ -3,13 +3,15 @@
 
 #include <string>
 #include <folly/executors/CPUThreadPoolExecutor.h>
-#include <folly/container/EvictingCacheMap.h>
+#include <folly/futures/ThreadWheelTimekeeper.h>
 
 #include "data_adaptor.h"
+#include "ClockCache.h"
 #include "EtcdClient.h"
 #include "ReadCacheClient.h"
 #include "WriteCacheClient.h"
 #include "GlobalCacheClient.h"
+#include "ReplicaSelector.h"
 
 #define NUM_WC_TYPES            2
 #define WC_TYPE_REPLICATION     0
@@ -18,6 +20,9 @@
 using HybridCache::ByteBuffer;
 using HybridCache::DataAdaptor;
 
+struct DeepFlushArgs;
+class S3DataAdaptor;
+
 class GlobalDataAdaptor : public DataAdaptor {
     friend class ReadCacheClient;
 
@@ -43,7 +48,8 @@ public:
                                                size_t size,
                                                ByteBuffer &buffer);
 
-    // 上传数据到数据服务器
+    // 上传数据到数据服务器. An upload to full disks is retried while the
+    // GC frees space, buffer must stay valid until the future completes
     virtual folly::Future<int> UpLoad(const std::string &key,
                                       size_t size,
                                       const ByteBuffer &buffer,
@@ -54,6 +60,7 @@ public:
                                         const ByteBuffer &buffer,
                                         const std::map <std::string, std::string> &headers);
 
+    // buffer and root must stay valid until the future completes
     virtual folly::Future<int> UpLoadPart(const std::string &key,
                                           size_t off,
                                           size_t size,
@@ -83,7 +90,13 @@ public:
                                     size_t &size,
                                     std::map <std::string, std::string> &headers);
     
+    // flush the write cached keys under prefix to the base adaptor, then
+    // reclaim their chunks from the write cache servers
     int PerformGarbageCollection(const std::string &prefix = "");
+
+    // wake the background GC up and wait at most timeout_ms for it to
+    // reclaim some space. Return OK if it did
+    int WaitForGarbageCollection(uint64_t timeout_ms);
     
     void SetCachePolicy(const std::string &key, CachePolicy &policy);
 
@@ -100,6 +113,10 @@ public:
         Json::Value root; 
     };
 
+    // metadata is cached only while the etcd records are watched, so
+    // that no update of other clients is missed
+    bool UseMetaCache() const;
+
     void InvalidateMetaCache();
 
     void InvalidateMetaCacheEntry(const std::string &key);
@@ -110,14 +127,60 @@ public:
 
     std::shared_ptr<GlobalCacheClient> GetRpcClient() const;
 
+    std::shared_ptr<const PlacementRing> GetPlacement() const {
+        return std::atomic_load(&placement_);
+    }
+
     const std::string GetServerHostname(int server_id) const {
-        if (server_id >= 0 && server_id < server_list_.size())
-            return server_list_[server_id];
+        auto placement = GetPlacement();
+        auto iter = placement->GetServers().find(server_id);
+        if (iter != placement->GetServers().end())
+            return iter->second;
         return "<invalid>";
     };
 
     void BackgroundWorker();
 
+    void GarbageCollectionWorker();
+
+    // reload the servers registered in etcd, then swap the placement ring
+    int RefreshMembership();
+
+private:
+    folly::Future<int> DeepFlushByParts(std::shared_ptr<DeepFlushArgs> args,
+                                        std::shared_ptr<S3DataAdaptor> s3_adaptor);
+
+    // run upload again while it fails with NO_ENOUGH_DISKSPACE, at most
+    // gc_backpressure_retries times, gc_backpressure_ms apart. No thread
+    // waits meanwhile
+    folly::Future<int> RetryOnFullDisk(const std::string &key,
+                                       std::function<folly::Future<int>()> upload,
+                                       uint32_t retry = 0);
+
+    // wake the background GC up without waiting for it
+    void RequestGarbageCollection();
+
+    struct GcRecord {
+        std::string key;
+        size_t size;
+        std::vector<int> replicas;
+        std::vector<std::string> internal_keys;
+        bool flushed = false;
+    };
+
+    // load the etcd records under prefix, skipping the ones gone meanwhile
+    int LoadGcRecords(const std::string &prefix, std::vector<std::shared_ptr<GcRecord>> &records);
+
+    // delete the chunks written before write_cache_ts from the write
+    // caches, except those of the records in etcd at this time
+    void ReclaimWriteCache(const std::string &prefix,
+                           const std::map<int, uint64_t> &write_cache_ts);
+
+    std::shared_ptr<PlacementRing> BuildStaticPlacement() const;
+
+    // register the server in every rpc client, retry in background on failure
+    void ConnectServer(int server_id, const std::string &address);
+
 private:
     std::shared_ptr<folly::CPUThreadPoolExecutor> executor_;
 
@@ -127,17 +190,27 @@ private:
     std::shared_ptr<DataAdaptor> base_adaptor_;
 
     std::vector<std::shared_ptr<GlobalCacheClient>> rpc_client_;
+    std::shared_ptr<ReplicaSelector> replica_selector_;
     std::shared_ptr<EtcdClient> etcd_client_;
-    std::vector<std::string> server_list_;
+    std::vector<std::string> server_list_;       // static servers, id is the index
+    std::mutex membership_mutex_;
+    std::shared_ptr<const PlacementRing> placement_;
 
-    std::mutex meta_cache_mutex_;
-    folly::EvictingCacheMap<std::string, std::shared_ptr<MetaCacheEntry>> meta_cache_;
+    ClockCache<MetaCacheEntry> meta_cache_;
 
     std::atomic<bool> bg_running_;
     std::thread bg_thread_;
     std::mutex bg_mutex_;
     std::condition_variable bg_cv_;
     std::vector<std::function<int()>> bg_tasks_;
+
+    std::mutex gc_run_mutex_;           // one GC at a time
+    std::thread gc_thread_;
+    std::mutex gc_mutex_;
+    std::condition_variable gc_cv_;
+    bool gc_requested_ = false;
+    uint64_t gc_reclaimed_ = 0;         // reclamation steps completed
+    folly::ThreadWheelTimekeeper timekeeper_;   // backoff of uploads to full disks
 };
 
 #endif // MADFS_GLOBAL_DATA_ADAPTOR_H
\ No newline at end of file
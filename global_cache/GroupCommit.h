@@ -0,0 +1,107 @@
+#ifndef MADFS_GROUP_COMMIT_H
+#define MADFS_GROUP_COMMIT_H
+
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include "Common.h"
+#include "FdCache.h"
+
+// Make writes durable with as few device flushes as possible. A writer
+// calls Commit() once its data is written: whoever finds no flush running
+// becomes the leader and fdatasyncs every file written by the writers that
+// joined so far, the others wait for that flush. Writers arriving during a
+// flush join the next one, so N concurrent writers cost about two flushes
+// instead of N.
+//
+// With a window, the leader also waits up to window_us for more writers
+// (or until max_batch_bytes are pending) before flushing. With fs_root
+// set, a batch is flushed by one syncfs() of that file system instead,
+// which also persists the directory entries of newly created files.
+class GroupCommitter {
+public:
+    GroupCommitter(uint64_t window_us = 0,
+                   uint64_t max_batch_bytes = 0,
+                   const OpenFilePtr &fs_root = nullptr)
+            : window_us_(window_us),
+              max_batch_bytes_(max_batch_bytes),
+              fs_root_(fs_root),
+              pending_(std::make_shared<Batch>()) {}
+
+    // return once the data written by the caller is durable. file may be
+    // nullptr with fs_root set
+    int Commit(const OpenFilePtr &file, uint64_t bytes = 0) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto batch = pending_;
+        if (file) {
+            batch->files.insert(file);
+        }
+        batch->bytes += bytes;
+        if (max_batch_bytes_ && batch->bytes >= max_batch_bytes_) {
+            cond_.notify_all();     // the leader may be waiting for us
+        }
+        while (!batch->done) {
+            if (syncing_) {
+                cond_.wait(lock);
+                continue;
+            }
+            syncing_ = true;
+            if (window_us_) {
+                cond_.wait_for(lock, std::chrono::microseconds(window_us_), [&] {
+                    return max_batch_bytes_ && batch->bytes >= max_batch_bytes_;
+                });
+            }
+            pending_ = std::make_shared<Batch>();
+            lock.unlock();
+            int res = Flush(batch->files);
+            lock.lock();
+            batch->res = res;
+            batch->done = true;
+            syncing_ = false;
+            cond_.notify_all();
+        }
+        return batch->res;
+    }
+
+private:
+    struct Batch {
+        std::set<OpenFilePtr> files;
+        uint64_t bytes = 0;
+        bool done = false;
+        int res = OK;
+    };
+
+    int Flush(const std::set<OpenFilePtr> &files) {
+        if (fs_root_) {
+            if (syncfs(fs_root_->fd) < 0) {
+                PLOG(ERROR) << "Fail to sync file system, fd: " << fs_root_->fd;
+                return IO_ERROR;
+            }
+            return OK;
+        }
+        int res = OK;
+        for (auto &entry : files) {
+            if (fdatasync(entry->fd) < 0) {
+                PLOG(ERROR) << "Fail to sync file, fd: " << entry->fd;
+                res = IO_ERROR;
+            }
+        }
+        return res;
+    }
+
+private:
+    const uint64_t window_us_;
+    const uint64_t max_batch_bytes_;
+    const OpenFilePtr fs_root_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::shared_ptr<Batch> pending_;
+    bool syncing_ = false;
+};
+
+#endif // MADFS_GROUP_COMMIT_H
@@ -0,0 +1,306 @@
+#include <butil/logging.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "IoUringEngine.h"
+
+DEFINE_uint32(io_uring_queue_depth, 256, "Submission queue depth of the io_uring disk engine");
+DEFINE_uint32(io_uring_submit_batch, 16, "Prepared requests that force a submission while I/O is in flight");
+DEFINE_uint32(io_uring_buffers, 64, "Registered bounce buffers for O_DIRECT I/O of the io_uring disk engine");
+DEFINE_uint64(io_uring_buffer_size, 4 * 1024 * 1024 + 4096, "Size of each registered bounce buffer in bytes");
+
+#ifdef CONFIG_IO_URING
+#include <liburing.h>
+
+struct IoUringEngine::Request {
+    enum Opcode { READ, WRITE, FSYNC };
+
+    Opcode opcode;
+    int fd;
+    char *buf;
+    size_t len;
+    off_t offset;
+    int buf_index;
+    size_t done = 0;
+    folly::Promise<ssize_t> promise;
+};
+
+std::shared_ptr<IoUringEngine> IoUringEngine::GetInstance() {
+    static std::once_flag once;
+    static std::shared_ptr<IoUringEngine> instance;
+    std::call_once(once, [] {
+        auto engine = std::shared_ptr<IoUringEngine>(new IoUringEngine());
+        if (engine->Init() == OK) {
+            instance = engine;
+        }
+    });
+    return instance;
+}
+
+int IoUringEngine::Init() {
+    ring_ = new struct io_uring;
+    int ret = io_uring_queue_init(FLAGS_io_uring_queue_depth, ring_, 0);
+    if (ret < 0) {
+        LOG(ERROR) << "Failed to set up io_uring: " << strerror(-ret);
+        delete ring_;
+        ring_ = nullptr;
+        return IO_ERROR;
+    }
+    cq_entries_ = ring_->cq.ring_entries;
+
+    buffer_size_ = (FLAGS_io_uring_buffer_size + kDirectIOAlign - 1) & ~(kDirectIOAlign - 1);
+    std::vector<struct iovec> iovecs;
+    for (uint32_t i = 0; i < FLAGS_io_uring_buffers; ++i) {
+        void *buf = nullptr;
+        if (posix_memalign(&buf, kDirectIOAlign, buffer_size_)) {
+            break;
+        }
+        buffers_.push_back((char *) buf);
+        free_buffers_.push_back(i);
+        iovecs.push_back({ buf, buffer_size_ });
+    }
+    if (!iovecs.empty() && (ret = io_uring_register_buffers(ring_, iovecs.data(), iovecs.size())) < 0) {
+        // buffered I/O still works, only O_DIRECT is off
+        LOG(WARNING) << "Failed to register io_uring buffers: " << strerror(-ret);
+        for (auto buf : buffers_) {
+            free(buf);
+        }
+        buffers_.clear();
+        free_buffers_.clear();
+    }
+
+    reaper_ = std::thread(&IoUringEngine::ReapLoop, this);
+    LOG(INFO) << "io_uring disk engine started, queue depth: " << FLAGS_io_uring_queue_depth
+              << ", registered buffers: " << buffers_.size();
+    return OK;
+}
+
+IoUringEngine::~IoUringEngine() {
+    if (!ring_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        stopping_ = true;
+    }
+    Enqueue(nullptr);   // the reaper exits on this NOP
+    reaper_.join();
+    io_uring_queue_exit(ring_);
+    delete ring_;
+    for (auto buf : buffers_) {
+        free(buf);
+    }
+}
+
+folly::Future<ssize_t> IoUringEngine::Read(int fd, char *buf, size_t len, off_t offset, int buf_index) {
+    auto req = new Request{ Request::READ, fd, buf, len, offset, buf_index };
+    auto future = req->promise.getFuture();
+    Enqueue(req);
+    return future;
+}
+
+folly::Future<ssize_t> IoUringEngine::Write(int fd, const char *buf, size_t len, off_t offset, int buf_index) {
+    auto req = new Request{ Request::WRITE, fd, const_cast<char *>(buf), len, offset, buf_index };
+    auto future = req->promise.getFuture();
+    Enqueue(req);
+    return future;
+}
+
+folly::Future<ssize_t> IoUringEngine::Fsync(int fd) {
+    auto req = new Request{ Request::FSYNC, fd, nullptr, 0, 0, -1 };
+    auto future = req->promise.getFuture();
+    Enqueue(req);
+    return future;
+}
+
+int IoUringEngine::AcquireBuffer(char *&buf) {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    if (free_buffers_.empty()) {
+        return -1;
+    }
+    int buf_index = free_buffers_.back();
+    free_buffers_.pop_back();
+    buf = buffers_[buf_index];
+    return buf_index;
+}
+
+void IoUringEngine::ReleaseBuffer(int buf_index) {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    free_buffers_.push_back(buf_index);
+}
+
+void IoUringEngine::Enqueue(Request *req) {
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    backlog_.push_back(req);
+    PrepareLocked();
+}
+
+void IoUringEngine::PrepareLocked() {
+    // every prepared request takes a completion entry sooner or later
+    while (!backlog_.empty() && pending_ + inflight_ < cq_entries_) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring_);
+        if (!sqe) {
+            // submission queue is full, hand it to the kernel once; if
+            // that fails the reaper retries after the next completions
+            SubmitLocked();
+            if (!(sqe = io_uring_get_sqe(ring_))) {
+                break;
+            }
+        }
+
+        Request *req = backlog_.front();
+        backlog_.pop_front();
+        if (!req) {
+            io_uring_prep_nop(sqe);
+        } else if (req->opcode == Request::FSYNC) {
+            io_uring_prep_fsync(sqe, req->fd, 0);
+        } else {
+            char *buf = req->buf + req->done;
+            const unsigned len = req->len - req->done;
+            const off_t offset = req->offset + req->done;
+            if (req->opcode == Request::READ) {
+                if (req->buf_index >= 0)
+                    io_uring_prep_read_fixed(sqe, req->fd, buf, len, offset, req->buf_index);
+                else
+                    io_uring_prep_read(sqe, req->fd, buf, len, offset);
+            } else {
+                if (req->buf_index >= 0)
+                    io_uring_prep_write_fixed(sqe, req->fd, buf, len, offset, req->buf_index);
+                else
+                    io_uring_prep_write(sqe, req->fd, buf, len, offset);
+            }
+        }
+        io_uring_sqe_set_data(sqe, req);
+        pending_++;
+    }
+
+    // an idle ring submits at once; a busy one is flushed by the reaper
+    // with the next completions, so requests arriving together share a
+    // single io_uring_enter
+    if (pending_ && (inflight_ == 0 || pending_ >= FLAGS_io_uring_submit_batch || stopping_)) {
+        SubmitLocked();
+    }
+}
+
+void IoUringEngine::SubmitLocked() {
+    int ret = io_uring_submit(ring_);
+    if (ret < 0) {
+        LOG_EVERY_SECOND(ERROR) << "Failed to submit io_uring requests: " << strerror(-ret);
+        sched_yield();
+        return;
+    }
+    pending_ -= ret;
+    inflight_ += ret;
+}
+
+void IoUringEngine::ReapLoop() {
+    std::vector<std::pair<Request *, int>> completed;
+    bool stop = false;
+    while (!stop) {
+        struct io_uring_cqe *cqe;
+        int ret = io_uring_wait_cqe(ring_, &cqe);
+        if (ret < 0) {
+            if (ret != -EINTR) {
+                LOG_EVERY_SECOND(ERROR) << "Failed to wait io_uring completions: " << strerror(-ret);
+            }
+            continue;
+        }
+
+        unsigned head;
+        unsigned count = 0;
+        io_uring_for_each_cqe(ring_, head, cqe) {
+            auto req = (Request *) io_uring_cqe_get_data(cqe);
+            if (req) {
+                completed.emplace_back(req, cqe->res);
+            } else {
+                stop = true;
+            }
+            count++;
+        }
+        io_uring_cq_advance(ring_, count);
+
+        // resumed transfers go to the backlog, the reaper must never
+        // wait for room in the rings it is the only one to drain
+        std::vector<Request *> resubmit;
+        for (auto &entry : completed) {
+            if (!OnComplete(entry.first, entry.second)) {
+                resubmit.push_back(entry.first);
+            }
+        }
+        completed.clear();
+
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        inflight_ -= count;
+        backlog_.insert(backlog_.begin(), resubmit.begin(), resubmit.end());
+        PrepareLocked();
+    }
+}
+
+bool IoUringEngine::OnComplete(Request *req, int res) {
+    if (res == -EINTR || res == -EAGAIN) {
+        return false;
+    }
+
+    ssize_t output;
+    if (res < 0) {
+        output = res;
+    } else if (req->opcode == Request::FSYNC) {
+        output = 0;
+    } else {
+        req->done += res;
+        if (res > 0 && req->done < req->len) {
+            return false;   // short transfer, resume
+        }
+        output = req->done;
+    }
+    req->promise.setValue(output);
+    delete req;
+    return true;
+}
+
+#else
+
+struct IoUringEngine::Request {};
+
+std::shared_ptr<IoUringEngine> IoUringEngine::GetInstance() {
+    LOG_FIRST_N(WARNING, 1) << "io_uring disk engine is not built in, rebuild with ENABLE_IO_URING";
+    return nullptr;
+}
+
+int IoUringEngine::Init() {
+    return UNSUPPORTED_OPERATION;
+}
+
+IoUringEngine::~IoUringEngine() {}
+
+folly::Future<ssize_t> IoUringEngine::Read(int fd, char *buf, size_t len, off_t offset, int buf_index) {
+    return folly::makeFuture<ssize_t>(-ENOSYS);
+}
+
+folly::Future<ssize_t> IoUringEngine::Write(int fd, const char *buf, size_t len, off_t offset, int buf_index) {
+    return folly::makeFuture<ssize_t>(-ENOSYS);
+}
+
+folly::Future<ssize_t> IoUringEngine::Fsync(int fd) {
+    return folly::makeFuture<ssize_t>(-ENOSYS);
+}
+
+int IoUringEngine::AcquireBuffer(char *&buf) {
+    return -1;
+}
+
+void IoUringEngine::ReleaseBuffer(int buf_index) {}
+
+void IoUringEngine::Enqueue(Request *req) {}
+
+void IoUringEngine::PrepareLocked() {}
+
+void IoUringEngine::SubmitLocked() {}
+
+void IoUringEngine::ReapLoop() {}
+
+bool IoUringEngine::OnComplete(Request *req, int res) {
+    return true;
+}
+
+#endif // CONFIG_IO_URING
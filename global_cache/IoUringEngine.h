@@ -0,0 +1,100 @@
+#ifndef MADFS_IO_URING_ENGINE_H
+#define MADFS_IO_URING_ENGINE_H
+
+#include <sys/types.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <folly/futures/Future.h>
+#include <folly/futures/Promise.h>
+
+#include "Common.h"
+
+DECLARE_uint32(io_uring_queue_depth);
+DECLARE_uint32(io_uring_submit_batch);
+DECLARE_uint32(io_uring_buffers);
+DECLARE_uint64(io_uring_buffer_size);
+
+struct io_uring;
+
+// Asynchronous file I/O on one io_uring shared by the process. A single
+// reaper thread completes the requests by resolving their promises, so no
+// thread blocks per I/O. Submission is batched: while I/O is in flight,
+// new requests wait in the submission queue until the reaper flushes them
+// with the next completions, or until io_uring_submit_batch of them pile up.
+// Requests beyond the completion queue size wait in a backlog, so the
+// completion queue never overflows and submitting never blocks.
+//
+// A pool of aligned buffers is registered with the ring. Callers use them
+// as bounce buffers for O_DIRECT I/O with the fixed buffer opcodes.
+//
+// Only available when built with ENABLE_IO_URING, GetInstance() returns
+// nullptr otherwise or when the ring can not be set up.
+class IoUringEngine {
+public:
+    static const size_t kDirectIOAlign = 4096;
+
+    static std::shared_ptr<IoUringEngine> GetInstance();
+
+    ~IoUringEngine();
+
+    // Transfer len bytes, short transfers are resumed until done.
+    // Resolve to the bytes transferred, less than len only at end of
+    // file, or to -errno. buf_index is the registered buffer that buf
+    // lies in, -1 if none.
+    folly::Future<ssize_t> Read(int fd, char *buf, size_t len, off_t offset, int buf_index = -1);
+
+    folly::Future<ssize_t> Write(int fd, const char *buf, size_t len, off_t offset, int buf_index = -1);
+
+    // resolve to 0 or -errno
+    folly::Future<ssize_t> Fsync(int fd);
+
+    // registered buffer of GetBufferSize() bytes, -1 if all are in use
+    int AcquireBuffer(char *&buf);
+
+    void ReleaseBuffer(int buf_index);
+
+    size_t GetBufferSize() const {
+        return buffer_size_;
+    }
+
+private:
+    struct Request;
+
+    IoUringEngine() {}
+
+    int Init();
+
+    void Enqueue(Request *req);
+
+    // move the backlog into the submission queue while the completion
+    // queue has room, then submit if needed
+    void PrepareLocked();
+
+    void SubmitLocked();
+
+    void ReapLoop();
+
+    // return false if the request must be submitted again
+    bool OnComplete(Request *req, int res);
+
+private:
+    struct io_uring *ring_ = nullptr;
+    std::thread reaper_;
+
+    std::mutex sq_mutex_;          // protects the submission queue
+    std::deque<Request *> backlog_;
+    size_t cq_entries_ = 0;
+    size_t pending_ = 0;           // prepared but not submitted
+    size_t inflight_ = 0;          // submitted but not completed
+    bool stopping_ = false;
+
+    std::mutex buffer_mutex_;
+    size_t buffer_size_ = 0;
+    std::vector<char *> buffers_;
+    std::vector<int> free_buffers_;
+};
+
+#endif // MADFS_IO_URING_ENGINE_H
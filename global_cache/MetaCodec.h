@@ -0,0 +1,126 @@
+#ifndef MADFS_META_CODEC_H
+#define MADFS_META_CODEC_H
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <json/json.h>
+
+#include "Common.h"
+#include "gcache.pb.h"
+
+DECLARE_bool(etcd_binary_meta);
+
+// Converts the metadata record of a write cached object between the JSON
+// tree used by the write cache clients and the value stored in etcd. With
+// etcd_binary_meta, values are ObjectMeta protobufs without the chunk
+// keys, which are derived again from the object key; otherwise they are
+// JSON. Both are always read, but clients older than this codec only
+// read JSON, so the flag must stay off until every client is upgraded.
+class ObjectMetaCodec {
+public:
+    static const uint32_t kVersion = 1;
+
+    static void Encode(const std::string &key, const Json::Value &root, std::string &value) {
+        if (!FLAGS_etcd_binary_meta) {
+            Json::FastWriter writer;
+            value = writer.write(root);
+            return;
+        }
+
+        gcache::ObjectMeta meta;
+        meta.set_version(kVersion);
+        meta.set_type(root["type"].asString() == "reed-solomon"
+                      ? gcache::ObjectMeta::REED_SOLOMON
+                      : gcache::ObjectMeta::REPLICATION);
+        meta.set_size(root["size"].asUInt64());
+        if (root.isMember("w")) {
+            meta.set_word_size(root["w"].asUInt());
+        }
+        for (auto &entry : root["replica"]) {
+            meta.add_replica(entry.asInt());
+        }
+        for (auto iter = root["headers"].begin(); iter != root["headers"].end(); iter++) {
+            (*meta.mutable_headers())[iter.key().asString()] = (*iter).asString();
+        }
+
+        const uint64_t chunk_size = GetGlobalConfig().write_chunk_size;
+        const size_t num_replicas = std::max(meta.replica_size(), 1);
+        meta.set_chunk_size(chunk_size);
+        const auto &path = root["path"];
+        for (Json::ArrayIndex i = 0; i < path.size(); ++i) {
+            uint64_t oid;
+            if (!ParseOid(path[i].asString(), BuildChunkPrefix(key, i / num_replicas, chunk_size), oid)) {
+                // keep every key as is
+                meta.clear_oid();
+                for (auto &entry : path) {
+                    meta.add_path(entry.asString());
+                }
+                break;
+            }
+            meta.add_oid(oid);
+        }
+        meta.SerializeToString(&value);
+    }
+
+    static int Decode(const std::string &key, const std::string &value, Json::Value &root) {
+        if (!value.empty() && value[0] == '{') {
+            Json::Reader reader;
+            return reader.parse(value, root) ? OK : METADATA_ERROR;
+        }
+
+        gcache::ObjectMeta meta;
+        if (!meta.ParseFromString(value) || meta.version() != kVersion) {
+            return METADATA_ERROR;
+        }
+        root["type"] = meta.type() == gcache::ObjectMeta::REED_SOLOMON ? "reed-solomon" : "replication";
+        root["size"] = (Json::UInt64) meta.size();
+        if (meta.has_word_size()) {
+            root["w"] = (int) meta.word_size();
+        }
+        Json::Value json_replica(Json::arrayValue), json_path(Json::arrayValue), json_headers;
+        for (auto server_id : meta.replica()) {
+            json_replica.append(server_id);
+        }
+        for (auto &entry : meta.headers()) {
+            json_headers[entry.first] = entry.second;
+        }
+        if (meta.path_size()) {
+            for (auto &entry : meta.path()) {
+                json_path.append(entry);
+            }
+        } else {
+            const size_t num_replicas = std::max(meta.replica_size(), 1);
+            for (int i = 0; i < meta.oid_size(); ++i) {
+                json_path.append(BuildChunkPrefix(key, i / num_replicas, meta.chunk_size())
+                                 + std::to_string(meta.oid(i)));
+            }
+        }
+        root["replica"] = json_replica;
+        root["headers"] = json_headers;
+        root["path"] = json_path;
+        return OK;
+    }
+
+private:
+    static std::string BuildChunkPrefix(const std::string &key, uint64_t chunk_id, uint64_t chunk_size) {
+        return key + "-" + std::to_string(chunk_id) + "-" + std::to_string(chunk_size) + "-";
+    }
+
+    static bool ParseOid(const std::string &internal_key, const std::string &prefix, uint64_t &oid) {
+        if (internal_key.size() <= prefix.size() || internal_key.compare(0, prefix.size(), prefix)) {
+            return false;
+        }
+        oid = 0;
+        for (size_t i = prefix.size(); i < internal_key.size(); ++i) {
+            if (!isdigit(internal_key[i])) {
+                return false;
+            }
+            oid = oid * 10 + (internal_key[i] - '0');
+        }
+        // rejects leading zeros, which would not round trip
+        return std::to_string(oid) == internal_key.substr(prefix.size());
+    }
+};
+
+#endif // MADFS_META_CODEC_H
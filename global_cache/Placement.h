@@ -1,15 +1,90 @@
 #ifndef MADFS_PLACEMENT_H
 #define MADFS_PLACEMENT_H
 
+#include <algorithm>
+#include <map>
 #include <vector>
+#include <folly/hash/SpookyHashV2.h>
+
 #include "Common.h"
 
-inline static std::vector<int> Placement(const std::string &key, int num_available, int num_choose) {
-    uint64_t seed = std::hash < std::string > {}(key);
-    std::vector<int> output;
-    for (int i = 0; i < std::min(num_available, num_choose); ++i)
-        output.push_back((seed + i) % num_available);
-    return output;
-}
+DECLARE_int32(placement_virtual_nodes);
+
+// Consistent hashing ring shared by the read cache and write cache clients.
+// Every server owns weight * virtual_nodes points on the ring, and a key is
+// placed on the first distinct servers clockwise from its hash. Adding or
+// removing one server only moves the keys of its own arcs, about 1/N of them.
+class PlacementRing {
+public:
+    PlacementRing(int virtual_nodes = FLAGS_placement_virtual_nodes)
+            : virtual_nodes_(std::max(virtual_nodes, 1)) {}
+
+    // server_id is the id registered in GlobalCacheClient, name must be
+    // stable across restarts (e.g. hostname:port) because it seeds the points
+    void AddServer(int server_id, const std::string &name, int weight = 1) {
+        RemoveServer(server_id);
+        weight = std::max(weight, 1);
+        for (int i = 0; i < weight * virtual_nodes_; ++i) {
+            std::string vnode = name + "#" + std::to_string(i);
+            points_.emplace_back(Hash(vnode), server_id);
+        }
+        std::sort(points_.begin(), points_.end());
+        servers_[server_id] = name;
+    }
+
+    void RemoveServer(int server_id) {
+        if (!servers_.erase(server_id))
+            return;
+        points_.erase(std::remove_if(points_.begin(), points_.end(),
+                                     [server_id](const std::pair<uint64_t, int> &point) {
+                                         return point.second == server_id;
+                                     }),
+                      points_.end());
+    }
+
+    // Choose num_choose servers for the key. The servers are distinct as
+    // long as there are enough of them, otherwise the choice wraps around
+    // like the original (hash + i) % n placement did.
+    std::vector<int> Locate(const std::string &key, int num_choose) const {
+        std::vector<int> output;
+        if (points_.empty() || num_choose <= 0)
+            return output;
+        const int num_distinct = std::min<int>(num_choose, servers_.size());
+        auto iter = std::lower_bound(points_.begin(), points_.end(),
+                                     std::make_pair(Hash(key), INT32_MIN));
+        for (size_t step = 0; step < points_.size() && (int) output.size() < num_distinct; ++step) {
+            if (iter == points_.end())
+                iter = points_.begin();
+            if (std::find(output.begin(), output.end(), iter->second) == output.end())
+                output.push_back(iter->second);
+            ++iter;
+        }
+        for (int i = 0; (int) output.size() < num_choose; ++i)
+            output.push_back(output[i]);
+        return output;
+    }
+
+    bool Contains(int server_id) const {
+        return servers_.count(server_id);
+    }
+
+    int GetServerCount() const {
+        return servers_.size();
+    }
+
+    const std::map<int, std::string> &GetServers() const {
+        return servers_;
+    }
+
+private:
+    static uint64_t Hash(const std::string &data) {
+        return folly::hash::SpookyHashV2::Hash64(data.data(), data.size(), 0);
+    }
+
+private:
+    const int virtual_nodes_;
+    std::vector<std::pair<uint64_t, int>> points_;     // sorted by hash
+    std::map<int, std::string> servers_;
+};
 
-#endif // MADFS_PLACEMENT_H
\ No newline at end of file
+#endif // MADFS_PLACEMENT_H
@@ -44,6 +44,28 @@ ReadCache4Cachelib::ReadCache4Cachelib(std::shared_ptr<folly::CPUThreadPoolExecu
 Future<GetOutput> ReadCache4Cachelib::Get(const std::string &key, uint64_t start, uint64_t length) {
     butil::Timer *t = new butil::Timer();
     t->start();
+    // Over TCP the response attachment references the cached pages, pinned
+    // by their handles until brpc has sent them. RDMA can only send from
+    // registered memory, so one copy into an RDMA block stays there.
+    if (!GetGlobalConfig().use_rdma) {
+        std::vector<HybridCache::PinnedData> segments;
+        if (impl_->GetPinned(key, start, length, segments) == OK) {
+            GetOutput output;
+            output.status = OK;
+            for (auto &segment : segments) {
+                auto pin = segment.pin;
+                output.buf.append_user_data(segment.data.data, segment.data.len, [pin](void *) {});
+            }
+            t->stop();
+            g_latency_readcache4cachelib_get << t->u_elapsed();
+            delete t;
+            LOG_IF(INFO, FLAGS_verbose) << "Get key: " << key 
+                                        << ", start: " << start
+                                        << ", length: " << length 
+                                        << ", status: " << OK << " (pinned)";
+            return folly::makeFuture(std::move(output));
+        }
+    }
 #ifndef BRPC_WITH_RDMA
     auto wrap = HybridCache::ByteBuffer(new char[length], length); 
 #else
@@ -201,15 +223,166 @@ int ReadCache4Disk::Delete(const std::string &key, uint64_t chunk_size, uint64_t
 }
 
 DEFINE_string(read_cache_engine, "cachelib", "Read cache engine: cachelib | disk");
+DEFINE_uint32(read_fill_concurrency, 64, "Max chunks filled from the base adaptor at the same time on read cache miss");
+
+#define AWS_BUFFER_PADDING 64
 
+// the engines never see the base adaptor, they would fetch the internal
+// key from it; misses are filled chunk by chunk here instead
 ReadCache::ReadCache(std::shared_ptr<folly::CPUThreadPoolExecutor> executor, 
-                     std::shared_ptr<DataAdaptor> base_adaptor) {
+                     std::shared_ptr<DataAdaptor> base_adaptor)
+        : executor_(executor), base_adaptor_(base_adaptor) {
     if (FLAGS_read_cache_engine == "cachelib")
-        impl_ = new ReadCache4Cachelib(executor, base_adaptor);
+        impl_ = new ReadCache4Cachelib(executor);
     else if (FLAGS_read_cache_engine == "disk")
-        impl_ = new ReadCache4Disk(executor, base_adaptor);
+        impl_ = new ReadCache4Disk(executor);
     else {
         LOG(FATAL) << "unsupported read cache engine";
         exit(EXIT_FAILURE);
     }
-}
\ No newline at end of file
+}
+
+Future<GetOutput> ReadCache::Get(const std::string &key, uint64_t start, uint64_t length) {
+    if (!base_adaptor_) {
+        return impl_->Get(key, start, length);
+    }
+    return impl_->Get(key, start, length).thenValue([this, key, start, length](GetOutput output) -> Future<GetOutput> {
+        if (output.status != CACHE_ENTRY_NOT_FOUND) {
+            return folly::makeFuture(std::move(output));
+        }
+        return Fill(key).thenValue([this, key, start, length](int res) -> Future<GetOutput> {
+            if (res != OK) {
+                GetOutput output;
+                output.status = res;
+                return folly::makeFuture(std::move(output));
+            }
+            return impl_->Get(key, start, length);
+        });
+    });
+}
+
+bool ReadCache::ParseInternalKey(const std::string &internal_key,
+                                 std::string &user_key,
+                                 uint64_t &chunk_id,
+                                 uint64_t &chunk_size) {
+    // the user key may contain '-', parse from the right
+    auto size_pos = internal_key.rfind('-');
+    if (size_pos == std::string::npos || size_pos == 0) {
+        return false;
+    }
+    auto id_pos = internal_key.rfind('-', size_pos - 1);
+    if (id_pos == std::string::npos || id_pos == 0) {
+        return false;
+    }
+    auto id_str = internal_key.substr(id_pos + 1, size_pos - id_pos - 1);
+    auto size_str = internal_key.substr(size_pos + 1);
+    if (id_str.empty() || size_str.empty()
+        || id_str.find_first_not_of("0123456789") != std::string::npos
+        || size_str.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    user_key = internal_key.substr(0, id_pos);
+    chunk_id = std::stoull(id_str);
+    chunk_size = std::stoull(size_str);
+    return chunk_size != 0;
+}
+
+Future<int> ReadCache::Fill(const std::string &key) {
+    std::lock_guard<std::mutex> lock(fill_mutex_);
+    auto iter = fills_.find(key);
+    if (iter != fills_.end()) {
+        return iter->second->getFuture();
+    }
+    auto promise = std::make_shared<folly::SharedPromise<int>>();
+    fills_[key] = promise;
+    if (inflight_fills_ < std::max<size_t>(FLAGS_read_fill_concurrency, 1)) {
+        inflight_fills_++;
+        // started outside of the lock, the fill may complete inline
+        folly::via(executor_.get(), [this, key]() { StartFill(key); });
+    } else {
+        pending_fills_.push_back(key);
+    }
+    return promise->getFuture();
+}
+
+void ReadCache::StartFill(const std::string &key) {
+    DoFill(key).then([this, key](folly::Try<int> &&res) {
+        OnFillDone(key, res.value_or(FOLLY_ERROR));
+    });
+}
+
+void ReadCache::OnFillDone(const std::string &key, int res) {
+    std::shared_ptr<folly::SharedPromise<int>> promise;
+    std::string next_key;
+    {
+        std::lock_guard<std::mutex> lock(fill_mutex_);
+        auto iter = fills_.find(key);
+        if (iter != fills_.end()) {
+            promise = iter->second;
+            fills_.erase(iter);
+        }
+        if (pending_fills_.empty()) {
+            inflight_fills_--;
+        } else {
+            next_key = pending_fills_.front();
+            pending_fills_.pop_front();
+        }
+    }
+    if (promise) {
+        promise->setValue(res);
+    }
+    if (!next_key.empty()) {
+        StartFill(next_key);
+    }
+}
+
+Future<int> ReadCache::DoFill(const std::string &key) {
+    struct Args {
+        std::string user_key;
+        uint64_t chunk_id;
+        uint64_t chunk_size;
+        size_t size;
+        std::map<std::string, std::string> headers;
+        ByteBuffer data_buf;
+
+        ~Args() {
+            if (data_buf.data) {
+                delete []data_buf.data;
+            }
+        }
+    };
+    auto args = std::make_shared<Args>();
+    if (!ParseInternalKey(key, args->user_key, args->chunk_id, args->chunk_size)) {
+        LOG(WARNING) << "Unable to fill read cache, malformed key: " << key;
+        return folly::makeFuture(CACHE_ENTRY_NOT_FOUND);
+    }
+
+    LOG_IF(INFO, FLAGS_verbose) << "Fill key: " << key;
+    return base_adaptor_->Head(args->user_key, args->size, args->headers)
+        .then([this, args, key](folly::Try<int> &&output) -> Future<int> {
+            if (output.value_or(FOLLY_ERROR) != OK) {
+                return folly::makeFuture(output.value_or(FOLLY_ERROR));
+            }
+            const uint64_t chunk_start = args->chunk_id * args->chunk_size;
+            if (chunk_start >= args->size) {
+                LOG(WARNING) << "Requested chunk exceeds object size, key: " << key
+                             << ", object size: " << args->size;
+                return folly::makeFuture(END_OF_FILE);
+            }
+            const uint64_t chunk_len = std::min(args->chunk_size, args->size - chunk_start);
+            args->data_buf.len = chunk_len + AWS_BUFFER_PADDING;
+            args->data_buf.data = new char[args->data_buf.len];
+            return base_adaptor_->DownLoad(args->user_key, chunk_start, chunk_len, args->data_buf)
+                .via(executor_.get())
+                .thenValue([this, args, key, chunk_len](int res) -> int {
+                    if (res != OK) {
+                        LOG(WARNING) << "Unable to fill read cache, key: " << key
+                                     << ", error code: " << res;
+                        return res;
+                    }
+                    butil::IOBuf buf;
+                    buf.append(args->data_buf.data, chunk_len);
+                    return impl_->Put(key, chunk_len, buf);
+                });
+        });
+}
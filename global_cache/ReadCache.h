@@ -1,9 +1,13 @@
 #ifndef MADFS_READ_CACHE_H
 #define MADFS_READ_CACHE_H
 
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/futures/SharedPromise.h>
 
 #include <butil/iobuf.h>
 
@@ -21,6 +25,13 @@ public:
     virtual int Delete(const std::string &key, uint64_t chunk_size, uint64_t max_chunk_id) = 0;
 };
 
+// With a base adaptor, a miss is filled by the server itself: the whole
+// chunk named by the internal key is fetched from the base adaptor and put
+// into the cache, then the request is served again. Concurrent misses of
+// the same internal key wait on one fill, and at most
+// --read_fill_concurrency fills are in flight, the rest are queued.
+// Clients rely on it: they return CACHE_ENTRY_NOT_FOUND of a server
+// without a base adaptor as is.
 class ReadCache {
 public:
     explicit ReadCache(std::shared_ptr<folly::CPUThreadPoolExecutor> executor, 
@@ -30,9 +41,7 @@ public:
         delete impl_;
     }
 
-    Future<GetOutput> Get(const std::string &key, uint64_t start, uint64_t length) {
-        return impl_->Get(key, start, length);
-    }
+    Future<GetOutput> Get(const std::string &key, uint64_t start, uint64_t length);
 
     int Put(const std::string &key, uint64_t length, const butil::IOBuf &buf) {
         return impl_->Put(key, length, buf);
@@ -46,8 +55,30 @@ public:
         return impl_->Delete(key, chunk_size, max_chunk_id);
     }
 
+    // internal_key is <user_key>-<chunk_id>-<chunk_size>, see ReadCacheClient
+    static bool ParseInternalKey(const std::string &internal_key,
+                                 std::string &user_key,
+                                 uint64_t &chunk_id,
+                                 uint64_t &chunk_size);
+
+private:
+    Future<int> Fill(const std::string &key);
+
+    void StartFill(const std::string &key);
+
+    Future<int> DoFill(const std::string &key);
+
+    void OnFillDone(const std::string &key, int res);
+
 private:
     ReadCacheImpl *impl_;
+    std::shared_ptr<folly::CPUThreadPoolExecutor> executor_;
+    std::shared_ptr<DataAdaptor> base_adaptor_;
+
+    std::mutex fill_mutex_;
+    std::unordered_map<std::string, std::shared_ptr<folly::SharedPromise<int>>> fills_;
+    std::deque<std::string> pending_fills_;
+    size_t inflight_fills_ = 0;
 };
 
 #endif // MADFS_READ_CACHE_H
\ No newline at end of file
@@ -1,7 +1,8 @@
 #include "ReadCacheClient.h"
 #include "GlobalDataAdaptor.h"
+#include "SlidingWindow.h"
 
-#define AWS_BUFFER_PADDING 64
+DEFINE_uint32(read_batch_chunks, 16, "Max chunks fetched from one server by a batched RPC, 1 to disable batching");
 
 ReadCacheClient::ReadCacheClient(GlobalDataAdaptor *parent)
         : parent_(parent) {}
@@ -12,7 +13,6 @@ folly::Future<int> ReadCacheClient::Get(const std::string &key, size_t start, si
     butil::Timer t;
     t.start();
     LOG_IF(INFO, FLAGS_verbose) << "Get key=" << key << ", start=" << start << ", size=" << size;
-    std::vector<folly::Future<int>> future_list;
     std::vector<GetChunkRequestV2> requests;
     auto &policy = parent_->GetCachePolicy(key);
     const int num_choose = policy.read_replication_factor;
@@ -21,164 +21,180 @@ folly::Future<int> ReadCacheClient::Get(const std::string &key, size_t start, si
         return folly::makeFuture(OK);
 
     auto DoGetChunkAsync = [this, num_choose](GetChunkRequestV2 &entry) -> folly::Future<int> {
-        auto replicas = GetReplica(entry.internal_key, num_choose);
-        int primary_server_id = replicas[lrand48() % replicas.size()];
-        return GetChunkAsync(primary_server_id, entry).thenValue([this, replicas, entry, primary_server_id](int res) -> int {
-            if (res != RPC_FAILED) {
-                return res;
-            }
-            LOG_EVERY_SECOND(WARNING) << "Unable to connect primary replicas. server_id " << primary_server_id
-                                      << ", hostname: " << parent_->GetServerHostname(primary_server_id);
-            for (auto &server_id : replicas) {
-                if (server_id == primary_server_id) {
-                    continue;
-                }
-                res = GetChunkAsync(server_id, entry).get();
-                if (res != RPC_FAILED) {
-                    return res;
-                }
-                LOG_EVERY_SECOND(WARNING) << "Unable to connect secondary replicas. server_id " << server_id
-                                            << ", hostname: " << parent_->GetServerHostname(server_id);
-            }
-            LOG_EVERY_SECOND(ERROR) << "Unable to connect all target replicas";
-            return RPC_FAILED;
-        });
+        return GetChunkAsync(GetReplica(entry.internal_key, num_choose), entry);
     };
 
     if (requests.size() == 1) {
         return DoGetChunkAsync(requests[0]);
     }
 
-    size_t aggregated_size = 0;
+    auto OnFinish = [=](int res) -> int {
+        if (res != OK) {
+            LOG(ERROR) << "Failed to get data from read cache, key: " << key
+                       << ", start: " << start
+                       << ", size: " << size
+                       << ", buf: " << (void *) buffer.data << " " << buffer.len
+                       << ", error code: " << res;
+        }
+        return res;
+    };
+
+    if (FLAGS_read_batch_chunks <= 1) {
+        std::vector<size_t> sizes;
+        for (auto &entry: requests) {
+            sizes.push_back(entry.chunk_len);
+        }
+        auto shared_requests = std::make_shared<std::vector<GetChunkRequestV2>>(std::move(requests));
+        return SlidingWindow::Run(std::move(sizes), GetGlobalConfig().max_inflight_payload_size,
+                [shared_requests, DoGetChunkAsync](size_t index) -> folly::Future<int> {
+                    return DoGetChunkAsync((*shared_requests)[index]);
+                }).via(parent_->executor_.get()).thenValue(OnFinish);
+    }
+
+    // chunks going to the same server share one RPC
+    std::vector<std::vector<int>> replicas;
+    std::vector<int> server_ids;
     for (auto &entry: requests) {
-        aggregated_size += entry.chunk_len;
-        future_list.emplace_back(DoGetChunkAsync(entry));
-        if (aggregated_size >= GetGlobalConfig().max_inflight_payload_size) {
-            auto output = folly::collectAll(future_list).get();
-            for (auto &entry: output)
-                if (entry.value_or(FOLLY_ERROR) != OK) {
-                    LOG(ERROR) << "Failed to get data from read cache, key: " << key
-                                << ", start: " << start
-                                << ", size: " << size
-                                << ", buf: " << (void *) buffer.data << " " << buffer.len
-                                << ", error code: " << entry.value_or(FOLLY_ERROR);
-                    return entry.value_or(FOLLY_ERROR);
-                }
-            future_list.clear();
+        replicas.push_back(GetReplica(entry.internal_key, num_choose));
+        auto &candidates = replicas.back();
+        server_ids.push_back(candidates.empty() ? -1 : candidates[parent_->replica_selector_->Order(candidates)[0]]);
+    }
+    std::vector<GetChunkBatch> batches;
+    GroupGetChunkRequests(requests, replicas, server_ids, batches, FLAGS_read_batch_chunks);
+
+    std::vector<size_t> sizes;
+    auto shared_batches = std::make_shared<std::vector<std::shared_ptr<GetChunkBatch>>>();
+    for (auto &batch: batches) {
+        size_t batch_size = 0;
+        for (auto &entry: batch.requests) {
+            batch_size += entry.chunk_len;
         }
+        sizes.push_back(batch_size);
+        shared_batches->push_back(std::make_shared<GetChunkBatch>(std::move(batch)));
     }
-    
-    if (future_list.empty()) return OK;
-    
-    return folly::collectAll(future_list).via(parent_->executor_.get()).thenValue(
-            [=](std::vector <folly::Try<int>> output) -> int {
+    return SlidingWindow::Run(std::move(sizes), GetGlobalConfig().max_inflight_payload_size,
+            [this, shared_batches](size_t index) -> folly::Future<int> {
+                return GetChunkBatchAsync((*shared_batches)[index]);
+            }).via(parent_->executor_.get()).thenValue(OnFinish);
+}
+
+void ReadCacheClient::GroupGetChunkRequests(std::vector<GetChunkRequestV2> &requests,
+                                            std::vector<std::vector<int>> &replicas,
+                                            std::vector<int> &server_ids,
+                                            std::vector<GetChunkBatch> &batches,
+                                            size_t max_batch_chunks) {
+    max_batch_chunks = std::max<size_t>(max_batch_chunks, 1);
+    // index of the batch still accepting requests for each server
+    std::map<int, size_t> open_batches;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        auto iter = open_batches.find(server_ids[i]);
+        if (iter == open_batches.end() || batches[iter->second].requests.size() >= max_batch_chunks) {
+            GetChunkBatch batch;
+            batch.server_id = server_ids[i];
+            batches.push_back(std::move(batch));
+            open_batches[server_ids[i]] = batches.size() - 1;
+            iter = open_batches.find(server_ids[i]);
+        }
+        auto &batch = batches[iter->second];
+        batch.requests.push_back(std::move(requests[i]));
+        batch.replicas.push_back(std::move(replicas[i]));
+    }
+}
+
+folly::Future<int> ReadCacheClient::GetChunkBatchAsync(std::shared_ptr<GetChunkBatch> batch) {
+    if (batch->requests.size() == 1 || batch->server_id < 0) {
+        std::vector<folly::Future<int>> future_list;
+        for (size_t i = 0; i < batch->requests.size(); ++i) {
+            future_list.emplace_back(GetChunkAsync(batch->replicas[i], batch->requests[i]));
+        }
+        return folly::collectAll(std::move(future_list)).via(parent_->executor_.get()).thenValue(
+            [](std::vector<folly::Try<int>> &&output) -> int {
                 for (auto &entry: output)
-                    if (entry.value_or(FOLLY_ERROR) != OK) {
-                        LOG(ERROR) << "Failed to get data from read cache, key: " << key
-                                   << ", start: " << start
-                                   << ", size: " << size
-                                   << ", buf: " << (void *) buffer.data << " " << buffer.len
-                                   << ", error code: " << entry.value_or(FOLLY_ERROR);
+                    if (entry.value_or(FOLLY_ERROR) != OK)
                         return entry.value_or(FOLLY_ERROR);
-                    }
                 return OK;
             });
+    }
+
+    LOG_IF(INFO, FLAGS_verbose) << "GetChunkBatchAsync server_id=" << batch->server_id
+                                << ", chunks=" << batch->requests.size()
+                                << ", first internal_key=" << batch->requests[0].internal_key;
+    std::vector<GetEntryArgs> entries;
+    for (auto &request: batch->requests) {
+        entries.push_back(GetEntryArgs{ request.internal_key, request.chunk_start, request.chunk_len });
+    }
+    const int server_id = batch->server_id;
+    const int64_t start_us = butil::cpuwide_time_us();
+    parent_->replica_selector_->OnStart(server_id);
+    return parent_->GetRpcClient()->BatchGetEntryFromReadCache(server_id, entries)
+        .then([this, batch, server_id, start_us](folly::Try<std::vector<GetOutput>> &&output) -> folly::Future<int> {
+            const bool failed = !output.hasValue() || output.value().empty()
+                                || output.value()[0].status == RPC_FAILED;
+            // the latency is amortized over the chunks so that batched and
+            // single reads of a server feed comparable samples
+            parent_->replica_selector_->OnFinish(server_id,
+                                                 (butil::cpuwide_time_us() - start_us) / batch->requests.size(),
+                                                 failed);
+            if (!output.hasValue()) {
+                return folly::makeFuture(FOLLY_ERROR);
+            }
+
+            std::vector<folly::Future<int>> future_list;
+            for (size_t i = 0; i < batch->requests.size(); ++i) {
+                auto &request = batch->requests[i];
+                auto &value = output.value()[i];
+                if (value.status == OK) {
+                    value.buf.copy_to(request.buffer.data, request.buffer.len);
+                } else if (value.status == RPC_FAILED) {
+                    // retry the other replicas chunk by chunk
+                    future_list.emplace_back(GetChunkAsync(batch->replicas[i], request));
+                } else {
+                    future_list.emplace_back(folly::makeFuture(value.status));
+                }
+            }
+            if (future_list.empty()) {
+                return folly::makeFuture(OK);
+            }
+            return folly::collectAll(std::move(future_list)).via(parent_->executor_.get()).thenValue(
+                [](std::vector<folly::Try<int>> &&output) -> int {
+                    for (auto &entry: output)
+                        if (entry.value_or(FOLLY_ERROR) != OK)
+                            return entry.value_or(FOLLY_ERROR);
+                    return OK;
+                });
+        });
 }
 
 folly::Future<int> ReadCacheClient::GetChunkAsync(int server_id, GetChunkRequestV2 request) {
-    LOG_IF(INFO, FLAGS_verbose) << "GetChunkAsync server_id=" << server_id
+    return GetChunkAsync(std::vector<int>{ server_id }, request);
+}
+
+folly::Future<int> ReadCacheClient::GetChunkAsync(const std::vector<int> &replicas, GetChunkRequestV2 request) {
+    LOG_IF(INFO, FLAGS_verbose) << "GetChunkAsync replicas=" << replicas.size()
                                 << ", internal_key=" << request.internal_key
                                 << ", chunk_id=" << request.chunk_id
                                 << ", chunk_start=" << request.chunk_start
                                 << ", chunk_len=" << request.chunk_len
                                 << ", buffer=" << (void *) request.buffer.data;
-    return parent_->GetRpcClient()->GetEntryFromReadCache(server_id, request.internal_key, request.chunk_start, request.chunk_len)
-        .then([this, server_id, request](folly::Try<GetOutput> &&output) -> folly::Future<int> {
+    auto fetch = [this, replicas, request](int replica_index) -> folly::Future<GetOutput> {
+        return parent_->GetRpcClient()->GetEntryFromReadCache(replicas[replica_index],
+                                                              request.internal_key,
+                                                              request.chunk_start,
+                                                              request.chunk_len);
+    };
+    // only the winning replica copies into the user buffer
+    return parent_->replica_selector_->HedgedGet(replicas, fetch)
+        .then([request](folly::Try<ReplicaGetOutput> &&output) -> folly::Future<int> {
             if (!output.hasValue()) {
                 return folly::makeFuture(FOLLY_ERROR);
             }
-            auto &value = output.value();
+            auto &value = output.value().output;
             if (value.status == OK) {
                 value.buf.copy_to(request.buffer.data, request.buffer.len);
                 return folly::makeFuture(OK);
-            } else if (value.status == CACHE_ENTRY_NOT_FOUND) {
-                return GetChunkFromGlobalCache(server_id, request);
-            } else {
-                return folly::makeFuture(value.status);
-            }
-        });
-}
-
-folly::Future<int> ReadCacheClient::GetChunkFromGlobalCache(int server_id, GetChunkRequestV2 request) {
-    struct Args {
-        size_t size;
-        std::map<std::string, std::string> headers;
-        ByteBuffer data_buf;
-
-        ~Args() {
-            if (data_buf.data) {
-                delete []data_buf.data;
-            }
-        }
-    };
-    auto args = std::make_shared<Args>();
-    // auto f = parent_->base_adaptor_->Head(request.user_key, args->size, args->headers)
-    auto f = parent_->Head(request.user_key, args->size, args->headers)
-        .then([this, args, request] (folly::Try<int> &&output) -> folly::Future<int> {
-            if (output.value_or(FOLLY_ERROR) != OK) {
-                return folly::makeFuture(output.value_or(FOLLY_ERROR));
-            }
-
-            const size_t align_chunk_start = request.chunk_id * request.chunk_granularity;
-            const size_t align_chunk_stop = std::min(align_chunk_start + request.chunk_granularity, args->size);
-            
-            if (align_chunk_start + request.chunk_start + request.chunk_len > args->size) {
-                LOG(WARNING) << "Requested data range exceeds object size, key: " << request.user_key
-                             << " request offset: " << align_chunk_start + request.chunk_start + request.chunk_len
-                             << ", size: " << args->size;
-                return folly::makeFuture(END_OF_FILE);
-            } else if (align_chunk_start == align_chunk_stop) {
-                return folly::makeFuture(OK);
-            } else if (align_chunk_start > align_chunk_stop) {
-                LOG(WARNING) << "Unexpected request range, key: " << request.user_key
-                             << " start offset: " << align_chunk_start
-                             << ", end offset: " << align_chunk_stop;
-                return folly::makeFuture(INVALID_ARGUMENT);
-            }
-
-            args->data_buf.len = align_chunk_stop - align_chunk_start + AWS_BUFFER_PADDING;
-            args->data_buf.data = new char[args->data_buf.len];
-            return parent_->base_adaptor_->DownLoad(request.user_key, 
-                                                    align_chunk_start,
-                                                    align_chunk_stop - align_chunk_start,
-                                                    args->data_buf);
-        }).then([this, args, request] (folly::Try<int> &&output) -> folly::Future<int> {
-            if (output.value_or(FOLLY_ERROR) != OK) {
-                return folly::makeFuture(output.value_or(FOLLY_ERROR));
             }
-            
-            memcpy(request.buffer.data, args->data_buf.data + request.chunk_start, request.chunk_len);
-            args->data_buf.len -= AWS_BUFFER_PADDING;
-            auto &policy = parent_->GetCachePolicy(request.user_key);
-            auto replicas = GetReplica(request.internal_key, policy.read_replication_factor);
-            std::vector <folly::Future<PutOutput>> future_list;
-            for (auto server_id: replicas)
-                future_list.emplace_back(parent_->GetRpcClient()->PutEntryFromReadCache(server_id, 
-                                                                                        request.internal_key, 
-                                                                                        args->data_buf,
-                                                                                        args->data_buf.len));
-            return folly::collectAll(std::move(future_list)).via(parent_->executor_.get()).thenValue(
-                [](std::vector <folly::Try<PutOutput>> &&output) -> int {
-                    for (auto &entry: output) {
-                        if (!entry.hasValue())
-                            return FOLLY_ERROR;
-                        if (entry.value().status != OK)
-                            return entry.value().status;
-                    }
-                    return OK;
-                });
+            return folly::makeFuture(value.status);
         });
-    return f;
 }
 
 folly::Future<int> ReadCacheClient::Invalidate(const std::string &key, size_t size) {
@@ -187,8 +203,8 @@ folly::Future<int> ReadCacheClient::Invalidate(const std::string &key, size_t si
     auto &policy = parent_->GetCachePolicy(key);
     const size_t chunk_size = policy.read_chunk_size;
     const size_t end_chunk_id = (size + chunk_size - 1) / chunk_size;
-    for (int server_id = 0; server_id < parent_->server_list_.size(); server_id++) {
-        future_list.emplace_back(parent_->GetRpcClient()->DeleteEntryFromReadCache(server_id, key, chunk_size, end_chunk_id));
+    for (auto &server : parent_->GetPlacement()->GetServers()) {
+        future_list.emplace_back(parent_->GetRpcClient()->DeleteEntryFromReadCache(server.first, key, chunk_size, end_chunk_id));
     }
     return folly::collectAll(future_list).via(parent_->executor_.get()).thenValue(
             [](std::vector <folly::Try<int>> output) -> int {
@@ -226,7 +242,6 @@ void ReadCacheClient::GenerateGetChunkRequestsV2(const std::string &key,
         item.chunk_id = chunk_id;
         item.chunk_start = chunk_start % chunk_size;
         item.chunk_len = chunk_stop - chunk_start;
-        item.chunk_granularity = chunk_size;
         item.buffer.data = buffer.data + buffer_offset;
         item.buffer.len = item.chunk_len;
         buffer_offset += item.chunk_len;
@@ -236,10 +251,6 @@ void ReadCacheClient::GenerateGetChunkRequestsV2(const std::string &key,
 }
 
 std::vector<int> ReadCacheClient::GetReplica(const std::string &key, int num_choose) {
-    const int num_available = parent_->server_list_.size();
-    uint64_t seed = std::hash < std::string > {}(key);
-    std::vector<int> output;
-    for (int i = 0; i < std::min(num_available, num_choose); ++i)
-        output.push_back((seed + i) % num_available);
-    return output;
+    auto placement = parent_->GetPlacement();
+    return placement->Locate(key, std::min(placement->GetServerCount(), num_choose));
 }
\ No newline at end of file
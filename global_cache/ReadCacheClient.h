@@ -7,10 +7,13 @@
 
 #include "Common.h"
 #include "Placement.h"
+#include "GlobalCacheClient.h"
 #include "data_adaptor.h"
 
 using HybridCache::ByteBuffer;
 
+DECLARE_uint32(read_batch_chunks);
+
 class GlobalDataAdaptor;
 
 class ReadCacheClient {
@@ -36,7 +39,6 @@ public:
         size_t chunk_id;
         size_t chunk_start;
         size_t chunk_len;
-        size_t chunk_granularity;
         ByteBuffer buffer;
     };
 
@@ -49,7 +51,23 @@ public:
 
     folly::Future<int> GetChunkAsync(int server_id, GetChunkRequestV2 context);
 
-    folly::Future<int> GetChunkFromGlobalCache(int server_id, GetChunkRequestV2 context);
+    // latency-aware replica choice with hedging, see ReplicaSelector
+    folly::Future<int> GetChunkAsync(const std::vector<int> &replicas, GetChunkRequestV2 context);
+
+    // chunks fetched from one server by a single BatchGetEntry RPC
+    struct GetChunkBatch {
+        int server_id;
+        std::vector<GetChunkRequestV2> requests;
+        std::vector<std::vector<int>> replicas;    // replicas of each request
+    };
+
+    static void GroupGetChunkRequests(std::vector<GetChunkRequestV2> &requests,
+                                      std::vector<std::vector<int>> &replicas,
+                                      std::vector<int> &server_ids,
+                                      std::vector<GetChunkBatch> &batches,
+                                      size_t max_batch_chunks);
+
+    folly::Future<int> GetChunkBatchAsync(std::shared_ptr<GetChunkBatch> batch);
 
     std::vector<int> GetReplica(const std::string &key, int num_choose);
 
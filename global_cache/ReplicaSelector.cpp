@@ -0,0 +1,170 @@
+#include <butil/time.h>
+#include <algorithm>
+#include <mutex>
+#include <numeric>
+
+#include "ReplicaSelector.h"
+
+DEFINE_bool(hedged_read, true, "Send a hedged request to the next replica when the first one is slower than its p95");
+DEFINE_uint64(hedge_min_delay_us, 1000, "Lower bound of the hedge delay in microseconds");
+
+// weight of a new latency sample is 1 / (1 << EWMA_SHIFT)
+#define EWMA_SHIFT 3
+
+struct ReplicaSelector::HedgeContext {
+    std::vector<int> replicas;
+    std::vector<int> order;
+    FetchFunc fetch;
+    folly::Promise<ReplicaGetOutput> promise;
+
+    std::mutex mutex;
+    size_t launched = 0;
+    size_t finished = 0;
+    bool done = false;
+};
+
+ReplicaSelector::ReplicaSelector(std::shared_ptr<folly::CPUThreadPoolExecutor> executor)
+        : stats_(new ServerStats[kMaxServers]), executor_(executor) {}
+
+uint64_t ReplicaSelector::Score(int server_id) {
+    auto stats = GetStats(server_id);
+    if (!stats) {
+        return 0;
+    }
+    return stats->ewma_us.load(std::memory_order_relaxed)
+           * (stats->inflight.load(std::memory_order_relaxed) + 1);
+}
+
+std::vector<int> ReplicaSelector::Order(const std::vector<int> &replicas) {
+    std::vector<int> order(replicas.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (order.size() < 2) {
+        return order;
+    }
+
+    std::vector<uint64_t> scores;
+    for (auto server_id : replicas) {
+        scores.push_back(Score(server_id));
+    }
+
+    // power of two choices for the first replica, so that an idle or
+    // unmeasured server is preferred without herding onto one server
+    int first = lrand48() % order.size();
+    int second = (first + 1 + lrand48() % (order.size() - 1)) % order.size();
+    if (scores[second] < scores[first]) {
+        first = second;
+    }
+    std::swap(order[0], order[first]);
+    std::sort(order.begin() + 1, order.end(), [&scores](int lhs, int rhs) {
+        return scores[lhs] < scores[rhs];
+    });
+    return order;
+}
+
+folly::Future<ReplicaGetOutput> ReplicaSelector::HedgedGet(const std::vector<int> &replicas, FetchFunc fetch) {
+    auto ctx = std::make_shared<HedgeContext>();
+    ctx->replicas = replicas;
+    ctx->order = Order(replicas);
+    ctx->fetch = std::move(fetch);
+    auto future = ctx->promise.getFuture();
+    if (replicas.empty()) {
+        ReplicaGetOutput result;
+        result.replica_index = -1;
+        result.output.status = RPC_FAILED;
+        ctx->promise.setValue(std::move(result));
+        return future;
+    }
+
+    Launch(ctx);
+    if (FLAGS_hedged_read && replicas.size() > 1) {
+        auto delay = std::chrono::microseconds(GetHedgeDelayUs(replicas[ctx->order[0]]));
+        folly::futures::sleep(delay, &timekeeper_).via(executor_.get())
+            .thenValue([this, ctx](folly::Unit) { Launch(ctx); });
+    }
+    return future;
+}
+
+void ReplicaSelector::Launch(std::shared_ptr<HedgeContext> ctx) {
+    int replica_index;
+    {
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        if (ctx->done || ctx->launched == ctx->order.size()) {
+            return;
+        }
+        replica_index = ctx->order[ctx->launched++];
+    }
+
+    const int server_id = ctx->replicas[replica_index];
+    const int64_t start_us = butil::cpuwide_time_us();
+    OnStart(server_id);
+    ctx->fetch(replica_index).then([this, ctx, replica_index, server_id, start_us](folly::Try<GetOutput> &&output) {
+        const bool failed = !output.hasValue() || output.value().status == RPC_FAILED;
+        OnFinish(server_id, butil::cpuwide_time_us() - start_us, failed);
+
+        std::unique_lock<std::mutex> lock(ctx->mutex);
+        ctx->finished++;
+        if (ctx->done) {
+            return;     // lost the race, the winner owns the user buffer
+        }
+        if (!failed) {
+            ctx->done = true;
+            lock.unlock();
+            ctx->promise.setValue(ReplicaGetOutput{ replica_index, std::move(output.value()) });
+            return;
+        }
+        LOG_EVERY_SECOND(WARNING) << "Unable to connect replica, server_id " << server_id;
+        if (ctx->launched < ctx->order.size()) {
+            lock.unlock();
+            Launch(ctx);
+            return;
+        }
+        if (ctx->finished == ctx->launched) {
+            ctx->done = true;
+            lock.unlock();
+            LOG_EVERY_SECOND(ERROR) << "Unable to connect all target replicas";
+            ReplicaGetOutput result;
+            result.replica_index = -1;
+            result.output.status = RPC_FAILED;
+            ctx->promise.setValue(std::move(result));
+        }
+    });
+}
+
+void ReplicaSelector::OnStart(int server_id) {
+    auto stats = GetStats(server_id);
+    if (stats) {
+        stats->inflight.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ReplicaSelector::OnFinish(int server_id, uint64_t latency_us, bool failed) {
+    auto stats = GetStats(server_id);
+    if (!stats) {
+        return;
+    }
+    stats->inflight.fetch_sub(1, std::memory_order_relaxed);
+    // an unreachable server counts as one that always times out
+    const uint64_t sample = failed ? std::max<uint64_t>(latency_us, GetGlobalConfig().rpc_timeout * 1000ull)
+                                   : latency_us;
+    const uint64_t ewma = stats->ewma_us.load(std::memory_order_relaxed);
+    if (ewma == 0) {
+        stats->ewma_us.store(sample, std::memory_order_relaxed);
+        return;
+    }
+    // racy updates only lose a sample, which is fine for an estimate
+    const int64_t diff = (int64_t) sample - (int64_t) ewma;
+    stats->ewma_us.store(ewma + diff / (1 << EWMA_SHIFT), std::memory_order_relaxed);
+    const uint64_t dev = stats->ewma_dev_us.load(std::memory_order_relaxed);
+    const int64_t dev_diff = std::abs(diff) - (int64_t) dev;
+    stats->ewma_dev_us.store(dev + dev_diff / (1 << EWMA_SHIFT), std::memory_order_relaxed);
+}
+
+uint64_t ReplicaSelector::GetHedgeDelayUs(int server_id) {
+    uint64_t delay = 0;
+    auto stats = GetStats(server_id);
+    if (stats) {
+        delay = stats->ewma_us.load(std::memory_order_relaxed)
+                + 2 * stats->ewma_dev_us.load(std::memory_order_relaxed);
+    }
+    return std::max<uint64_t>(delay, FLAGS_hedge_min_delay_us);
+}
@@ -0,0 +1,76 @@
+#ifndef MADFS_REPLICA_SELECTOR_H
+#define MADFS_REPLICA_SELECTOR_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/futures/ThreadWheelTimekeeper.h>
+
+#include "Common.h"
+
+DECLARE_bool(hedged_read);
+
+struct ReplicaGetOutput {
+    int replica_index;      // index into the replica list, -1 if none answered
+    GetOutput output;
+};
+
+// Latency-aware replica selection shared by the read cache and write cache
+// clients. Each server keeps an EWMA of its latency and its in-flight count;
+// a replica is chosen by power of two choices on ewma * (inflight + 1), and
+// a hedged request goes to the next replica once the first one is slower
+// than its p95 estimate.
+class ReplicaSelector {
+public:
+    // fetch the replica at the given index of the replica list
+    using FetchFunc = std::function<folly::Future<GetOutput>(int replica_index)>;
+
+    ReplicaSelector(std::shared_ptr<folly::CPUThreadPoolExecutor> executor);
+
+    ~ReplicaSelector() {}
+
+    // replica indexes ordered by preference, the first one is picked by
+    // power of two choices and the rest by score
+    std::vector<int> Order(const std::vector<int> &replicas);
+
+    // The first answer other than RPC_FAILED wins. A replica failing with
+    // RPC_FAILED, or not answering within the hedge delay, makes the next
+    // replica in order to be tried. Non-blocking.
+    folly::Future<ReplicaGetOutput> HedgedGet(const std::vector<int> &replicas, FetchFunc fetch);
+
+    void OnStart(int server_id);
+
+    void OnFinish(int server_id, uint64_t latency_us, bool failed);
+
+    // p95 estimate of the server: mean + 2 * mean deviation
+    uint64_t GetHedgeDelayUs(int server_id);
+
+private:
+    struct alignas(64) ServerStats {
+        std::atomic<uint64_t> ewma_us{0};
+        std::atomic<uint64_t> ewma_dev_us{0};
+        std::atomic<int64_t> inflight{0};
+    };
+
+    ServerStats *GetStats(int server_id) {
+        if (server_id < 0 || server_id >= kMaxServers)
+            return nullptr;
+        return &stats_[server_id];
+    }
+
+    uint64_t Score(int server_id);
+
+    struct HedgeContext;
+
+    void Launch(std::shared_ptr<HedgeContext> ctx);
+
+private:
+    static const int kMaxServers = 4096;
+    std::unique_ptr<ServerStats[]> stats_;
+    std::shared_ptr<folly::CPUThreadPoolExecutor> executor_;
+    folly::ThreadWheelTimekeeper timekeeper_;
+};
+
+#endif // MADFS_REPLICA_SELECTOR_H
@@ -1,5 +1,6 @@
 #include "ReplicationWriteCacheClient.h"
 #include "GlobalDataAdaptor.h"
+#include "SlidingWindow.h"
 
 folly::Future<PutResult> ReplicationWriteCacheClient::Put(const std::string &key,
                                                           size_t size,
@@ -79,75 +80,35 @@ folly::Future<int> ReplicationWriteCacheClient::Get(const std::string &key,
         replicas.push_back(entry.asInt());
     }
 
-    std::vector<std::string> internal_keys;
+    // shared by the chunk requests instead of copied into each of them
+    auto internal_keys = std::make_shared<std::vector<std::string>>();
     for (auto &entry : root["path"]) {
-        internal_keys.push_back(entry.asString());
+        internal_keys->push_back(entry.asString());
     }
 
-    std::vector <folly::Future<int>> future_list;
     std::vector<GetChunkRequestV2> requests;
     auto write_chunk_size = GetGlobalConfig().write_chunk_size;
     GenerateGetChunkRequestsV2(key, start, size, buffer, requests, write_chunk_size);
     if (requests.empty())
         return folly::makeFuture(OK);
 
-    size_t aggregated_size = 0;
+    std::vector<size_t> sizes;
     for (auto &entry: requests) {
-        int primary_replica_id  = lrand48() % replicas.size();
-        int primary_server_id = replicas[primary_replica_id];
-        std::string internal_key = internal_keys[entry.chunk_id * replicas.size() + primary_replica_id];
-        future_list.emplace_back(GetChunkAsync(primary_server_id, entry, internal_key)
-            .thenValue([this, replicas, entry, primary_server_id, internal_keys](int res) -> int {
-            if (res != RPC_FAILED) {
-                return res;
-            }
-            LOG_EVERY_SECOND(WARNING) << "Unable to connect primary replicas. server_id " << primary_server_id
-                                        << ", hostname: " << parent_->GetServerHostname(primary_server_id);
-            for (auto &server_id : replicas) {
-                if (server_id == primary_server_id) {
-                    continue;
-                }
-                auto internal_key = internal_keys[entry.chunk_id * replicas.size() + server_id];
-                res = GetChunkAsync(server_id, entry, internal_key).get();
-                if (res != RPC_FAILED) {
-                    return res;
-                }
-                LOG_EVERY_SECOND(WARNING) << "Unable to connect secondary replicas. server_id " << server_id
-                                            << ", hostname: " << parent_->GetServerHostname(server_id);
-            }
-            LOG_EVERY_SECOND(ERROR) << "Unable to connect all target replicas";
-            return RPC_FAILED;
-        }));
-
-        aggregated_size += entry.chunk_len;
-        if (aggregated_size >= GetGlobalConfig().max_inflight_payload_size) {
-            auto output = folly::collectAll(future_list).get();
-            for (auto &entry: output)
-                if (entry.value_or(FOLLY_ERROR) != OK) {
+        sizes.push_back(entry.chunk_len);
+    }
+    auto shared_requests = std::make_shared<std::vector<GetChunkRequestV2>>(std::move(requests));
+    return SlidingWindow::Run(std::move(sizes), GetGlobalConfig().max_inflight_payload_size,
+            [this, shared_requests, replicas, internal_keys](size_t index) -> folly::Future<int> {
+                return GetChunkAsync(replicas, (*shared_requests)[index], internal_keys);
+            }).via(parent_->executor_.get()).thenValue([=](int res) -> int {
+                if (res != OK) {
                     LOG(ERROR) << "Failed to get data from write cache, key: " << key
-                                << ", start: " << start
-                                << ", size: " << size
-                                << ", buf: " << (void *) buffer.data << " " << buffer.len
-                                << ", error code: " << entry.hasValue() << " "  << entry.value_or(FOLLY_ERROR);
-                    return entry.value_or(FOLLY_ERROR);
+                               << ", start: " << start
+                               << ", size: " << size
+                               << ", buf: " << (void *) buffer.data << " " << buffer.len
+                               << ", error code: " << res;
                 }
-            aggregated_size = 0;
-            future_list.clear();
-        }
-    }
-
-    return folly::collectAll(future_list).via(parent_->executor_.get()).thenValue(
-            [=](std::vector <folly::Try<int>> output) -> int {
-                for (auto &entry: output)
-                    if (entry.value_or(FOLLY_ERROR) != OK) {
-                        LOG(ERROR) << "Failed to get data from write cache, key: " << key
-                                   << ", start: " << start
-                                   << ", size: " << size
-                                   << ", buf: " << (void *) buffer.data << " " << buffer.len
-                                   << ", error code: " << entry.hasValue() << " "  << entry.value_or(FOLLY_ERROR);
-                        return entry.value_or(FOLLY_ERROR);
-                    }
-                return OK;
+                return res;
             });
 
     // return parent_->GetRpcClient()->GetEntryFromWriteCache(replica[primary_index], internal_keys[primary_index], start, size).thenValue(
@@ -201,15 +162,40 @@ folly::Future<int> ReplicationWriteCacheClient::GetChunkAsync(int server_id, Get
     // return folly::makeFuture(OK);
 }
 
+folly::Future<int> ReplicationWriteCacheClient::GetChunkAsync(const std::vector<int> &replicas,
+                                                              GetChunkRequestV2 request,
+                                                              std::shared_ptr<const std::vector<std::string>> internal_keys) {
+    LOG_IF(INFO, FLAGS_verbose) << "GetChunkAsync replicas=" << replicas.size()
+                                << ", chunk_id=" << request.chunk_id
+                                << ", chunk_start=" << request.chunk_start
+                                << ", chunk_len=" << request.chunk_len
+                                << ", buffer=" << (void *) request.buffer.data;
+    const size_t num_replicas = replicas.size();
+    auto fetch = [this, replicas, request, internal_keys, num_replicas](int replica_index) -> folly::Future<GetOutput> {
+        const std::string &internal_key = (*internal_keys)[request.chunk_id * num_replicas + replica_index];
+        return parent_->GetRpcClient()->GetEntryFromWriteCache(replicas[replica_index],
+                                                               internal_key,
+                                                               request.chunk_start,
+                                                               request.chunk_len);
+    };
+    // only the winning replica copies into the user buffer
+    return parent_->replica_selector_->HedgedGet(replicas, fetch)
+        .then([request](folly::Try<ReplicaGetOutput> &&output) -> int {
+            if (!output.hasValue()) {
+                return FOLLY_ERROR;
+            }
+            auto &value = output.value().output;
+            if (value.status == OK) {
+                value.buf.copy_to(request.buffer.data, request.buffer.len);
+            }
+            return value.status;
+        }).via(parent_->executor_.get());
+}
+
 std::vector<int> ReplicationWriteCacheClient::GetReplica(const std::string &key) {
-    const int num_available = parent_->server_list_.size();
     auto &policy = parent_->GetCachePolicy(key);
     const int num_choose = policy.write_replication_factor;
-    uint64_t seed = std::hash < std::string > {}(key);
-    std::vector<int> output;
-    for (int i = 0; i < num_choose; ++i)
-        output.push_back((seed + i) % num_available);
-    return output;
+    return parent_->GetPlacement()->Locate(key, num_choose);
 }
 
 void ReplicationWriteCacheClient::GenerateGetChunkRequestsV2(const std::string &key, 
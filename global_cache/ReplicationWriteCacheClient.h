@@ -50,6 +50,11 @@ public:
 
     folly::Future<int> GetChunkAsync(int server_id, GetChunkRequestV2 context, std::string &internal_key);
 
+    // latency-aware replica choice with hedging, see ReplicaSelector
+    folly::Future<int> GetChunkAsync(const std::vector<int> &replicas,
+                                     GetChunkRequestV2 context,
+                                     std::shared_ptr<const std::vector<std::string>> internal_keys);
+
 private:
     GlobalDataAdaptor *parent_;
 };
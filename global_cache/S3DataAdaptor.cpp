@@ -4,6 +4,12 @@
 #include <aws/s3/model/HeadObjectRequest.h>
 #include <aws/s3/model/GetObjectRequest.h>
 #include <aws/s3/model/DeleteObjectRequest.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/CompletedMultipartUpload.h>
+#include <aws/s3/model/CompletedPart.h>
 #include <aws/core/utils/memory/stl/AWSString.h>
 #include <aws/core/utils/stream/PreallocatedStreamBuf.h>
 
@@ -186,3 +192,115 @@ folly::Future<int> S3DataAdaptor::Head(const std::string &key,
     s3Client_->HeadObjectAsync(request, handler, nullptr);
     return promise->getFuture();
 }
+
+folly::Future<int> S3DataAdaptor::CreateMultipartUpload(const std::string &key,
+                                                        const std::map <std::string, std::string> &headers,
+                                                        std::string &upload_id) {
+    Aws::S3::Model::CreateMultipartUploadRequest request;
+    request.SetBucket(GetGlobalConfig().s3_config.bucket);
+    request.SetKey(key);
+    request.SetMetadata(headers);
+    auto promise = std::make_shared < folly::Promise < int >> ();
+    Aws::S3::CreateMultipartUploadResponseReceivedHandler handler =
+            [promise, &upload_id](
+                    const Aws::S3::S3Client */*client*/,
+                    const Aws::S3::Model::CreateMultipartUploadRequest &/*request*/,
+                    const Aws::S3::Model::CreateMultipartUploadOutcome &response,
+                    const std::shared_ptr<const Aws::Client::AsyncCallerContext> &awsCtx) {
+                if (response.IsSuccess()) {
+                    upload_id = response.GetResult().GetUploadId();
+                    promise->setValue(OK);
+                } else {
+                    LOG(ERROR) << "CreateMultipartUploadAsync error: "
+                               << response.GetError().GetExceptionName()
+                               << "message: " << response.GetError().GetMessage();
+                    promise->setValue(S3_INTERNAL_ERROR);
+                }
+            };
+    s3Client_->CreateMultipartUploadAsync(request, handler, nullptr);
+    return promise->getFuture();
+}
+
+folly::Future<int> S3DataAdaptor::UpLoadPart(const std::string &key,
+                                             const std::string &upload_id,
+                                             int part_number,
+                                             const ByteBuffer &buffer,
+                                             std::string &etag) {
+    Aws::S3::Model::UploadPartRequest request;
+    request.SetBucket(GetGlobalConfig().s3_config.bucket);
+    request.SetKey(key);
+    request.SetUploadId(upload_id);
+    request.SetPartNumber(part_number);
+    request.SetContentLength(buffer.len);
+    request.SetBody(Aws::MakeShared<PreallocatedIOStream>(AWS_ALLOCATE_TAG, buffer.data, buffer.len));
+    auto promise = std::make_shared < folly::Promise < int >> ();
+    Aws::S3::UploadPartResponseReceivedHandler handler =
+            [promise, &etag](
+                    const Aws::S3::S3Client */*client*/,
+                    const Aws::S3::Model::UploadPartRequest &/*request*/,
+                    const Aws::S3::Model::UploadPartOutcome &response,
+                    const std::shared_ptr<const Aws::Client::AsyncCallerContext> &awsCtx) {
+                if (response.IsSuccess()) {
+                    etag = response.GetResult().GetETag();
+                    promise->setValue(OK);
+                } else {
+                    LOG(ERROR) << "UploadPartAsync error: "
+                               << response.GetError().GetExceptionName()
+                               << "message: " << response.GetError().GetMessage();
+                    promise->setValue(S3_INTERNAL_ERROR);
+                }
+            };
+    s3Client_->UploadPartAsync(request, handler, nullptr);
+    return promise->getFuture();
+}
+
+folly::Future<int> S3DataAdaptor::CompleteMultipartUpload(const std::string &key,
+                                                          const std::string &upload_id,
+                                                          const std::vector<std::string> &etags) {
+    Aws::S3::Model::CompletedMultipartUpload completed;
+    for (size_t i = 0; i < etags.size(); ++i) {
+        completed.AddParts(Aws::S3::Model::CompletedPart().WithETag(etags[i]).WithPartNumber(i + 1));
+    }
+    Aws::S3::Model::CompleteMultipartUploadRequest request;
+    request.SetBucket(GetGlobalConfig().s3_config.bucket);
+    request.SetKey(key);
+    request.SetUploadId(upload_id);
+    request.SetMultipartUpload(completed);
+    auto promise = std::make_shared < folly::Promise < int >> ();
+    Aws::S3::CompleteMultipartUploadResponseReceivedHandler handler =
+            [promise](
+                    const Aws::S3::S3Client */*client*/,
+                    const Aws::S3::Model::CompleteMultipartUploadRequest &/*request*/,
+                    const Aws::S3::Model::CompleteMultipartUploadOutcome &response,
+                    const std::shared_ptr<const Aws::Client::AsyncCallerContext> &awsCtx) {
+                LOG_IF(ERROR, !response.IsSuccess())
+                        << "CompleteMultipartUploadAsync error: "
+                        << response.GetError().GetExceptionName()
+                        << "message: " << response.GetError().GetMessage();
+                promise->setValue(response.IsSuccess() ? OK : S3_INTERNAL_ERROR);
+            };
+    s3Client_->CompleteMultipartUploadAsync(request, handler, nullptr);
+    return promise->getFuture();
+}
+
+folly::Future<int> S3DataAdaptor::AbortMultipartUpload(const std::string &key, const std::string &upload_id) {
+    Aws::S3::Model::AbortMultipartUploadRequest request;
+    request.SetBucket(GetGlobalConfig().s3_config.bucket);
+    request.SetKey(key);
+    request.SetUploadId(upload_id);
+    auto promise = std::make_shared < folly::Promise < int >> ();
+    Aws::S3::AbortMultipartUploadResponseReceivedHandler handler =
+            [promise](
+                    const Aws::S3::S3Client */*client*/,
+                    const Aws::S3::Model::AbortMultipartUploadRequest &/*request*/,
+                    const Aws::S3::Model::AbortMultipartUploadOutcome &response,
+                    const std::shared_ptr<const Aws::Client::AsyncCallerContext> &awsCtx) {
+                LOG_IF(ERROR, !response.IsSuccess())
+                        << "AbortMultipartUploadAsync error: "
+                        << response.GetError().GetExceptionName()
+                        << "message: " << response.GetError().GetMessage();
+                promise->setValue(response.IsSuccess() ? OK : S3_INTERNAL_ERROR);
+            };
+    s3Client_->AbortMultipartUploadAsync(request, handler, nullptr);
+    return promise->getFuture();
+}
@@ -39,6 +39,25 @@ public:
                                     size_t &size,
                                     std::map <std::string, std::string> &headers);
 
+    // 分片上传, 大对象可以边读边传
+    folly::Future<int> CreateMultipartUpload(const std::string &key,
+                                             const std::map <std::string, std::string> &headers,
+                                             std::string &upload_id);
+
+    // part_number starts from 1, every part but the last is at least 5MB
+    folly::Future<int> UpLoadPart(const std::string &key,
+                                  const std::string &upload_id,
+                                  int part_number,
+                                  const ByteBuffer &buffer,
+                                  std::string &etag);
+
+    // etags[i] is the etag of part i + 1
+    folly::Future<int> CompleteMultipartUpload(const std::string &key,
+                                               const std::string &upload_id,
+                                               const std::vector<std::string> &etags);
+
+    folly::Future<int> AbortMultipartUpload(const std::string &key, const std::string &upload_id);
+
 private:
     Aws::Client::ClientConfiguration *clientCfg_;
     Aws::S3::S3Client *s3Client_;
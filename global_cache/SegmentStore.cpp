@@ -0,0 +1,421 @@
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <butil/logging.h>
+#include <folly/hash/Checksum.h>
+
+#include "FileSystemDataAdaptor.h"
+#include "SegmentStore.h"
+
+DEFINE_uint64(write_segment_size, 256 * 1024 * 1024, "Preallocated size of a write cache segment file");
+DEFINE_double(write_segment_compact_ratio, 0.25, "Sealed segments with less live data than this ratio are compacted");
+
+// records start at 8-byte aligned offsets, so a scan can step over torn records
+static const uint64_t kRecordAlign = 8;
+
+static inline uint64_t AlignRecord(uint64_t len) {
+    return (len + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+static uint32_t ChecksumIOBuf(const std::string &key, const butil::IOBuf &data) {
+    uint32_t crc = folly::crc32c((const uint8_t *) key.data(), key.size());
+    for (size_t i = 0; i < data.backing_block_num(); ++i) {
+        auto block = data.backing_block(i);
+        crc = folly::crc32c((const uint8_t *) block.data(), block.size(), crc);
+    }
+    return crc;
+}
+
+SegmentStore::SegmentStore(const std::string &dir) : dir_(dir) {}
+
+std::string SegmentStore::BuildSegmentPath(uint64_t segment_id) {
+    char name[32];
+    snprintf(name, sizeof(name), "segment-%020lu", segment_id);
+    return PathJoin(dir_, name);
+}
+
+int SegmentStore::Open() {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(dir_, ec);
+    if (ec) {
+        LOG(ERROR) << "Failed to create directory: " << dir_ << ", " << ec.message();
+        return IO_ERROR;
+    }
+
+    std::vector<uint64_t> segment_ids;
+    DIR *dir = opendir(dir_.c_str());
+    if (!dir) {
+        PLOG(ERROR) << "Failed to open directory: " << dir_;
+        return IO_ERROR;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        uint64_t segment_id;
+        if (sscanf(entry->d_name, "segment-%lu", &segment_id) == 1) {
+            segment_ids.push_back(segment_id);
+        }
+    }
+    closedir(dir);
+    std::sort(segment_ids.begin(), segment_ids.end());
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (auto segment_id : segment_ids) {
+        if (RecoverSegment(segment_id)) {
+            return IO_ERROR;
+        }
+        next_segment_id_ = segment_id + 1;
+    }
+
+    // keep appending to the last segment, seal the others
+    for (auto &entry : segments_) {
+        entry.second->sealed = true;
+    }
+    if (!segments_.empty()) {
+        auto last = segments_.rbegin()->second;
+        if (last->used < last->capacity) {
+            last->sealed = false;
+            active_ = last;
+        }
+    }
+
+    LOG(INFO) << "Segment store opened, directory: " << dir_
+              << ", segments: " << segments_.size()
+              << ", keys: " << index_.size()
+              << ", max ts: " << max_ts_;
+    return OK;
+}
+
+int SegmentStore::RecoverSegment(uint64_t segment_id) {
+    auto path = BuildSegmentPath(segment_id);
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to open segment: " << path;
+        return IO_ERROR;
+    }
+    auto segment = std::make_shared<Segment>();
+    segment->id = segment_id;
+    segment->file = std::make_shared<OpenFile>(fd);
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        PLOG(ERROR) << "Failed to stat segment: " << path;
+        return IO_ERROR;
+    }
+    segment->capacity = st.st_size;
+    segments_[segment_id] = segment;
+    if (segment->capacity == 0) {
+        return OK;
+    }
+
+    const char *base = (const char *) mmap(nullptr, segment->capacity, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to map segment: " << path;
+        return IO_ERROR;
+    }
+
+    // A record whose writer crashed is torn, but records after it may be
+    // durable and acknowledged: step over it instead of stopping
+    uint64_t offset = 0;
+    uint64_t records = 0;
+    while (offset + sizeof(RecordHeader) <= segment->capacity) {
+        const RecordHeader *header = (const RecordHeader *) (base + offset);
+        const uint64_t payload_len = (uint64_t) header->key_len + header->data_len;
+        if (header->magic != kRecordMagic
+            || payload_len > segment->capacity - offset - sizeof(RecordHeader)) {
+            offset += kRecordAlign;
+            continue;
+        }
+        const uint8_t *key_data = (const uint8_t *) (base + offset + sizeof(RecordHeader));
+        if (folly::crc32c(key_data + header->key_len, header->data_len,
+                          folly::crc32c(key_data, header->key_len)) != header->crc) {
+            offset += kRecordAlign;
+            continue;
+        }
+
+        std::string key((const char *) key_data, header->key_len);
+        const uint64_t record_len = AlignRecord(sizeof(RecordHeader) + payload_len);
+        auto iter = index_.find(key);
+        if (iter != index_.end()) {
+            // a compacted copy, keep the newer one
+            auto old_segment = segments_.at(iter->second.segment_id);
+            old_segment->live_bytes -= AlignRecord(sizeof(RecordHeader) + key.size() + iter->second.length);
+        }
+        index_[key] = Location{ segment_id, offset + sizeof(RecordHeader) + header->key_len, header->data_len, header->ts };
+        segment->live_bytes += record_len;
+        max_ts_ = std::max(max_ts_, header->ts);
+        offset += record_len;
+        segment->used = offset;
+        records++;
+    }
+    munmap((void *) base, segment->capacity);
+    LOG_IF(INFO, FLAGS_verbose) << "Recovered segment " << path << ", records: " << records
+                                << ", used: " << segment->used;
+    return OK;
+}
+
+std::shared_ptr<SegmentStore::Segment> SegmentStore::CreateSegment(uint64_t capacity) {
+    const uint64_t segment_id = next_segment_id_++;
+    auto path = BuildSegmentPath(segment_id);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to create segment: " << path;
+        return nullptr;
+    }
+    // preallocated space reads as zeros, never as a stale record
+    if (fallocate(fd, 0, 0, capacity)) {
+        PLOG(ERROR) << "Failed to preallocate segment: " << path;
+        int err = errno;
+        close(fd);
+        unlink(path.c_str());
+        errno = err;
+        return nullptr;
+    }
+    // persist the directory entry of the new segment
+    int dir_fd = open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    auto segment = std::make_shared<Segment>();
+    segment->id = segment_id;
+    segment->file = std::make_shared<OpenFile>(fd);
+    segment->capacity = capacity;
+    segments_[segment_id] = segment;
+    return segment;
+}
+
+std::shared_ptr<SegmentStore::Segment> SegmentStore::Reserve(uint64_t record_len, uint64_t &offset) {
+    if (!active_ || active_->used + record_len > active_->capacity) {
+        if (active_) {
+            active_->sealed = true;
+        }
+        active_ = CreateSegment(std::max(FLAGS_write_segment_size, record_len));
+        if (!active_) {
+            return nullptr;
+        }
+    }
+    offset = active_->used;
+    active_->used += record_len;
+    active_->writers++;
+    return active_;
+}
+
+int SegmentStore::WriteRecord(const std::shared_ptr<Segment> &segment, uint64_t offset,
+                              const std::string &key, uint64_t ts, const butil::IOBuf &data) {
+    std::string head(sizeof(RecordHeader), '\0');
+    RecordHeader *header = (RecordHeader *) &head[0];
+    header->magic = kRecordMagic;
+    header->key_len = key.size();
+    header->data_len = data.length();
+    header->ts = ts;
+    header->crc = ChecksumIOBuf(key, data);
+    head.append(key);
+
+    if (fully_pwrite(segment->file->fd, &head[0], head.size(), offset) != (ssize_t) head.size()) {
+        PLOG(ERROR) << "Failed to write record header, segment: " << segment->id << ", key: " << key;
+        return IO_ERROR;
+    }
+    // the data blocks go to the file without being gathered first
+    butil::IOBuf pieces = data;
+    off_t data_offset = offset + head.size();
+    while (!pieces.empty()) {
+        ssize_t nbytes = pieces.pcut_into_file_descriptor(segment->file->fd, data_offset);
+        if (nbytes < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            PLOG(ERROR) << "Failed to write record data, segment: " << segment->id << ", key: " << key;
+            return IO_ERROR;
+        }
+        data_offset += nbytes;
+    }
+    return OK;
+}
+
+int SegmentStore::Append(const std::string &key, uint64_t ts, const butil::IOBuf &data) {
+    return AppendRecord(key, ts, data, nullptr);
+}
+
+int SegmentStore::AppendRecord(const std::string &key, uint64_t ts, const butil::IOBuf &data,
+                               const Location *expected) {
+    const uint64_t record_len = AlignRecord(sizeof(RecordHeader) + key.size() + data.length());
+    std::shared_ptr<Segment> segment;
+    uint64_t offset;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        segment = Reserve(record_len, offset);
+        if (!segment) {
+            return errno == ENOSPC ? NO_ENOUGH_DISKSPACE : IO_ERROR;
+        }
+    }
+
+    int res = WriteRecord(segment, offset, key, ts, data);
+    if (res == OK) {
+        res = committer_.Commit(segment->file);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    segment->writers--;
+    if (res != OK) {
+        return res;     // the reserved space stays dead
+    }
+    auto iter = index_.find(key);
+    if (expected) {
+        // compaction: the key may have been deleted meanwhile
+        if (iter == index_.end() || iter->second.segment_id != expected->segment_id
+            || iter->second.offset != expected->offset) {
+            return OK;
+        }
+    }
+    if (iter != index_.end()) {
+        auto old_segment = segments_.find(iter->second.segment_id);
+        if (old_segment != segments_.end()) {
+            old_segment->second->live_bytes -= AlignRecord(sizeof(RecordHeader) + key.size() + iter->second.length);
+        }
+    }
+    index_[key] = Location{ segment->id, offset + sizeof(RecordHeader) + key.size(), data.length(), ts };
+    segment->live_bytes += record_len;
+    return OK;
+}
+
+int SegmentStore::Read(const std::string &key, uint64_t start, uint64_t length, butil::IOBuf &output) {
+    Location location;
+    OpenFilePtr file;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto iter = index_.find(key);
+        if (iter == index_.end()) {
+            return NOT_FOUND;
+        }
+        location = iter->second;
+        // the file stays open even if the segment is removed meanwhile
+        file = segments_.at(location.segment_id)->file;
+    }
+    if (length == 0 || start + length > location.length) {
+        return INVALID_ARGUMENT;
+    }
+
+    butil::IOPortal portal;
+    off_t offset = location.offset + start;
+    while (portal.length() < length) {
+        ssize_t nbytes = portal.pappend_from_file_descriptor(file->fd, offset, length - portal.length());
+        if (nbytes < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            PLOG(ERROR) << "Failed to read record, segment: " << location.segment_id << ", key: " << key;
+            return IO_ERROR;
+        } else if (nbytes == 0) {
+            LOG(ERROR) << "Unexpected end of segment " << location.segment_id << ", key: " << key;
+            return IO_ERROR;
+        }
+        offset += nbytes;
+    }
+    output.append(portal);
+    return OK;
+}
+
+int SegmentStore::Delete(const std::string &key_prefix,
+                         const std::function<bool(const std::string &key, uint64_t ts)> &filter) {
+    // appends and reads go on while the victims are picked
+    std::vector<std::pair<std::string, Location>> victims;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto iter = index_.lower_bound(key_prefix);
+        for (; iter != index_.end() && !iter->first.compare(0, key_prefix.size(), key_prefix); ++iter) {
+            if (filter(iter->first, iter->second.ts)) {
+                victims.emplace_back(iter->first, iter->second);
+            }
+        }
+    }
+
+    std::vector<uint64_t> to_remove;
+    std::vector<std::shared_ptr<Segment>> to_compact;
+    size_t deleted = 0;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        for (auto &victim : victims) {
+            // skip the keys appended again or moved by compaction meanwhile
+            auto iter = index_.find(victim.first);
+            if (iter == index_.end() || iter->second.segment_id != victim.second.segment_id
+                    || iter->second.offset != victim.second.offset) {
+                continue;
+            }
+            segments_.at(iter->second.segment_id)->live_bytes -=
+                    AlignRecord(sizeof(RecordHeader) + iter->first.size() + iter->second.length);
+            index_.erase(iter);
+            deleted++;
+        }
+        for (auto &entry : segments_) {
+            auto &segment = entry.second;
+            if (!segment->sealed || segment->writers) {
+                continue;
+            }
+            if (segment->live_bytes == 0) {
+                to_remove.push_back(segment->id);
+            } else if (segment->live_bytes < segment->used * FLAGS_write_segment_compact_ratio) {
+                to_compact.push_back(segment);
+            }
+        }
+    }
+
+    for (auto segment_id : to_remove) {
+        RemoveSegment(segment_id);
+    }
+    for (auto &segment : to_compact) {
+        Compact(segment);
+    }
+    LOG(INFO) << "Deleted " << deleted << " keys from segment store"
+              << ", removed segments: " << to_remove.size()
+              << ", compacted segments: " << to_compact.size();
+    return OK;
+}
+
+void SegmentStore::Compact(const std::shared_ptr<Segment> &segment) {
+    std::vector<std::pair<std::string, Location>> records;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (auto &entry : index_) {
+            if (entry.second.segment_id == segment->id) {
+                records.emplace_back(entry.first, entry.second);
+            }
+        }
+    }
+
+    for (auto &record : records) {
+        butil::IOBuf data;
+        if (Read(record.first, 0, record.second.length, data) != OK) {
+            continue;
+        }
+        if (AppendRecord(record.first, record.second.ts, data, &record.second) != OK) {
+            LOG(WARNING) << "Failed to compact segment " << segment->id;
+            return;
+        }
+    }
+
+    bool empty;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        empty = segment->live_bytes == 0;
+    }
+    if (empty) {
+        RemoveSegment(segment->id);
+    }
+}
+
+void SegmentStore::RemoveSegment(uint64_t segment_id) {
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        segments_.erase(segment_id);
+    }
+    auto path = BuildSegmentPath(segment_id);
+    if (unlink(path.c_str())) {
+        PLOG(WARNING) << "Failed to remove segment: " << path;
+    }
+}
+
+size_t SegmentStore::GetKeyCount() {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return index_.size();
+}
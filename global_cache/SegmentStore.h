@@ -0,0 +1,122 @@
+#ifndef MADFS_SEGMENT_STORE_H
+#define MADFS_SEGMENT_STORE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <butil/iobuf.h>
+
+#include "Common.h"
+#include "FdCache.h"
+#include "GroupCommit.h"
+
+DECLARE_uint64(write_segment_size);
+DECLARE_double(write_segment_compact_ratio);
+
+// Append-only store of write cache chunks. Chunks are appended as records
+// to large preallocated segment files and made durable by group commit;
+// an in-memory index maps each internal key to its record. Deleting a key
+// only drops it from the index, a segment is removed once none of its
+// records are live, and sealed segments that are mostly dead are compacted
+// by copying the live records to the active segment.
+//
+// Nothing is written for deletes: after a restart, the index is rebuilt
+// from the segments and deleted keys may reappear, to be deleted again by
+// the next garbage collection with the same criteria.
+//
+// record layout: [RecordHeader][key][data], padded to 8 bytes
+class SegmentStore {
+public:
+    explicit SegmentStore(const std::string &dir);
+
+    ~SegmentStore() {}
+
+    // rebuild the index from the segments on disk
+    int Open();
+
+    // ts orders the keys for garbage collection
+    int Append(const std::string &key, uint64_t ts, const butil::IOBuf &data);
+
+    int Read(const std::string &key, uint64_t start, uint64_t length, butil::IOBuf &output);
+
+    // drop the keys under key_prefix matched by the filter from the
+    // index, then reclaim and compact segments
+    int Delete(const std::string &key_prefix,
+               const std::function<bool(const std::string &key, uint64_t ts)> &filter);
+
+    // largest ts found by Open(), 0 if the store was empty
+    uint64_t GetMaxTS() const {
+        return max_ts_;
+    }
+
+    size_t GetKeyCount();
+
+private:
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t key_len;
+        uint64_t data_len;
+        uint64_t ts;
+        uint32_t crc;       // crc32c of key and data
+        uint32_t reserved;
+    };
+
+    struct Location {
+        uint64_t segment_id;
+        uint64_t offset;        // of the data
+        uint64_t length;
+        uint64_t ts;
+    };
+
+    struct Segment {
+        uint64_t id;
+        OpenFilePtr file;
+        uint64_t capacity;
+        uint64_t used = 0;          // bytes appended
+        uint64_t live_bytes = 0;    // bytes of the records in the index
+        uint32_t writers = 0;       // appends between reservation and indexing
+        bool sealed = false;
+    };
+
+    static const uint32_t kRecordMagic = 0x4d534547;  // "MSEG"
+
+    std::string BuildSegmentPath(uint64_t segment_id);
+
+    int RecoverSegment(uint64_t segment_id);
+
+    // reserve room for a record in the active segment, rolling to a new
+    // segment when it is full. Called with mutex_ held
+    std::shared_ptr<Segment> Reserve(uint64_t record_len, uint64_t &offset);
+
+    std::shared_ptr<Segment> CreateSegment(uint64_t capacity);
+
+    // with expected set, index the record only if the key still points
+    // at the expected location (compaction)
+    int AppendRecord(const std::string &key, uint64_t ts, const butil::IOBuf &data,
+                     const Location *expected);
+
+    int WriteRecord(const std::shared_ptr<Segment> &segment, uint64_t offset,
+                    const std::string &key, uint64_t ts, const butil::IOBuf &data);
+
+    void Compact(const std::shared_ptr<Segment> &segment);
+
+    void RemoveSegment(uint64_t segment_id);
+
+private:
+    const std::string dir_;
+    uint64_t max_ts_ = 0;
+    GroupCommitter committer_;
+
+    std::shared_mutex mutex_;       // protects everything below
+    std::map<std::string, Location> index_;     // ordered for prefix deletes
+    std::map<uint64_t, std::shared_ptr<Segment>> segments_;
+    std::shared_ptr<Segment> active_;
+    uint64_t next_segment_id_ = 0;
+};
+
+#endif // MADFS_SEGMENT_STORE_H
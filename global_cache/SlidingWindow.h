@@ -0,0 +1,92 @@
+#ifndef MADFS_SLIDING_WINDOW_H
+#define MADFS_SLIDING_WINDOW_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <folly/futures/Future.h>
+
+#include "Common.h"
+
+// Issue a sequence of requests keeping about window_size bytes in flight.
+// The next request goes out as soon as an earlier one completes, so large
+// reads keep the network busy without ever blocking the calling thread.
+// The result is the first error, reported after every issued request has
+// completed because they all write into the caller's buffer.
+class SlidingWindow {
+public:
+    using IssueFunc = std::function<folly::Future<int>(size_t index)>;
+
+    static folly::Future<int> Run(std::vector<size_t> sizes, size_t window_size, IssueFunc issue) {
+        auto window = std::shared_ptr<SlidingWindow>(new SlidingWindow(std::move(sizes), window_size, std::move(issue)));
+        auto future = window->promise_.getFuture();
+        window->Pump(window);
+        return future;
+    }
+
+private:
+    SlidingWindow(std::vector<size_t> sizes, size_t window_size, IssueFunc issue)
+            : sizes_(std::move(sizes)), window_size_(window_size), issue_(std::move(issue)) {}
+
+    void Pump(std::shared_ptr<SlidingWindow> self) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // requests completing inline re-enter here, let the running pump
+        // loop pick up their slots instead of recursing
+        if (pumping_) {
+            repump_ = true;
+            return;
+        }
+        pumping_ = true;
+        do {
+            repump_ = false;
+            while (status_ == OK && next_ < sizes_.size()
+                   && (inflight_size_ == 0 || inflight_size_ + sizes_[next_] <= window_size_)) {
+                const size_t index = next_++;
+                inflight_size_ += sizes_[index];
+                issued_++;
+                lock.unlock();
+                issue_(index).then([self, index](folly::Try<int> &&output) {
+                    self->OnComplete(self, index, output.value_or(FOLLY_ERROR));
+                });
+                lock.lock();
+            }
+        } while (repump_);
+        pumping_ = false;
+
+        if (completed_ == issued_ && (status_ != OK || next_ == sizes_.size()) && !finished_) {
+            finished_ = true;
+            lock.unlock();
+            promise_.setValue(status_);
+        }
+    }
+
+    void OnComplete(std::shared_ptr<SlidingWindow> self, size_t index, int status) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            inflight_size_ -= sizes_[index];
+            completed_++;
+            if (status != OK && status_ == OK) {
+                status_ = status;
+            }
+        }
+        Pump(self);
+    }
+
+private:
+    const std::vector<size_t> sizes_;
+    const size_t window_size_;
+    IssueFunc issue_;
+    folly::Promise<int> promise_;
+
+    std::mutex mutex_;
+    size_t next_ = 0;
+    size_t issued_ = 0;
+    size_t completed_ = 0;
+    size_t inflight_size_ = 0;
+    int status_ = OK;
+    bool pumping_ = false;
+    bool repump_ = false;
+    bool finished_ = false;
+};
+
+#endif // MADFS_SLIDING_WINDOW_H
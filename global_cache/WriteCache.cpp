@@ -2,9 +2,13 @@
 
 #include "WriteCache.h"
 #include "FileSystemDataAdaptor.h"
+#include "SegmentStore.h"
 #include <dirent.h>
 #include "write_cache.h"
 
+DEFINE_bool(write_cache_sync, true, "Make write cache puts of the disk engine durable before replying");
+DEFINE_uint64(write_cache_commit_window_us, 200, "Time a write cache flush waits for more puts to join it");
+DEFINE_uint64(write_cache_commit_bytes, 16 * 1024 * 1024, "Pending put bytes that flush the write cache without waiting");
 
 //#define BRPC_WITH_RDMA 1
 //#include <brpc/rdma/block_pool.h>
@@ -94,8 +98,9 @@ static uint64_t ParseTS(const std::string &key) {
     if (pos != std::string::npos) {
         std::string lastSubStr = key.substr(pos + 1);
         uint64_t number;
-        std::istringstream(lastSubStr) >> number;
-        if (!std::cin.fail()) {
+        std::istringstream stream(lastSubStr);
+        stream >> number;
+        if (!stream.fail()) {
             return number;
         } else {
             return UINT64_MAX;
@@ -147,13 +152,37 @@ public:
 
     virtual int Delete(const std::string &key_prefix, uint64_t ts, const std::unordered_set<std::string> &except_keys);
 
+private:
+    void LoadIndex();
+
 private:
     std::shared_ptr<DataAdaptor> cache_fs_adaptor_;
+    std::shared_ptr<GroupCommitter> committer_;
+
+    // internal key -> ts of every entry on disk, ordered so that GC scans
+    // only the keys of a prefix instead of walking the directory tree
+    std::mutex index_mutex_;
+    std::map<std::string, uint64_t> index_;
 };
 
 WriteCache4Disk::WriteCache4Disk(std::shared_ptr<folly::CPUThreadPoolExecutor> executor) 
         : WriteCacheImpl(executor) {
+    // no fsync per put, puts are flushed together by the committer
     cache_fs_adaptor_ = std::make_shared<FileSystemDataAdaptor>(GetGlobalConfig().write_cache_dir, nullptr, false, nullptr, false);
+    if (FLAGS_write_cache_sync) {
+        auto &dir = GetGlobalConfig().write_cache_dir;
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(dir, ec);
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) {
+            PLOG(FATAL) << "Failed to open write cache directory: " << dir;
+        }
+        // every put creates a file, syncfs persists its directory entry too
+        committer_ = std::make_shared<GroupCommitter>(FLAGS_write_cache_commit_window_us,
+                                                      FLAGS_write_cache_commit_bytes,
+                                                      std::make_shared<OpenFile>(fd));
+    }
+    LoadIndex();
 }
 
 WriteCache4Disk::~WriteCache4Disk() {}
@@ -230,24 +259,29 @@ PutOutput WriteCache4Disk::Put(const std::string &key, uint64_t length, const bu
 
     int res = cache_fs_adaptor_->UpLoad(internal_key, length, wrap, headers).get();
     // free(aux_buffer);
+    if (res == OK && committer_) {
+        res = committer_->Commit(nullptr, length);
+    }
     if (res) {
         LOG(WARNING) << "Failed to put key " << internal_key << " to disk";
         return {IO_ERROR, "<undefined>"};
     }
+    {
+        std::lock_guard<std::mutex> lock(index_mutex_);
+        index_[internal_key] = oid;
+    }
     t.stop();
     LOG_IF(INFO, FLAGS_verbose) << "PutWriteCache key: " << key << ", internal_key: " << internal_key << ", size: " << length << ", duration: " << t.u_elapsed();
     return {OK, internal_key};
 }
 
 
-void listFilesRecursively(const std::string &directoryPath,
-                          std::vector<std::string> &to_remove, 
-                          const std::string &key_prefix, 
-                          uint64_t ts, 
-                          const std::unordered_set<std::string> &except_keys) {
+static void ListKeysRecursively(const std::string &directoryPath,
+                                const std::string &rootPath,
+                                std::vector<std::string> &keys) {
     DIR* dir = opendir(directoryPath.c_str());
     if (dir == nullptr) {
-        std::cerr << "Error opening directory: " << directoryPath << std::endl;
+        PLOG(ERROR) << "Error opening directory: " << directoryPath;
         return;
     }
 
@@ -259,47 +293,152 @@ void listFilesRecursively(const std::string &directoryPath,
         }
 
         std::string fullPath = PathJoin(directoryPath, entry->d_name);
-        std::string rootPath = GetGlobalConfig().write_cache_dir;
         struct stat statbuf;
         if (stat(fullPath.c_str(), &statbuf) == 0) {
             if (S_ISDIR(statbuf.st_mode)) {
                 // It's a directory, recurse into it
-                listFilesRecursively(fullPath, to_remove, key_prefix, ts, except_keys);
+                ListKeysRecursively(fullPath, rootPath, keys);
             } else if (S_ISREG(statbuf.st_mode)) {
                 std::string key = fullPath.substr(rootPath.length());
                 if (!key.empty() && key[0] == '/') {
                     key = key.substr(1);
                 }
-                if (!HasPrefix(key, key_prefix) || except_keys.count(key) || ParseTS(key) >= ts) {
-                    continue;
-                }
-                to_remove.push_back(fullPath);
-                // LOG(INFO) << "Deleted key " << key << ", location " << fullPath;
+                keys.push_back(key);
             }
         }
     }
     closedir(dir);
 }
 
+// the only directory walk: entries left by the previous run
+void WriteCache4Disk::LoadIndex() {
+    butil::Timer t;
+    t.start();
+    std::vector<std::string> keys;
+    ListKeysRecursively(GetGlobalConfig().write_cache_dir, GetGlobalConfig().write_cache_dir, keys);
+    uint64_t max_ts = 0;
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    for (auto &key : keys) {
+        auto ts = ParseTS(key);
+        index_[key] = ts;
+        if (ts != UINT64_MAX) {
+            max_ts = std::max(max_ts, ts + 1);
+        }
+    }
+    // do not hand out object ids of the recovered entries again
+    next_object_id_ = max_ts;
+    t.stop();
+    LOG(INFO) << "Loaded " << index_.size() << " write cache entries from "
+              << GetGlobalConfig().write_cache_dir << ", duration: " << t.u_elapsed();
+}
+
 
 // Delete all entries that: match the prefix, < ts, and not in except_keys
 int WriteCache4Disk::Delete(const std::string &key_prefix, uint64_t ts, const std::unordered_set<std::string> &except_keys) {
     LOG(INFO) << "Request key_prefix = " << key_prefix << ", ts = " << ts;
-    std::vector<std::string> to_remove;
-    listFilesRecursively(GetGlobalConfig().write_cache_dir, 
-                         to_remove, 
-                         key_prefix, 
-                         ts, 
-                         except_keys);
-    for (auto &entry : to_remove) {
-        if (remove(entry.c_str())) {
-            LOG(WARNING) << "Failed to remove file: " << entry;
+    std::vector<std::pair<std::string, uint64_t>> to_remove;
+    {
+        std::lock_guard<std::mutex> lock(index_mutex_);
+        auto iter = index_.lower_bound(key_prefix);
+        while (iter != index_.end() && HasPrefix(iter->first, key_prefix)) {
+            if (iter->second >= ts || except_keys.count(iter->first)) {
+                ++iter;
+                continue;
+            }
+            to_remove.emplace_back(iter->first, iter->second);
+            iter = index_.erase(iter);
+        }
+    }
+    // through the adaptor, which also drops its open file of the key
+    for (size_t i = 0; i < to_remove.size(); ++i) {
+        int res = cache_fs_adaptor_->Delete(to_remove[i].first).get();
+        if (res != OK && res != NOT_FOUND) {
+            LOG(WARNING) << "Failed to remove key: " << to_remove[i].first;
+            // keep the rest for the next GC
+            std::lock_guard<std::mutex> lock(index_mutex_);
+            for (; i < to_remove.size(); ++i) {
+                index_.insert(to_remove[i]);
+            }
             return IO_ERROR;
         }
     }
+    LOG(INFO) << "Deleted " << to_remove.size() << " write cache entries";
     return OK;
 }
 
+// ----------------------------------------------------------------------------
+
+class WriteCache4Segment : public WriteCacheImpl {
+public:
+    explicit WriteCache4Segment(std::shared_ptr<folly::CPUThreadPoolExecutor> executor);
+
+    ~WriteCache4Segment() {}
+
+    virtual GetOutput Get(const std::string &internal_key, uint64_t start, uint64_t length);
+
+    virtual PutOutput Put(const std::string &key, uint64_t length, const butil::IOBuf &buf);
+
+    virtual int Delete(const std::string &key_prefix, uint64_t ts, const std::unordered_set<std::string> &except_keys);
+
+private:
+    std::shared_ptr<SegmentStore> store_;
+};
+
+WriteCache4Segment::WriteCache4Segment(std::shared_ptr<folly::CPUThreadPoolExecutor> executor)
+        : WriteCacheImpl(executor) {
+    store_ = std::make_shared<SegmentStore>(PathJoin(GetGlobalConfig().write_cache_dir, "segments"));
+    if (store_->Open()) {
+        LOG(FATAL) << "Failed to open segment store in " << GetGlobalConfig().write_cache_dir;
+    }
+    // object ids of recovered keys must not be handed out again
+    if (store_->GetKeyCount()) {
+        next_object_id_ = store_->GetMaxTS() + 1;
+    }
+}
+
+GetOutput WriteCache4Segment::Get(const std::string &internal_key, uint64_t start, uint64_t length) {
+    butil::Timer t;
+    t.start();
+    GetOutput output;
+    output.status = store_->Read(internal_key, start, length, output.buf);
+    t.stop();
+    LOG_IF(INFO, FLAGS_verbose) << "Get key: " << internal_key 
+                                << ", start: " << start
+                                << ", length: " << length 
+                                << ", status: " << output.status
+                                << ", latency: " << t.u_elapsed();
+    return output;
+}
+
+PutOutput WriteCache4Segment::Put(const std::string &key, uint64_t length, const butil::IOBuf &buf) {
+    butil::Timer t;
+    t.start();
+    auto oid = next_object_id_.fetch_add(1);
+    auto internal_key = key + "-" + std::to_string(oid);
+
+    if (ReportAvailableDiskSpace(GetGlobalConfig().write_cache_dir) < std::max(length, kMinDiskFreeSpace)) {
+        return {NO_ENOUGH_DISKSPACE, "<undefined>"};
+    }
+
+    int res = store_->Append(internal_key, oid, buf);
+    if (res) {
+        LOG(WARNING) << "Failed to put key " << internal_key << " to segment store";
+        return {res == NO_ENOUGH_DISKSPACE ? NO_ENOUGH_DISKSPACE : IO_ERROR, "<undefined>"};
+    }
+    t.stop();
+    LOG_IF(INFO, FLAGS_verbose) << "PutWriteCache key: " << key << ", internal_key: " << internal_key << ", size: " << length << ", duration: " << t.u_elapsed();
+    return {OK, internal_key};
+}
+
+// Delete all entries that: match the prefix, < ts, and not in except_keys
+int WriteCache4Segment::Delete(const std::string &key_prefix, uint64_t ts, const std::unordered_set<std::string> &except_keys) {
+    LOG(INFO) << "Request key_prefix = " << key_prefix << ", ts = " << ts;
+    // the object id is the ts of the record, no need to parse the key
+    return store_->Delete(key_prefix, [&](const std::string &key, uint64_t key_ts) -> bool {
+        return key_ts < ts && !except_keys.count(key);
+    });
+}
+
 
 class WriteCache4Fake : public WriteCacheImpl {
 public:
@@ -388,13 +527,15 @@ private:
 };
 
 
-DEFINE_string(write_cache_engine, "disk", "Write cache engine: rocksdb | disk");
+DEFINE_string(write_cache_engine, "disk", "Write cache engine: rocksdb | disk | segment");
 
 WriteCache::WriteCache(std::shared_ptr<folly::CPUThreadPoolExecutor> executor) {
     if (FLAGS_write_cache_engine == "rocksdb")
         impl_ = new WriteCache4RocksDB(executor);
     else if (FLAGS_write_cache_engine == "disk")
         impl_ = new WriteCache4Disk(executor);
+    else if (FLAGS_write_cache_engine == "segment")
+        impl_ = new WriteCache4Segment(executor);
     else if (FLAGS_write_cache_engine == "fake")
         impl_ = new WriteCache4Fake(executor);
     else {
@@ -8,6 +8,7 @@
 
 #include "common.h"
 #include "config.h"
+#include "page_cache.h"
 
 namespace HybridCache {
 
@@ -38,6 +39,9 @@ bool GetHybridCacheConfig(const std::string& file, HybridCacheConfig& cfg) {
                              cfg.ReadCacheCfg.CacheCfg.EnableCAS);
     conf.GetValueFatalIfFail("ReadCacheConfig.CacheConfig.SafeMode",
                              cfg.ReadCacheCfg.CacheCfg.SafeMode);
+    // optional, older configs have no compression
+    conf.GetValue("ReadCacheConfig.CacheConfig.CompressType",
+                  cfg.ReadCacheCfg.CacheCfg.CompressType);
     conf.GetValueFatalIfFail("ReadCacheConfig.CacheConfig.CacheLibConfig.EnableNvmCache",
                              cfg.ReadCacheCfg.CacheCfg.CacheLibCfg.EnableNvmCache);
     if (cfg.ReadCacheCfg.CacheCfg.CacheLibCfg.EnableNvmCache) {
@@ -118,6 +122,23 @@ bool CheckConfig(const HybridCacheConfig& cfg) {
         return false;
     }
 
+    if (cfg.ReadCacheCfg.CacheCfg.PageMetaSize < PAGE_META_MIN_SIZE ||
+            cfg.WriteCacheCfg.CacheCfg.PageMetaSize < PAGE_META_MIN_SIZE) {
+        LOG(FATAL) << "Config error. Page meta size must be at least " << PAGE_META_MIN_SIZE;
+        return false;
+    }
+
+    if (cfg.ReadCacheCfg.CacheCfg.CompressType >= COMPRESS_TYPE_NUM) {
+        LOG(FATAL) << "Config error. Unknown read cache compress type "
+                   << cfg.ReadCacheCfg.CacheCfg.CompressType;
+        return false;
+    }
+
+    if (cfg.WriteCacheCfg.CacheCfg.CompressType != COMPRESS_NONE) {
+        LOG(FATAL) << "Config error. Write Cache not support compression!";
+        return false;
+    }
+
     return true;
 }
 
@@ -194,4 +215,14 @@ void Configuration::GetValueFatalIfFail(const std::string& key, T& value) {
     LOG(FATAL) << "Get " << key << " from " << confFile_ << " fail";
 }
 
+template <class T>
+bool Configuration::GetValue(const std::string& key, T& value) {
+    auto iter = config_.find(key);
+    if (iter == config_.end())
+        return false;
+    std::stringstream sstream(iter->second);
+    sstream >> value;
+    return true;
+}
+
 }  // namespace HybridCache
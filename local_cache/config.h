@@ -11,6 +11,14 @@
 
 namespace HybridCache {
 
+// page body compression codec
+enum PageCompressType {
+    COMPRESS_NONE = 0,
+    COMPRESS_LZ4 = 1,
+    COMPRESS_ZSTD = 2,
+    COMPRESS_TYPE_NUM
+};
+
 struct CacheLibConfig {
     bool            EnableNvmCache  = false;
     std::string     RaidPath;
@@ -26,6 +34,7 @@ struct CacheConfig {
     uint32_t        PageMetaSize;
     bool            EnableCAS;
     bool            SafeMode;  // atomic write/delete lock
+    uint32_t        CompressType = COMPRESS_NONE;  // read cache only
     CacheLibConfig  CacheLibCfg;
 };
 
@@ -88,6 +97,17 @@ class Configuration {
     template <class T>
     void GetValueFatalIfFail(const std::string& key, T& value);
 
+    /*
+    * @brief GetValue Get the value of an optional config item
+    *
+    * @param[in] key config name
+    * @param[out] value config value, left unchanged if the item is absent
+    *
+    * @return true if the item is present
+    */
+    template <class T>
+    bool GetValue(const std::string& key, T& value);
+
  private:
     std::string confFile_;
     std::map<std::string, std::string>  config_;
@@ -14,6 +14,7 @@ enum ErrCode {
     PAGE_DEL_FAIL           = -2,
     ADAPTOR_NOT_FOUND       = -3,
     REMOTE_FILE_NOT_FOUND   = -4,
+    PAGE_WRITE_FAIL         = -5,
 };
 
 }  // namespace HybridCache
@@ -1,3 +1,5 @@
+#include <thread>
+
 #include "glog/logging.h"
 
 #include "common.h"
@@ -6,42 +8,52 @@
 
 namespace HybridCache {
 
+static inline uint64_t* GetSeqPtr(const char* pageMemory) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(pageMemory + int(MetaPos::SEQ));
+    addr = (addr + sizeof(uint64_t) - 1) & ~(uintptr_t)(sizeof(uint64_t) - 1);
+    return reinterpret_cast<uint64_t*>(addr);
+}
+
 bool PageCache::Lock(char* pageMemory) {
-   if (!cfg_.EnableCAS) return true;
-   uint8_t* lock = reinterpret_cast<uint8_t*>(pageMemory + int(MetaPos::LOCK));
-   uint8_t lockExpected = 0;
-   return __atomic_compare_exchange_n(lock, &lockExpected, 1, true,
-          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    if (!cfg_.EnableCAS) return true;
+    uint64_t* seq = GetSeqPtr(pageMemory);
+    uint64_t seqExpected = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    if (seqExpected & 1) return false;
+    return __atomic_compare_exchange_n(seq, &seqExpected, seqExpected + 1,
+           false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
 }
 
 void PageCache::UnLock(char* pageMemory) {
-   if (!cfg_.EnableCAS) return;
-   uint8_t* lock = reinterpret_cast<uint8_t*>(pageMemory + int(MetaPos::LOCK));
-   __atomic_store_n(lock, 0, __ATOMIC_SEQ_CST);
+    if (!cfg_.EnableCAS) return;
+    __atomic_add_fetch(GetSeqPtr(pageMemory), 1, __ATOMIC_RELEASE);
 }
 
-uint8_t PageCache::AddNewVer(char* pageMemory) {
+uint64_t PageCache::ReadBegin(const char* pageMemory) {
     if (!cfg_.EnableCAS) return 0;
-    uint8_t* newVer = reinterpret_cast<uint8_t*>(pageMemory + int(MetaPos::NEWVER));
-    return __atomic_add_fetch(newVer, 1, __ATOMIC_SEQ_CST);
-}
-
-void PageCache::SetLastVer(char* pageMemory, uint8_t newVer) {
-   if (!cfg_.EnableCAS) return;
-   uint8_t* lastVer = reinterpret_cast<uint8_t*>(pageMemory + int(MetaPos::LASTVER));
-   __atomic_store_n(lastVer, newVer, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(GetSeqPtr(pageMemory), __ATOMIC_ACQUIRE);
 }
 
-uint8_t PageCache::GetLastVer(const char* pageMemory) {
-    if (!cfg_.EnableCAS) return 0;
-    const uint8_t* lastVer = reinterpret_cast<const uint8_t*>(pageMemory + int(MetaPos::LASTVER));
-    return __atomic_load_n(lastVer, __ATOMIC_SEQ_CST);
+bool PageCache::ReadValidate(const char* pageMemory, uint64_t seq) {
+    if (!cfg_.EnableCAS) return true;
+    if (seq & 1) return false;
+    // order the data copy before the sequence reload
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(GetSeqPtr(pageMemory), __ATOMIC_RELAXED) == seq;
 }
 
-uint8_t PageCache::GetNewVer(const char* pageMemory) {
-    if (!cfg_.EnableCAS) return 0;
-    const uint8_t* newVer = reinterpret_cast<const uint8_t*>(pageMemory + int(MetaPos::NEWVER));
-    return __atomic_load_n(newVer, __ATOMIC_SEQ_CST);
+void PageCache::Backoff(uint32_t& spins) {
+    if (spins < BACKOFF_SPIN_LIMIT) {
+        for (uint32_t i = 0; i < (1u << spins); ++i) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+        }
+        ++spins;
+    } else {
+        std::this_thread::yield();
+    }
 }
 
 void PageCache::SetFastBitmap(char* pageMemory, bool valid) {
@@ -143,23 +155,61 @@ int PageCacheImpl::Write(const std::string &key,
     assert(cfg_.PageBodySize >= pagePos + length);
     assert(cache_);
 
+    if (IsCompressed())
+        return WriteCompressed(key, pagePos, length, buf);
+
     Cache::WriteHandle writeHandle = nullptr;
     char* pageValue = nullptr;
+    uint32_t spins = 0;
     while (true) {
         writeHandle = std::move(FindOrCreateWriteHandle(key));
+        if (!writeHandle) return PAGE_WRITE_FAIL;
         pageValue = reinterpret_cast<char*>(writeHandle->getMemory());
         if (Lock(pageValue)) break;
+        // re-find after backoff, the page may be removed by the holder
+        Backoff(spins);
     }
 
+    // another handle may be a pin of ReadPinned, whose bytes must never
+    // change: write a copy instead. Both the lock and the handle refcount
+    // are atomic RMWs, so a pin taken after this check sees the lock held
+    if (cfg_.EnableCAS && writeHandle->getRefCount() > 1)
+        return WriteCopy(key, pageValue, pagePos, length, buf);
+
     uint64_t realOffset = cfg_.PageMetaSize + bitmapSize_ + pagePos;
-    uint8_t newVer = AddNewVer(pageValue);
     std::memcpy(pageValue + realOffset, buf, length);
     SetBitMap(pageValue, pagePos, length, true);
-    SetLastVer(pageValue, newVer);
     UnLock(pageValue);
     return SUCCESS;
 }
 
+int PageCacheImpl::WriteCopy(const std::string &key,
+                             char* oldValue,
+                             uint32_t pagePos,
+                             uint32_t length,
+                             const char *buf) {
+    auto writeHandle = AllocateItem(key, GetRealPageSize());
+    if (!writeHandle) {
+        UnLock(oldValue);
+        return PAGE_WRITE_FAIL;
+    }
+    char* pageValue = reinterpret_cast<char*>(writeHandle->getMemory());
+    std::memcpy(pageValue, oldValue, GetRealPageSize());
+    // the copied sequence belongs to the old item
+    memset(pageValue + int(MetaPos::SEQ), 0, int(MetaPos::FAST_BITMAP));
+    uint64_t realOffset = cfg_.PageMetaSize + bitmapSize_ + pagePos;
+    std::memcpy(pageValue + realOffset, buf, length);
+    SetBitMap(pageValue, pagePos, length, true);
+
+    if (!cache_->insertOrReplace(writeHandle)) {  // deleted meanwhile
+        pageNum_.fetch_add(1);
+        pagesList_.insert(key);
+    }
+    // the old item stays locked, like a page removed by DeletePart, so
+    // writers and readers waiting on it find the copy instead
+    return SUCCESS;
+}
+
 int PageCacheImpl::Read(const std::string &key,
                         uint32_t pagePos,
                         uint32_t length,
@@ -169,77 +219,234 @@ int PageCacheImpl::Read(const std::string &key,
     assert(cache_);
 
     int res = SUCCESS;
+    uint32_t spins = 0;
     while (true) {
         auto readHandle = cache_->find(key);
         if (!readHandle) {
             res = PAGE_NOT_FOUND;
             break;
         }
-        while (!readHandle.isReady());
+        readHandle.wait();
 
         const char* pageValue = reinterpret_cast<const char*>(
                 readHandle->getMemory());
-        uint8_t lastVer = GetLastVer(pageValue);
-        uint8_t newVer = GetNewVer(pageValue);
-        if (lastVer != newVer) continue;
+        uint64_t seq = ReadBegin(pageValue);
+        if (seq & 1) {
+            Backoff(spins);
+            continue;
+        }
 
-        dataBoundary.clear();
-        uint32_t cur = pagePos;
-        if (GetFastBitmap(pageValue)) {
-            uint32_t pageOff = cfg_.PageMetaSize + bitmapSize_ + pagePos;
-            std::memcpy(buf, pageValue + pageOff, length);
-            dataBoundary.push_back(std::make_pair(0, length));
-            cur += length;
+        const char* pageView = GetPageView(pageValue);
+        if (pageView)
+            CopyValidData(pageView, pagePos, length, buf, dataBoundary);
+
+        if (ReadValidate(pageValue, seq)) {
+            if (!pageView) {
+                dataBoundary.clear();
+                res = PAGE_NOT_FOUND;
+            }
+            break;
         }
+        Backoff(spins);
+    }
+    return res;
+}
 
-        bool continuousDataValid = false;  // continuous Data valid or invalid
-        uint32_t continuousLen = 0;
-        while (cur < pagePos+length) {
-            const char *byte = pageValue + cfg_.PageMetaSize + cur / BYTE_LEN;
+int PageCacheImpl::ReadPages(std::vector<PageRequest>& pages) {
+    return ReadPagesAsync(pages).get();
+}
 
-            // fast to judge full byte of bitmap
-            uint16_t batLen = 0;
-            bool batByteValid = false, isBatFuncValid = false;
+folly::SemiFuture<int> PageCacheImpl::ReadPagesAsync(
+        std::vector<PageRequest>& pages) {
+    assert(cache_);
 
-            batLen = 64;
-            if (cur % batLen == 0 && (pagePos+length-cur) >= batLen) {
-                uint64_t byteValue = *reinterpret_cast<const uint64_t*>(byte);
-                if (byteValue == UINT64_MAX) {
-                    batByteValid = true;
-                    isBatFuncValid = true;
-                } else if (byteValue == 0)  {
-                    isBatFuncValid = true;
-                }
-            }
+    // issue all lookups without waiting on any of them,
+    // so the hash bucket walks and NVM fetches of the batch overlap
+    std::vector<folly::SemiFuture<folly::Unit>> pending;
+    for (auto& page : pages) {
+        assert(cfg_.PageBodySize >= page.pagePos + page.length);
+        page.dataBoundary.clear();
+        auto readHandle = cache_->find(page.key);
+        // test the handle only once it is ready, its bool conversion
+        // waits for the NVM lookup; CopyPage takes care of the misses
+        if (readHandle.isReady()) {
+            CopyPage(page, readHandle);
+            continue;
+        }
+        // item is being fetched from NVM, copy it once it is in DRAM
+        pending.emplace_back(std::move(readHandle).toSemiFuture()
+                .deferValue([this, &page](Cache::ReadHandle handle) {
+            CopyPage(page, handle);
+        }));
+    }
 
-            if (isBatFuncValid && (continuousLen == 0 ||
-                                continuousDataValid == batByteValid)) {
-                continuousDataValid = batByteValid;
-                continuousLen += batLen;
-                cur += batLen;
-                continue;
+    auto collectRes = [&pages]() {
+        int res = SUCCESS;
+        for (auto& page : pages) {
+            if (SUCCESS != page.res && PAGE_NOT_FOUND != page.res) {
+                res = page.res;
+                break;
             }
+        }
+        return res;
+    };
+    if (pending.empty())
+        return folly::makeSemiFuture(collectRes());
+    return folly::collectAll(std::move(pending)).deferValue(
+            [collectRes](std::vector<folly::Try<folly::Unit>>&&) {
+        return collectRes();
+    });
+}
 
-            bool curByteValid = GetBit(byte, cur % BYTE_LEN);
-            if (continuousLen == 0 || continuousDataValid == curByteValid) {
-                continuousDataValid = curByteValid;
-                ++continuousLen;
-                ++cur;
-                continue;
-            }
+void PageCacheImpl::CopyPage(PageRequest& page,
+                             const Cache::ReadHandle& readHandle) {
+    if (!readHandle) {  // NVM lookup missed
+        page.res = PAGE_NOT_FOUND;
+        return;
+    }
+    const char* pageValue = reinterpret_cast<const char*>(
+            readHandle->getMemory());
+    uint64_t seq = ReadBegin(pageValue);
+    if (!(seq & 1)) {
+        const char* pageView = GetPageView(pageValue);
+        if (pageView)
+            CopyValidData(pageView, page.pagePos, page.length, page.buf,
+                          page.dataBoundary);
+        if (pageView && ReadValidate(pageValue, seq)) {
+            page.res = SUCCESS;
+            return;
+        }
+    }
+    // the page is being written, fall back to the retrying path
+    page.res = Read(page.key, page.pagePos, page.length, page.buf,
+                    page.dataBoundary);
+}
 
-            if (continuousDataValid) {
-                uint32_t bufOff = cur - continuousLen - pagePos;
-                uint32_t pageOff = cfg_.PageMetaSize + bitmapSize_ +
-                                   cur - continuousLen;
-                std::memcpy(buf + bufOff, pageValue + pageOff, continuousLen);
-                dataBoundary.push_back(std::make_pair(bufOff, continuousLen));
+int PageCacheImpl::ReadPinned(const std::string &key,
+                              uint32_t pagePos,
+                              uint32_t length,
+                              PinnedData& pinned) {
+    assert(cfg_.PageBodySize >= pagePos + length);
+    assert(cache_);
+
+    // without CAS a writer can not tell a pinned page, copy it out instead
+    if (IsCompressed() || !cfg_.EnableCAS) return PAGE_NOT_FOUND;
+    Cache::ReadHandle readHandle = nullptr;
+    const char* pageValue = nullptr;
+    uint32_t spins = 0;
+    while (true) {
+        // re-find on every round, a locked page may be retired by WriteCopy
+        readHandle = cache_->find(key);
+        if (!readHandle) return PAGE_NOT_FOUND;
+        readHandle.wait();
+        if (!readHandle) return PAGE_NOT_FOUND;  // NVM lookup missed
+
+        pageValue = reinterpret_cast<const char*>(readHandle->getMemory());
+        uint64_t seq = ReadBegin(pageValue);
+        if (seq & 1) {
+            Backoff(spins);
+            continue;
+        }
+        bool valid = IsRangeValid(pageValue, pagePos, length);
+        if (ReadValidate(pageValue, seq)) {
+            if (!valid) return PAGE_NOT_FOUND;
+            break;
+        }
+        Backoff(spins);
+    }
+
+    // while the handle is held, Write copies the page instead of changing
+    // it, and a deleted item keeps its memory until the handle is released
+    pinned.data = ByteBuffer(const_cast<char*>(pageValue) + cfg_.PageMetaSize +
+                             bitmapSize_ + pagePos, length);
+    pinned.pin = std::make_shared<Cache::ReadHandle>(std::move(readHandle));
+    return SUCCESS;
+}
+
+bool PageCacheImpl::IsRangeValid(const char* pageValue,
+                                 uint32_t pagePos,
+                                 uint32_t length) {
+    if (GetFastBitmap(pageValue)) return true;
+    const char* bitmap = pageValue + cfg_.PageMetaSize;
+    uint32_t cur = pagePos;
+    while (cur < pagePos + length) {
+        // fast to judge full byte of bitmap
+        if (cur % BYTE_LEN == 0 && pagePos + length - cur >= BYTE_LEN) {
+            if (static_cast<uint8_t>(bitmap[cur / BYTE_LEN]) != UINT8_MAX)
+                return false;
+            cur += BYTE_LEN;
+            continue;
+        }
+        if (!GetBit(bitmap + cur / BYTE_LEN, cur % BYTE_LEN)) return false;
+        ++cur;
+    }
+    return true;
+}
+
+int PageCacheImpl::WritePages(std::vector<PageRequest>& pages) {
+    assert(cache_);
+
+    // cachelib has no batched allocate nor bucket prefetch, a batch
+    // only saves the per-call overhead of the callers
+    int res = SUCCESS;
+    for (auto& page : pages) {
+        page.res = Write(page.key, page.pagePos, page.length, page.buf);
+        if (SUCCESS != page.res && SUCCESS == res)
+            res = page.res;
+    }
+    return res;
+}
+
+void PageCacheImpl::CopyValidData(const char* pageValue,
+                                  uint32_t pagePos,
+                                  uint32_t length,
+                                  char *buf,
+                    std::vector<std::pair<size_t, size_t>>& dataBoundary) {
+    dataBoundary.clear();
+    uint32_t cur = pagePos;
+    if (GetFastBitmap(pageValue)) {
+        uint32_t pageOff = cfg_.PageMetaSize + bitmapSize_ + pagePos;
+        std::memcpy(buf, pageValue + pageOff, length);
+        dataBoundary.push_back(std::make_pair(0, length));
+        cur += length;
+    }
+
+    bool continuousDataValid = false;  // continuous Data valid or invalid
+    uint32_t continuousLen = 0;
+    while (cur < pagePos+length) {
+        const char *byte = pageValue + cfg_.PageMetaSize + cur / BYTE_LEN;
+
+        // fast to judge full byte of bitmap
+        uint16_t batLen = 0;
+        bool batByteValid = false, isBatFuncValid = false;
+
+        batLen = 64;
+        if (cur % batLen == 0 && (pagePos+length-cur) >= batLen) {
+            uint64_t byteValue = *reinterpret_cast<const uint64_t*>(byte);
+            if (byteValue == UINT64_MAX) {
+                batByteValid = true;
+                isBatFuncValid = true;
+            } else if (byteValue == 0)  {
+                isBatFuncValid = true;
             }
+        }
 
+        if (isBatFuncValid && (continuousLen == 0 ||
+                            continuousDataValid == batByteValid)) {
+            continuousDataValid = batByteValid;
+            continuousLen += batLen;
+            cur += batLen;
+            continue;
+        }
+
+        bool curByteValid = GetBit(byte, cur % BYTE_LEN);
+        if (continuousLen == 0 || continuousDataValid == curByteValid) {
             continuousDataValid = curByteValid;
-            continuousLen = 1;
+            ++continuousLen;
             ++cur;
+            continue;
         }
+
         if (continuousDataValid) {
             uint32_t bufOff = cur - continuousLen - pagePos;
             uint32_t pageOff = cfg_.PageMetaSize + bitmapSize_ +
@@ -248,31 +455,42 @@ int PageCacheImpl::Read(const std::string &key,
             dataBoundary.push_back(std::make_pair(bufOff, continuousLen));
         }
 
-        newVer = GetNewVer(pageValue);
-        if (lastVer == newVer) break;
+        continuousDataValid = curByteValid;
+        continuousLen = 1;
+        ++cur;
+    }
+    if (continuousDataValid) {
+        uint32_t bufOff = cur - continuousLen - pagePos;
+        uint32_t pageOff = cfg_.PageMetaSize + bitmapSize_ +
+                           cur - continuousLen;
+        std::memcpy(buf + bufOff, pageValue + pageOff, continuousLen);
+        dataBoundary.push_back(std::make_pair(bufOff, continuousLen));
     }
-    return res;
 }
 
 int PageCacheImpl::GetAllCache(const std::string &key,
                     std::vector<std::pair<ByteBuffer, size_t>>& dataSegments) {
     assert(cache_);
+    assert(!IsCompressed());
     uint32_t pageSize = cfg_.PageBodySize;
 
     int res = SUCCESS;
+    uint32_t spins = 0;
     while (true) {
         auto readHandle = cache_->find(key);
         if (!readHandle) {
             res = PAGE_NOT_FOUND;
             break;
         }
-        while (!readHandle.isReady());
+        readHandle.wait();
 
         const char* pageValue = reinterpret_cast<const char*>(
                 readHandle->getMemory());
-        uint8_t lastVer = GetLastVer(pageValue);
-        uint8_t newVer = GetNewVer(pageValue);
-        if (lastVer != newVer) continue;
+        uint64_t seq = ReadBegin(pageValue);
+        if (seq & 1) {
+            Backoff(spins);
+            continue;
+        }
 
         dataSegments.clear();
         uint32_t cur = 0;
@@ -339,8 +557,8 @@ int PageCacheImpl::GetAllCache(const std::string &key,
                 cur - continuousLen));
         }
 
-        newVer = GetNewVer(pageValue);
-        if (lastVer == newVer) break;
+        if (ReadValidate(pageValue, seq)) break;
+        Backoff(spins);
     }
     return res;
 }
@@ -354,6 +572,7 @@ int PageCacheImpl::DeletePart(const std::string &key,
     int res = SUCCESS;
     Cache::WriteHandle writeHandle = nullptr;
     char* pageValue = nullptr;
+    uint32_t spins = 0;
     while (true) {
         writeHandle = cache_->findToWrite(key);
         if (!writeHandle) {
@@ -362,10 +581,10 @@ int PageCacheImpl::DeletePart(const std::string &key,
         }
         pageValue = reinterpret_cast<char*>(writeHandle->getMemory());
         if (Lock(pageValue)) break;
+        Backoff(spins);
     }
 
     if (SUCCESS == res) {
-        uint8_t newVer = AddNewVer(pageValue);
         SetBitMap(pageValue, pagePos, length, false);
 
         bool isEmpty = true;
@@ -380,15 +599,10 @@ int PageCacheImpl::DeletePart(const std::string &key,
 
         bool isDel = false;
         if (isEmpty) {
-            if (cfg_.SafeMode) {  // exclusive lock
-                while(true) {
-                    int64_t expected = 0;
-                    if (lock_.compare_exchange_weak(expected, -1))
-                        break;
-                }
-            }
+            folly::RWSpinLock& stripeLock = GetStripeLock(key);
+            if (cfg_.SafeMode) stripeLock.lock();  // exclusive lock
             auto rr = cache_->remove(writeHandle);
-            if (cfg_.SafeMode) lock_.store(0);  // release exclusive lock
+            if (cfg_.SafeMode) stripeLock.unlock();  // release exclusive lock
             if (rr == Cache::RemoveRes::kSuccess) {
                 pageNum_.fetch_sub(1);
                 pagesList_.erase(key);
@@ -399,7 +613,6 @@ int PageCacheImpl::DeletePart(const std::string &key,
         }
 
         if (!isDel) {
-            SetLastVer(pageValue, newVer);
             UnLock(pageValue);
         }
     }
@@ -408,15 +621,10 @@ int PageCacheImpl::DeletePart(const std::string &key,
 
 int PageCacheImpl::Delete(const std::string &key) {
     assert(cache_);
-    if (cfg_.SafeMode) {  // exclusive lock
-        while(true) {
-            int64_t expected = 0;
-            if (lock_.compare_exchange_weak(expected, -1))
-                break;
-        }
-    }
+    folly::RWSpinLock& stripeLock = GetStripeLock(key);
+    if (cfg_.SafeMode) stripeLock.lock();  // exclusive lock
     int res = cache_->remove(key) == Cache::RemoveRes::kSuccess ? SUCCESS : PAGE_NOT_FOUND;
-    if (cfg_.SafeMode) lock_.store(0);  // release exclusive lock
+    if (cfg_.SafeMode) stripeLock.unlock();  // release exclusive lock
     if (SUCCESS == res) {
         pageNum_.fetch_sub(1);
         pagesList_.erase(key);
@@ -427,18 +635,8 @@ int PageCacheImpl::Delete(const std::string &key) {
 Cache::WriteHandle PageCacheImpl::FindOrCreateWriteHandle(const std::string &key) {
     auto writeHandle = cache_->findToWrite(key);
     if (!writeHandle) {
-        if (cfg_.SafeMode) {  // shared lock
-            while(true) {
-                int64_t lock = lock_.load();
-                if (lock >= 0 && lock_.compare_exchange_weak(lock, lock + 1))
-                    break;
-            }
-        }
-        writeHandle = cache_->allocate(pool_, key, GetRealPageSize());
-        if (cfg_.SafeMode) lock_.fetch_sub(1);  // release shared lock
-
-        assert(writeHandle);
-        assert(writeHandle->getMemory());
+        writeHandle = AllocateItem(key, GetRealPageSize());
+        if (!writeHandle) return writeHandle;
         // need init
         memset(writeHandle->getMemory(), 0, cfg_.PageMetaSize + bitmapSize_);
 
@@ -462,4 +660,167 @@ Cache::WriteHandle PageCacheImpl::FindOrCreateWriteHandle(const std::string &key
     return writeHandle;
 }
 
+Cache::WriteHandle PageCacheImpl::AllocateItem(const std::string &key,
+                                               uint32_t size) {
+    Cache::WriteHandle writeHandle = nullptr;
+    std::string err = "no memory";
+    folly::RWSpinLock& stripeLock = GetStripeLock(key);
+    if (cfg_.SafeMode) stripeLock.lock_shared();  // shared lock
+    try {
+        // throws on a key or size cachelib does not support
+        writeHandle = cache_->allocate(pool_, key, size);
+    } catch (const std::exception& e) {
+        err = e.what();
+    }
+    if (cfg_.SafeMode) stripeLock.unlock_shared();  // release shared lock
+    if (!writeHandle) {
+        LOG(ERROR) << "[PageCache]Allocate page failed, name:" << cfg_.CacheName
+                   << ", key:" << key << ", size:" << size << ", err:" << err;
+    }
+    return writeHandle;
+}
+
+void PageCacheImpl::InitCompress() {
+    if (!IsCompressed()) return;
+    if (cfg_.CompressType >= COMPRESS_TYPE_NUM || !GetCodec()) {
+        LOG(ERROR) << "[PageCache]Compress type " << cfg_.CompressType
+                   << " unavailable, name:" << cfg_.CacheName
+                   << ", store pages uncompressed";
+        cfg_.CompressType = COMPRESS_NONE;
+    }
+}
+
+folly::io::Codec* PageCacheImpl::GetCodec() {
+    static thread_local std::unique_ptr<folly::io::Codec> codecs[COMPRESS_TYPE_NUM];
+    auto& codec = codecs[cfg_.CompressType];
+    if (!codec) {
+        folly::io::CodecType type = COMPRESS_LZ4 == cfg_.CompressType ?
+                folly::io::CodecType::LZ4 : folly::io::CodecType::ZSTD;
+        if (!folly::io::hasCodec(type)) return nullptr;
+        codec = folly::io::getCodec(type);
+    }
+    return codec.get();
+}
+
+bool PageCacheImpl::UnpackPage(const char* pageValue, char* out) {
+    uint32_t headSize = cfg_.PageMetaSize + bitmapSize_;
+    std::memcpy(out, pageValue, headSize);
+    CompressedLenType bodyLen = 0;
+    std::memcpy(&bodyLen, pageValue + headSize, sizeof(bodyLen));
+    const char* body = pageValue + headSize + sizeof(bodyLen);
+    if (bodyLen >= cfg_.PageBodySize) {
+        std::memcpy(out + headSize, body, cfg_.PageBodySize);
+        return true;
+    }
+    try {
+        std::string raw = GetCodec()->uncompress(
+                folly::StringPiece(body, bodyLen),
+                static_cast<uint64_t>(cfg_.PageBodySize));
+        if (raw.size() != cfg_.PageBodySize) return false;
+        std::memcpy(out + headSize, raw.data(), raw.size());
+    } catch (const std::exception& e) {
+        LOG(ERROR) << "[PageCache]Uncompress page failed, name:"
+                   << cfg_.CacheName << ", err:" << e.what();
+        return false;
+    }
+    return true;
+}
+
+const char* PageCacheImpl::GetPageView(const char* pageValue) {
+    if (!IsCompressed()) return pageValue;
+    static thread_local std::vector<char> pageBuf;
+    pageBuf.resize(GetRealPageSize());
+    if (!UnpackPage(pageValue, pageBuf.data())) return nullptr;
+    return pageBuf.data();
+}
+
+int PageCacheImpl::WriteCompressed(const std::string &key,
+                                   uint32_t pagePos,
+                                   uint32_t length,
+                                   const char *buf) {
+    uint32_t headSize = cfg_.PageMetaSize + bitmapSize_;
+    static thread_local std::vector<char> pageBuf;
+    pageBuf.resize(GetRealPageSize());
+    char* newPage = pageBuf.data();
+
+    uint32_t spins = 0;
+    while (true) {
+        // the old item stays locked until its replacement is inserted,
+        // concurrent writers of the same page queue on its sequence
+        Cache::WriteHandle oldHandle = cache_->findToWrite(key);
+        char* oldValue = nullptr;
+        if (oldHandle) {
+            oldValue = reinterpret_cast<char*>(oldHandle->getMemory());
+            if (!Lock(oldValue)) {
+                oldHandle.reset();
+                Backoff(spins);
+                continue;
+            }
+            // replaced by another writer between find and lock
+            auto curHandle = cache_->find(key);
+            if (curHandle) curHandle.wait();
+            if (curHandle.get() != oldHandle.get()) {
+                UnLock(oldValue);
+                oldHandle.reset();
+                Backoff(spins);
+                continue;
+            }
+            if (!UnpackPage(oldValue, newPage))
+                memset(newPage, 0, headSize);  // drop the corrupted page
+        } else {
+            memset(newPage, 0, headSize);
+        }
+
+        std::memcpy(newPage + headSize + pagePos, buf, length);
+        SetBitMap(newPage, pagePos, length, true);
+
+        std::string packed;
+        try {
+            packed = GetCodec()->compress(
+                    folly::StringPiece(newPage + headSize, cfg_.PageBodySize));
+        } catch (const std::exception& e) {
+            LOG(ERROR) << "[PageCache]Compress page failed, name:"
+                       << cfg_.CacheName << ", err:" << e.what();
+            packed.clear();
+        }
+        bool isRaw = packed.empty() || packed.size() >= cfg_.PageBodySize;
+        CompressedLenType bodyLen = isRaw ? cfg_.PageBodySize : packed.size();
+        const char* body = isRaw ? newPage + headSize : packed.data();
+        uint32_t itemSize = headSize + sizeof(bodyLen) + bodyLen;
+
+        auto writeHandle = AllocateItem(key, itemSize);
+        if (!writeHandle) {
+            if (oldValue) UnLock(oldValue);
+            return PAGE_WRITE_FAIL;
+        }
+        char* pageValue = reinterpret_cast<char*>(writeHandle->getMemory());
+        std::memcpy(pageValue, newPage, headSize);
+        // the copied sequence belongs to the old item
+        memset(pageValue + int(MetaPos::SEQ), 0, int(MetaPos::FAST_BITMAP));
+        std::memcpy(pageValue + headSize, &bodyLen, sizeof(bodyLen));
+        std::memcpy(pageValue + headSize + sizeof(bodyLen), body, bodyLen);
+
+        bool isNew = false;
+        if (oldHandle || cfg_.CacheLibCfg.EnableNvmCache) {
+            isNew = !cache_->insertOrReplace(writeHandle);
+        } else if (cache_->insert(writeHandle)) {
+            isNew = true;
+        } else {
+            // created by another writer, merge into it
+            Backoff(spins);
+            continue;
+        }
+        if (oldValue) UnLock(oldValue);
+
+        if (isNew) {
+            pageNum_.fetch_add(1);
+            pagesList_.insert(key);
+        }
+        compressInBytes_.fetch_add(GetRealPageSize());
+        compressOutBytes_.fetch_add(itemSize);
+        break;
+    }
+    return SUCCESS;
+}
+
 }  // namespace HybridCache
@@ -7,13 +7,20 @@
 #define HYBRIDCACHE_PAGE_CACHE_H_
 
 #include <string>
+#include <array>
 #include <set>
+#include <vector>
 
 #include "folly/ConcurrentSkipList.h"
+#include "folly/compression/Compression.h"
+#include "folly/futures/Future.h"
+#include "folly/lang/Align.h"
+#include "folly/synchronization/RWSpinLock.h"
 #include "cachelib/allocator/CacheAllocator.h"
 
 #include "common.h"
 #include "config.h"
+#include "errorcode.h"
 
 namespace HybridCache {
 
@@ -21,11 +28,48 @@ typedef folly::ConcurrentSkipList<std::string> StringSkipList;
 using Cache = facebook::cachelib::LruAllocator;
 using facebook::cachelib::PoolId;
 
+// page meta layout:
+// [SEQ, SEQ+16): 64-bit sequence counter, placed at the first 8-byte aligned
+//                address of the slot, odd while a writer holds the page
+// FAST_BITMAP:   whole page valid flag
 enum class MetaPos {
-    LOCK = 0,
-    LASTVER,
-    NEWVER,
-    FAST_BITMAP
+    SEQ = 0,
+    FAST_BITMAP = 16
+};
+
+static const uint32_t PAGE_META_MIN_SIZE = int(MetaPos::FAST_BITMAP) + 1;
+
+// compressed page layout:
+// [meta][bitmap][uint32_t body len][body]
+// meta and bitmap stay uncompressed, so DeletePart works in place.
+// the body is stored raw when compression can not shrink it,
+// that is when body len equals PageBodySize
+typedef uint32_t CompressedLenType;
+
+// exponential pause rounds before falling back to yield
+static const uint32_t BACKOFF_SPIN_LIMIT = 6;
+
+// SafeMode allocate/remove lock stripes, keyed by page key hash
+static const uint32_t SAFE_MODE_LOCK_STRIPES = 1024;
+
+// one page of a batched read/write
+struct PageRequest {
+    std::string key;  // page key
+    uint32_t pagePos;
+    uint32_t length;
+    char *buf;  // user buf
+    int res = SUCCESS;  // output
+    std::vector<std::pair<size_t, size_t>> dataBoundary;  // output, read only
+
+    PageRequest(const std::string &pageKey, uint32_t pos, uint32_t len, char *data)
+        : key(pageKey), pagePos(pos), length(len), buf(data) {}
+};
+
+// a page range served straight from cache memory,
+// data stays valid as long as pin is held
+struct PinnedData {
+    ByteBuffer data;
+    std::shared_ptr<const void> pin;
 };
 
 class PageCache {
@@ -49,6 +93,28 @@ class PageCache {
                      std::vector<std::pair<size_t, size_t>>& dataBoundary  // valid data segment boundar
                     ) = 0;
 
+    // batched Read, fills res/dataBoundary of every page.
+    // return the first error other than PAGE_NOT_FOUND
+    virtual int ReadPages(std::vector<PageRequest>& pages) = 0;
+
+    // async ReadPages, pages in DRAM are copied before it returns and
+    // NVM pages once their lookup completes.
+    // pages must stay valid until the returned future completes
+    virtual folly::SemiFuture<int> ReadPagesAsync(
+            std::vector<PageRequest>& pages) = 0;
+
+    // zero-copy Read, pins the page instead of copying it out. pinned data
+    // never changes, writers copy a pinned page.
+    // return PAGE_NOT_FOUND unless [pagePos, pagePos+length) is all valid,
+    // nonsupport compressed pages nor EnableCAS off
+    virtual int ReadPinned(const std::string &key,
+                           uint32_t pagePos,
+                           uint32_t length,
+                           PinnedData& pinned) = 0;
+
+    // batched Write
+    virtual int WritePages(std::vector<PageRequest>& pages) = 0;
+
     // upper layer need to guarantee that the page will not be delete
     virtual int GetAllCache(const std::string &key,
                     std::vector<std::pair<ByteBuffer, size_t>>& dataSegments  // <ByteBuffer(buf+len), pageOff>
@@ -66,18 +132,25 @@ class PageCache {
     virtual size_t GetCacheSize() = 0;
     virtual size_t GetCacheMaxSize() = 0;
 
+    // page size before/after compression, 1 if compression is off
+    virtual double GetCompressRatio() = 0;
+    // max size scaled by the compress ratio
+    virtual size_t GetCacheEffectiveMaxSize() = 0;
+
     const folly::ConcurrentSkipList<std::string>::Accessor& GetPageList() {
         return this->pagesList_;
     }
 
  protected:
-    // CAS operate
+    // seqlock operate
+    // writer: Lock() makes the sequence odd, UnLock() makes it even again
     bool Lock(char* pageMemory);
     void UnLock(char* pageMemory);
-    uint8_t AddNewVer(char* pageMemory);
-    void SetLastVer(char* pageMemory, uint8_t newVer);
-    uint8_t GetLastVer(const char* pageMemory);
-    uint8_t GetNewVer(const char* pageMemory);
+    // reader: copy optimistically between ReadBegin() and ReadValidate()
+    uint64_t ReadBegin(const char* pageMemory);
+    bool ReadValidate(const char* pageMemory, uint64_t seq);
+    // spin a few rounds, then yield the cpu to the lock holder
+    void Backoff(uint32_t& spins);
 
     // bitmap operate
     void SetFastBitmap(char* pageMemory, bool valid);
@@ -96,12 +169,14 @@ class PageCacheImpl : public PageCache {
  public:
     PageCacheImpl(const CacheConfig& cfg) : PageCache(cfg) {
         bitmapSize_ = cfg_.PageBodySize / BYTE_LEN;
+        InitCompress();
     }
 
     // added by tqy
     PageCacheImpl(const CacheConfig& cfg, PoolId curr_pool_id, 
                   std::shared_ptr<Cache> curr_cache) : PageCache(cfg) {
         bitmapSize_ = cfg_.PageBodySize / BYTE_LEN;
+        InitCompress();
         cache_ = curr_cache;
         pool_ = curr_pool_id;
     }
@@ -125,6 +200,18 @@ class PageCacheImpl : public PageCache {
              std::vector<std::pair<size_t, size_t>>& dataBoundary
             );
 
+    int ReadPages(std::vector<PageRequest>& pages);
+
+    folly::SemiFuture<int> ReadPagesAsync(std::vector<PageRequest>& pages);
+
+    int ReadPinned(const std::string &key,
+                   uint32_t pagePos,
+                   uint32_t length,
+                   PinnedData& pinned);
+
+    int WritePages(std::vector<PageRequest>& pages);
+
+    // nonsupport compressed pages, the segments point into page memory
     int GetAllCache(const std::string &key,
                     std::vector<std::pair<ByteBuffer, size_t>>& dataSegments
                    );
@@ -147,6 +234,15 @@ class PageCacheImpl : public PageCache {
         return cfg_.MaxCacheSize + nvmMaxSize;
     }
 
+    double GetCompressRatio() {
+        uint64_t outBytes = compressOutBytes_.load();
+        if (0 == outBytes) return 1.0;
+        return static_cast<double>(compressInBytes_.load()) / outBytes;
+    }
+    size_t GetCacheEffectiveMaxSize() {
+        return GetCacheMaxSize() * GetCompressRatio();
+    }
+
  private:
     uint64_t GetPageNum() {
         return pageNum_.load();
@@ -156,14 +252,61 @@ class PageCacheImpl : public PageCache {
         return cfg_.PageMetaSize + bitmapSize_ + cfg_.PageBodySize;
     }
 
+    // nullptr if the page can not be allocated
     Cache::WriteHandle FindOrCreateWriteHandle(const std::string &key);
+    Cache::WriteHandle AllocateItem(const std::string &key, uint32_t size);
+    // Write of a locked page other handles refer to, into a new item that
+    // replaces it. The old item is left locked
+    int WriteCopy(const std::string &key,
+                  char* oldValue,
+                  uint32_t pagePos,
+                  uint32_t length,
+                  const char *buf);
+
+    // compression operate
+    void InitCompress();
+    bool IsCompressed() { return COMPRESS_NONE != cfg_.CompressType; }
+    folly::io::Codec* GetCodec();  // codecs are not thread safe, one per thread
+    // expand a compressed page into the raw page layout at out
+    bool UnpackPage(const char* pageValue, char* out);
+    // raw page layout view of pageValue, nullptr if the body is corrupted
+    const char* GetPageView(const char* pageValue);
+    // read-modify-write of a compressed page, replaces the whole item
+    int WriteCompressed(const std::string &key,
+                        uint32_t pagePos,
+                        uint32_t length,
+                        const char *buf);
+
+    folly::RWSpinLock& GetStripeLock(const std::string &key) {
+        return stripeLocks_[std::hash<std::string>{}(key) %
+                            SAFE_MODE_LOCK_STRIPES].lock;
+    }
+
+    // fill one page request from a ready handle
+    void CopyPage(PageRequest& page, const Cache::ReadHandle& readHandle);
+
+    // whether [pagePos, pagePos+length) is all valid in the bitmap
+    bool IsRangeValid(const char* pageValue, uint32_t pagePos, uint32_t length);
+
+    // copy the valid segments of [pagePos, pagePos+length) to buf
+    void CopyValidData(const char* pageValue,
+                       uint32_t pagePos,
+                       uint32_t length,
+                       char *buf,
+                       std::vector<std::pair<size_t, size_t>>& dataBoundary);
 
  private:
     std::shared_ptr<Cache> cache_;
     PoolId pool_;
     std::atomic<uint64_t> pageNum_{0};
     uint32_t bitmapSize_;
-    std::atomic<int64_t> lock_{0};
+    std::atomic<uint64_t> compressInBytes_{0};
+    std::atomic<uint64_t> compressOutBytes_{0};
+    // padded to one cache line, so unrelated keys never share a line
+    struct alignas(folly::hardware_destructive_interference_size) StripeLock {
+        folly::RWSpinLock lock;
+    };
+    std::array<StripeLock, SAFE_MODE_LOCK_STRIPES> stripeLocks_;
 };
 
 }  // namespace HybridCache
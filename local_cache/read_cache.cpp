@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "errorcode.h"
 #include "read_cache.h"
 
@@ -19,40 +21,58 @@ folly::Future<int> ReadCache::Get(const std::string &key, size_t start,
     std::chrono::steady_clock::time_point startTime;
     if (EnableLogging) startTime = std::chrono::steady_clock::now();
 
-    int res = SUCCESS;
     uint32_t pageSize = cfg_.CacheCfg.PageBodySize;
     size_t index = start / pageSize;
     uint32_t pagePos = start % pageSize;
     size_t readLen = 0;
-    size_t realReadLen = 0;
     size_t bufOffset = 0;
     size_t remainLen = len;
-    uint64_t readPageCnt = 0;
-    std::vector<std::pair<size_t, size_t>> dataBoundary;
+    auto pages = std::make_shared<std::vector<PageRequest>>();
 
     while (remainLen > 0) {
         readLen = pagePos + remainLen > pageSize ? pageSize - pagePos : remainLen;
-        std::string pageKey = std::move(GetPageKey(key, index));
-        std::vector<std::pair<size_t, size_t>> stepDataBoundary;
-        int tmpRes = pageCache_->Read(pageKey, pagePos, readLen,
-                     (buffer.data + bufOffset), stepDataBoundary);
-        if (SUCCESS == tmpRes) {
-            ++readPageCnt;
-        } else if (PAGE_NOT_FOUND != tmpRes) {
-            res = tmpRes;
-            break;
-        }
-
-        for (auto& it : stepDataBoundary) {
-            dataBoundary.push_back(std::make_pair(it.first + bufOffset, it.second));
-            realReadLen += it.second;
-        }
+        pages->emplace_back(GetPageKey(key, index), pagePos, readLen,
+                            buffer.data + bufOffset);
         remainLen -= readLen;
         ++index;
         bufOffset += readLen;
         pagePos = (pagePos + readLen) % pageSize;
     }
 
+    // pages in DRAM are copied inline, NVM lookups of the whole request
+    // are in flight together and copied as they complete
+    auto readFuture = pageCache_->ReadPagesAsync(*pages);
+    if (readFuture.isReady()) {
+        return GetMissed(key, start, len, buffer, *pages,
+                         std::move(readFuture).get(), startTime);
+    }
+    ByteBuffer userBuffer = buffer;
+    return std::move(readFuture).via(executor_.get())
+            .thenValue([this, key, start, len, userBuffer, pages, startTime](int res) {
+        return this->GetMissed(key, start, len, userBuffer, *pages, res, startTime);
+    });
+}
+
+folly::Future<int> ReadCache::GetMissed(const std::string &key, size_t start,
+        size_t len, const ByteBuffer &buffer,
+        const std::vector<PageRequest> &pages, int res,
+        std::chrono::steady_clock::time_point startTime) {
+    size_t readLen = 0;
+    size_t realReadLen = 0;
+    size_t bufOffset = 0;
+    size_t remainLen = 0;
+    uint64_t readPageCnt = 0;
+    std::vector<std::pair<size_t, size_t>> dataBoundary;
+
+    for (auto& page : pages) {
+        if (SUCCESS == page.res) ++readPageCnt;
+        bufOffset = page.buf - buffer.data;
+        for (auto& it : page.dataBoundary) {
+            dataBoundary.push_back(std::make_pair(it.first + bufOffset, it.second));
+            realReadLen += it.second;
+        }
+    }
+
     remainLen = len - realReadLen;
     if (remainLen > 0 && !dataAdaptor_) {
         res = ADAPTOR_NOT_FOUND;
@@ -96,6 +116,11 @@ folly::Future<int> ReadCache::Get(const std::string &key, size_t start,
                            << ", res:" << downRes;
                 return downRes;
             }
+            if (COMPRESS_NONE != cfg_.CacheCfg.CompressType) {
+                // compress off the read path
+                this->PutAsync(key, fileStartOff, readLen, stepBuffer);
+                return SUCCESS;
+            }
             return this->Put(key, fileStartOff, readLen, stepBuffer);
         });
 
@@ -147,6 +172,32 @@ folly::Future<int> ReadCache::Get(const std::string &key, size_t start,
     return folly::makeFuture(res);
 }
 
+int ReadCache::GetPinned(const std::string &key, size_t start, size_t len,
+                         std::vector<PinnedData>& segments) {
+    uint32_t pageSize = cfg_.CacheCfg.PageBodySize;
+    size_t index = start / pageSize;
+    uint32_t pagePos = start % pageSize;
+    size_t readLen = 0;
+    size_t remainLen = len;
+    segments.clear();
+
+    while (remainLen > 0) {
+        readLen = pagePos + remainLen > pageSize ? pageSize - pagePos : remainLen;
+        PinnedData pinned;
+        int res = pageCache_->ReadPinned(GetPageKey(key, index), pagePos,
+                                         readLen, pinned);
+        if (SUCCESS != res) {
+            segments.clear();
+            return res;
+        }
+        segments.emplace_back(std::move(pinned));
+        remainLen -= readLen;
+        ++index;
+        pagePos = (pagePos + readLen) % pageSize;
+    }
+    return SUCCESS;
+}
+
 int ReadCache::Put(const std::string &key, size_t start, size_t len,
                    const ByteBuffer &buffer) {
     std::chrono::steady_clock::time_point startTime;
@@ -161,19 +212,22 @@ int ReadCache::Put(const std::string &key, size_t start, size_t len,
     uint64_t writePageCnt = 0;
     size_t remainLen = len;
 
+    std::vector<PageRequest> pages;
     while (remainLen > 0) {
         writeLen = pagePos + remainLen > pageSize ? pageSize - pagePos : remainLen;
-        std::string pageKey = std::move(GetPageKey(key, index));
-        res = pageCache_->Write(pageKey, pagePos, writeLen,
-                                (buffer.data + writeOffset));
-        if (SUCCESS != res) break;
-        ++writePageCnt;
+        pages.emplace_back(GetPageKey(key, index), pagePos, writeLen,
+                           buffer.data + writeOffset);
         remainLen -= writeLen;
         ++index;
         writeOffset += writeLen;
         pagePos = (pagePos + writeLen) % pageSize;
     }
 
+    res = pageCache_->WritePages(pages);
+    for (auto& page : pages) {
+        if (SUCCESS == page.res) ++writePageCnt;
+    }
+
     if (EnableLogging) {
         double totalTime = std::chrono::duration<double, std::milli>(
                 std::chrono::steady_clock::now() - startTime).count();
@@ -185,6 +239,16 @@ int ReadCache::Put(const std::string &key, size_t start, size_t len,
     return res;
 }
 
+void ReadCache::PutAsync(const std::string &key, size_t start, size_t len,
+                         const ByteBuffer &buffer) {
+    // the user buffer is handed back once Get returns, put a copy
+    std::shared_ptr<char> data(new char[len], std::default_delete<char[]>());
+    std::memcpy(data.get(), buffer.data, len);
+    executor_->add([this, key, start, len, data]() {
+        this->Put(key, start, len, ByteBuffer(data.get(), len));
+    });
+}
+
 int ReadCache::Delete(const std::string &key) {
     std::chrono::steady_clock::time_point startTime;
     if (EnableLogging) startTime = std::chrono::steady_clock::now();
@@ -237,9 +301,19 @@ int ReadCache::GetAllKeys(std::set<std::string>& keys) {
     return SUCCESS;
 }
 
+double ReadCache::GetCompressRatio() {
+    return pageCache_->GetCompressRatio();
+}
+
+size_t ReadCache::GetCacheEffectiveMaxSize() {
+    return pageCache_->GetCacheEffectiveMaxSize();
+}
+
 void ReadCache::Close() {
     pageCache_->Close();
-    LOG(WARNING) << "[ReadCache]Close";
+    LOG(WARNING) << "[ReadCache]Close, compressType:" << cfg_.CacheCfg.CompressType
+                 << ", compressRatio:" << GetCompressRatio()
+                 << ", effectiveMaxSize:" << GetCacheEffectiveMaxSize();
 }
 
 int ReadCache::Init() {
@@ -247,7 +321,8 @@ int ReadCache::Init() {
     tokenBucket_ = std::make_shared<folly::TokenBucket>(
             cfg_.DownloadNormalFlowLimit, cfg_.DownloadBurstFlowLimit);
     int res = pageCache_->Init();
-    LOG(WARNING) << "[ReadCache]Init, res:" << res;
+    LOG(WARNING) << "[ReadCache]Init, res:" << res
+                 << ", compressType:" << cfg_.CacheCfg.CompressType;
     return res;
 }
 
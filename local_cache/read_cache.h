@@ -30,15 +30,34 @@ class ReadCache {
                            ByteBuffer &buffer // user buf
                           );
 
+    // zero-copy Get of a range that is fully cached, the segments point
+    // into the cache pages in order. return PAGE_NOT_FOUND on any miss,
+    // the caller falls back to Get then
+    int GetPinned(const std::string &key,
+                  size_t start,
+                  size_t len,
+                  std::vector<PinnedData>& segments);
+
     int Put(const std::string &key,
             size_t start,
             size_t len,
             const ByteBuffer &buffer);
 
+    // Put in the executor on a copy of the buffer, for the miss path of
+    // compressed caches
+    void PutAsync(const std::string &key,
+                  size_t start,
+                  size_t len,
+                  const ByteBuffer &buffer);
+
     int Delete(const std::string &key);
 
     int GetAllKeys(std::set<std::string>& keys);
 
+    // page compress ratio and the capacity it buys
+    double GetCompressRatio();
+    size_t GetCacheEffectiveMaxSize();
+
     void Close();
 
  private:
@@ -49,6 +68,15 @@ class ReadCache {
 
     std::string GetPageKey(const std::string &key, size_t pageIndex);
 
+    // merge the page results of Get and download the missing ranges
+    folly::Future<int> GetMissed(const std::string &key,
+                                 size_t start,
+                                 size_t len,
+                                 const ByteBuffer &buffer,
+                                 const std::vector<PageRequest> &pages,
+                                 int res,
+                                 std::chrono::steady_clock::time_point startTime);
+
  private:
     ReadCacheConfig cfg_;
     std::shared_ptr<PageCache> pageCache_;
@@ -37,18 +37,21 @@ int WriteCache::Put(const std::string &key, size_t start, size_t len,
     if (cfg_.EnableThrottle)
         this->throttling_.Put_Consume(key, len);
 
+    std::vector<PageRequest> pages;
     while (remainLen > 0) {
         writeLen = pagePos + remainLen > pageSize ? pageSize - pagePos : remainLen;
-        std::string pageKey = std::move(GetPageKey(key, index));
-        res = pageCache_->Write(pageKey, pagePos, writeLen,
-                                (buffer.data + writeOffset));
-        if (SUCCESS != res) break;
-        ++writePageCnt;
+        pages.emplace_back(GetPageKey(key, index), pagePos, writeLen,
+                           buffer.data + writeOffset);
         remainLen -= writeLen;
         ++index;
         writeOffset += writeLen;
         pagePos = (pagePos + writeLen) % pageSize;
     }
+
+    res = pageCache_->WritePages(pages);
+    for (auto& page : pages) {
+        if (SUCCESS == page.res) ++writePageCnt;
+    }
     if (0 < writePageCnt)
         keys_.insert(key, time(nullptr));
 
@@ -78,20 +81,22 @@ int WriteCache::Get(const std::string &key, size_t start, size_t len,
     size_t remainLen = len;
     uint64_t readPageCnt = 0;
 
+    std::vector<PageRequest> pages;
     while (remainLen > 0) {
         readLen = pagePos + remainLen > pageSize ? pageSize - pagePos : remainLen;
-        std::string pageKey = std::move(GetPageKey(key, index));
-        std::vector<std::pair<size_t, size_t>> stepDataBoundary;
-        int tmpRes = pageCache_->Read(pageKey, pagePos, readLen,
-                (buffer.data + bufOffset), stepDataBoundary);
-        if (SUCCESS == tmpRes) {
-            ++readPageCnt;
-        } else if (PAGE_NOT_FOUND != tmpRes) {
-            res = tmpRes;
-            break;
-        }
+        pages.emplace_back(GetPageKey(key, index), pagePos, readLen,
+                           buffer.data + bufOffset);
+        remainLen -= readLen;
+        ++index;
+        bufOffset += readLen;
+        pagePos = (pagePos + readLen) % pageSize;
+    }
 
-        for (auto& it : stepDataBoundary) {
+    res = pageCache_->ReadPages(pages);
+    for (auto& page : pages) {
+        if (SUCCESS == page.res) ++readPageCnt;
+        bufOffset = page.buf - buffer.data;
+        for (auto& it : page.dataBoundary) {
             size_t realStart = it.first + bufOffset;
             auto last = dataBoundary.rbegin();
             if (last != dataBoundary.rend() && (last->first + last->second) == realStart) {
@@ -100,10 +105,6 @@ int WriteCache::Get(const std::string &key, size_t start, size_t len,
                 dataBoundary.push_back(std::make_pair(realStart, it.second));
             }
         }
-        remainLen -= readLen;
-        ++index;
-        bufOffset += readLen;
-        pagePos = (pagePos + readLen) % pageSize;
     }
 
     if (EnableLogging) {
@@ -33,6 +33,10 @@ void HybridCacheAccessor4S3fs::Init() {
         if (cfg_.GlobalCacheCfg.EnableWriteCache) {
             GetGlobalConfig().default_policy.write_cache_type = REPLICATION;
             GetGlobalConfig().default_policy.write_replication_factor = 1;
+        }
+        // also used to watch the global cache servers joining or leaving
+        if (cfg_.GlobalCacheCfg.EnableWriteCache ||
+                !cfg_.GlobalCacheCfg.EtcdAddress.empty()) {
             etcd_client = std::make_shared<EtcdClient>(cfg_.GlobalCacheCfg.EtcdAddress);
         }
         if (!cfg_.GlobalCacheCfg.GflagFile.empty()) {
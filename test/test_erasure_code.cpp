@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <vector>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "ErasureCode.h"
+
+class ErasureCodeTest : public testing::TestWithParam<std::pair<int, int>> {
+protected:
+    void SetUp() override {
+        std::tie(k_, m_) = GetParam();
+        code_ = ErasureCode::Get(k_, m_);
+        ASSERT_NE(nullptr, code_);
+    }
+
+    // random data blocks followed by their parity
+    void Encode(size_t len) {
+        blocks_.assign(k_ + m_, std::vector<char>(len));
+        ptrs_.clear();
+        for (auto &block : blocks_) {
+            for (auto &c : block) {
+                c = rng_();
+            }
+            ptrs_.push_back(block.data());
+        }
+        code_->Encode(&ptrs_[0], &ptrs_[k_], len);
+    }
+
+    int k_, m_;
+    std::shared_ptr<const ErasureCode> code_;
+    std::vector<std::vector<char>> blocks_;
+    std::vector<char *> ptrs_;
+    std::mt19937 rng_{1};
+};
+
+TEST_P(ErasureCodeTest, RecoverErasures) {
+    // lengths cover the SIMD loops and their scalar tails
+    for (size_t len : { 1, 31, 64, 100, 4096 + 7 }) {
+        Encode(len);
+        const auto expected = blocks_;
+        for (int round = 0; round < 20; ++round) {
+            std::vector<int> ids(k_ + m_);
+            std::iota(ids.begin(), ids.end(), 0);
+            std::shuffle(ids.begin(), ids.end(), rng_);
+            std::vector<int> erasures(ids.begin(), ids.begin() + rng_() % (m_ + 1));
+            for (auto id : erasures) {
+                memset(ptrs_[id], 0, len);
+            }
+            ASSERT_EQ(OK, code_->Decode(&ptrs_[0], erasures, len));
+            for (int i = 0; i < k_; ++i) {
+                ASSERT_EQ(expected[i], blocks_[i]) << "len " << len << ", block " << i;
+            }
+            blocks_ = expected;
+            for (int i = 0; i < k_ + m_; ++i) {
+                ptrs_[i] = blocks_[i].data();
+            }
+        }
+    }
+}
+
+TEST_P(ErasureCodeTest, TooManyErasures) {
+    Encode(128);
+    std::vector<int> erasures;
+    for (int i = 0; i <= m_; ++i) {
+        erasures.push_back(i);
+    }
+    EXPECT_EQ(IO_ERROR, code_->Decode(&ptrs_[0], erasures, 128));
+}
+
+INSTANTIATE_TEST_CASE_P(Codes, ErasureCodeTest,
+                        testing::Values(std::make_pair(1, 1), std::make_pair(3, 2),
+                                        std::make_pair(4, 4), std::make_pair(10, 4)));
+
+TEST(ErasureCode, SharedPerCode) {
+    EXPECT_EQ(ErasureCode::Get(3, 2), ErasureCode::Get(3, 2));
+    EXPECT_NE(ErasureCode::Get(3, 2), ErasureCode::Get(3, 1));
+    EXPECT_EQ(nullptr, ErasureCode::Get(0, 2));
+    EXPECT_EQ(nullptr, ErasureCode::Get(200, 57));
+}
+
+TEST(CodingBuffer, Reuse) {
+    char *data;
+    {
+        CodingBuffer buffer(4096);
+        data = buffer.data();
+        EXPECT_EQ(0, (uintptr_t) data % 64);
+    }
+    CodingBuffer buffer(4096);
+    EXPECT_EQ(data, buffer.data());
+}
+
+int main(int argc, char **argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
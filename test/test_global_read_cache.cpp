@@ -8,12 +8,15 @@
 #include "FileSystemDataAdaptor.h"
 #include "GlobalDataAdaptor.h"
 #include "ReadCacheClient.h"
+#include "ReadCache.h"
 
 DEFINE_string(server, "0.0.0.0:8000", "IP Address of server");
 DEFINE_int32(bench_repeat, 1000, "Repeat count");
 DEFINE_int32(bench_size, 1024 * 16, "Request size in bytes");
 DEFINE_string(filename, "sample.dat", "Test file name");
 
+DECLARE_uint64(gc_reclaim_bytes);
+
 std::string ReadDirectly(const std::string &path, size_t start, size_t length) {
     int fd = open(path.c_str(), O_RDONLY);
     if (fd < 0) {
@@ -109,6 +112,54 @@ TEST(read_cache, generate_get_chunk_request)
     }
 }
 
+TEST(read_cache, group_get_chunk_request)
+{
+    const size_t chunk_size = GetGlobalConfig().default_policy.read_chunk_size;
+    ByteBuffer mock_buffer((char *) 0, 10 * chunk_size);
+    std::vector<ReadCacheClient::GetChunkRequestV2> requests;
+    ReadCacheClient::GenerateGetChunkRequestsV2("foo", 0, 5 * chunk_size, mock_buffer, requests, chunk_size);
+    ASSERT_EQ(requests.size(), 5);
+
+    std::vector<std::vector<int>> replicas = { {0}, {1}, {0}, {0}, {1} };
+    std::vector<int> server_ids = { 0, 1, 0, 0, 1 };
+    std::vector<ReadCacheClient::GetChunkBatch> batches;
+    ReadCacheClient::GroupGetChunkRequests(requests, replicas, server_ids, batches, 2);
+    ASSERT_EQ(batches.size(), 3);
+    ASSERT_EQ(batches[0].server_id, 0);
+    ASSERT_EQ(batches[0].requests.size(), 2);
+    ASSERT_EQ(batches[0].requests[0].chunk_id, 0);
+    ASSERT_EQ(batches[0].requests[1].chunk_id, 2);
+    ASSERT_EQ(batches[1].server_id, 1);
+    ASSERT_EQ(batches[1].requests.size(), 2);
+    ASSERT_EQ(batches[1].requests[0].chunk_id, 1);
+    ASSERT_EQ(batches[1].requests[1].chunk_id, 4);
+    ASSERT_EQ(batches[1].requests[1].buffer.data, (char *) (4 * chunk_size));
+    ASSERT_EQ(batches[2].server_id, 0);
+    ASSERT_EQ(batches[2].requests.size(), 1);
+    ASSERT_EQ(batches[2].requests[0].chunk_id, 3);
+    ASSERT_EQ(batches[2].replicas[0], std::vector<int>{0});
+}
+
+TEST(read_cache, parse_internal_key)
+{
+    std::string user_key;
+    uint64_t chunk_id, chunk_size;
+    ASSERT_TRUE(ReadCache::ParseInternalKey("foo-3-262144", user_key, chunk_id, chunk_size));
+    ASSERT_EQ(user_key, "foo");
+    ASSERT_EQ(chunk_id, 3);
+    ASSERT_EQ(chunk_size, 262144);
+
+    ASSERT_TRUE(ReadCache::ParseInternalKey("dir/a-b-0-4096", user_key, chunk_id, chunk_size));
+    ASSERT_EQ(user_key, "dir/a-b");
+    ASSERT_EQ(chunk_id, 0);
+    ASSERT_EQ(chunk_size, 4096);
+
+    ASSERT_FALSE(ReadCache::ParseInternalKey("foo", user_key, chunk_id, chunk_size));
+    ASSERT_FALSE(ReadCache::ParseInternalKey("foo-3", user_key, chunk_id, chunk_size));
+    ASSERT_FALSE(ReadCache::ParseInternalKey("foo-x-4096", user_key, chunk_id, chunk_size));
+    ASSERT_FALSE(ReadCache::ParseInternalKey("foo-3-0", user_key, chunk_id, chunk_size));
+}
+
 TEST(read_cache, get_chunk)
 {
     auto etcd_client = std::make_shared<EtcdClient>("http://127.0.0.1:2379");
@@ -168,6 +219,58 @@ TEST(read_cache, mix_read_write)
     ASSERT_EQ(NOT_FOUND, global->Head("hello", fsize, headers).get());
 }
 
+// keys written while GC runs may own chunks older than the ts it queried
+// and get their records after its first list, they must all survive
+TEST(read_cache, gc_keeps_concurrent_writes)
+{
+    GetGlobalConfig().default_policy.write_cache_type = REPLICATION;
+    auto etcd_client = std::make_shared<EtcdClient>("http://127.0.0.1:2379");
+    auto base = std::make_shared<FileSystemDataAdaptor>();
+    auto global = std::make_shared<GlobalDataAdaptor>(base, SplitString(FLAGS_server), etcd_client);
+
+    const size_t chunk_size = GetGlobalConfig().default_policy.read_chunk_size;
+    const int key_count = 64;
+    FLAGS_gc_reclaim_bytes = chunk_size;    // reclaim after every key flushed
+    for (int i = 0; i < 8; ++i) {
+        std::map<std::string, std::string> headers;
+        ByteBuffer buffer(new char[2 * chunk_size], 2 * chunk_size);
+        memset(buffer.data, 'A' + i, buffer.len);
+        ASSERT_EQ(0, global->UpLoad("gc-old-" + std::to_string(i), buffer.len, buffer, headers).get());
+        delete []buffer.data;
+    }
+
+    std::atomic<bool> writing(true);
+    std::thread writer([&] {
+        std::map<std::string, std::string> headers;
+        ByteBuffer buffer(new char[2 * chunk_size], 2 * chunk_size);
+        for (int i = 0; i < key_count; ++i) {
+            memset(buffer.data, 'a' + i % 26, buffer.len);
+            EXPECT_EQ(0, global->UpLoad("gc-new-" + std::to_string(i), buffer.len, buffer, headers).get());
+        }
+        delete []buffer.data;
+        writing = false;
+    });
+    while (writing) {
+        ASSERT_EQ(0, global->PerformGarbageCollection("gc-"));
+    }
+    writer.join();
+    ASSERT_EQ(0, global->PerformGarbageCollection("gc-"));
+
+    ByteBuffer buffer(new char[2 * chunk_size], 2 * chunk_size);
+    for (int i = 0; i < key_count; ++i) {
+        memset(buffer.data, 0, buffer.len);
+        ASSERT_EQ(0, global->DownLoad("gc-new-" + std::to_string(i), 0, buffer.len, buffer).get());
+        ASSERT_EQ(std::string(buffer.len, 'a' + i % 26), std::string(buffer.data, buffer.len)) << i;
+    }
+    delete []buffer.data;
+    for (int i = 0; i < 8; ++i) {
+        global->Delete("gc-old-" + std::to_string(i)).get();
+    }
+    for (int i = 0; i < key_count; ++i) {
+        global->Delete("gc-new-" + std::to_string(i)).get();
+    }
+}
+
 int main(int argc, char **argv)
 {
     gflags::ParseCommandLineFlags(&argc, &argv, true);
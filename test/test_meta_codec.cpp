@@ -0,0 +1,92 @@
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "MetaCodec.h"
+
+static Json::Value BuildRoot(const std::string &key, int chunks, const std::vector<int> &replicas) {
+    const uint64_t chunk_size = GetGlobalConfig().write_chunk_size;
+    Json::Value root, json_replica(Json::arrayValue), json_path(Json::arrayValue), json_headers;
+    uint64_t oid = 1000;
+    for (auto server_id : replicas) {
+        json_replica.append(server_id);
+    }
+    for (int chunk_id = 0; chunk_id < chunks; ++chunk_id) {
+        for (size_t i = 0; i < replicas.size(); ++i) {
+            json_path.append(key + "-" + std::to_string(chunk_id) + "-" + std::to_string(chunk_size)
+                             + "-" + std::to_string(oid++));
+        }
+    }
+    json_headers["content-type"] = "text/plain";
+    root["type"] = "replication";
+    root["size"] = (Json::UInt64) chunk_size * chunks;
+    root["replica"] = json_replica;
+    root["headers"] = json_headers;
+    root["path"] = json_path;
+    return root;
+}
+
+TEST(ObjectMetaCodec, DerivedChunkKeys) {
+    auto root = BuildRoot("bucket/dir/file", 64, { 1, 3, 5 });
+    std::string value;
+    ObjectMetaCodec::Encode("bucket/dir/file", root, value);
+    Json::FastWriter writer;
+    EXPECT_LT(value.size() * 10, writer.write(root).size());
+
+    Json::Value decoded;
+    ASSERT_EQ(OK, ObjectMetaCodec::Decode("bucket/dir/file", value, decoded));
+    EXPECT_EQ(root, decoded);
+}
+
+TEST(ObjectMetaCodec, ReedSolomon) {
+    auto root = BuildRoot("file", 4, { 0, 1, 2, 3, 4 });
+    root["type"] = "reed-solomon";
+    root["w"] = 8;
+    std::string value;
+    ObjectMetaCodec::Encode("file", root, value);
+
+    Json::Value decoded;
+    ASSERT_EQ(OK, ObjectMetaCodec::Decode("file", value, decoded));
+    EXPECT_EQ(root, decoded);
+}
+
+TEST(ObjectMetaCodec, ExplicitChunkKeys) {
+    auto root = BuildRoot("file", 4, { 0, 1 });
+    root["path"][3] = "file-1-7-0042";
+    std::string value;
+    ObjectMetaCodec::Encode("file", root, value);
+
+    Json::Value decoded;
+    ASSERT_EQ(OK, ObjectMetaCodec::Decode("file", value, decoded));
+    EXPECT_EQ(root, decoded);
+}
+
+TEST(ObjectMetaCodec, JsonEncoding) {
+    auto root = BuildRoot("file", 2, { 0, 1 });
+    FLAGS_etcd_binary_meta = false;
+    std::string value;
+    ObjectMetaCodec::Encode("file", root, value);
+    FLAGS_etcd_binary_meta = true;
+    EXPECT_EQ('{', value[0]);
+
+    Json::Value decoded;
+    ASSERT_EQ(OK, ObjectMetaCodec::Decode("file", value, decoded));
+    EXPECT_EQ(root, decoded);
+}
+
+TEST(ObjectMetaCodec, LegacyJson) {
+    auto root = BuildRoot("file", 2, { 0 });
+    Json::FastWriter writer;
+    Json::Value decoded;
+    ASSERT_EQ(OK, ObjectMetaCodec::Decode("file", writer.write(root), decoded));
+    EXPECT_EQ(root, decoded);
+    EXPECT_EQ(METADATA_ERROR, ObjectMetaCodec::Decode("file", "garbage", decoded));
+}
+
+int main(int argc, char **argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_etcd_binary_meta = true;      // off by default, the protobuf codec is tested
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
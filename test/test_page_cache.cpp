@@ -1,4 +1,8 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <thread>
 
 #include "gtest/gtest.h"
 
@@ -15,6 +19,7 @@ std::shared_ptr<PageCacheImpl> page;
 
 const std::string key1 = "007";
 const std::string key2 = "009";
+const std::string key3 = "011";
 
 const size_t TEST_LEN = 64 * 1024;
 std::unique_ptr<char[]> bufIn(new char[TEST_LEN]);
@@ -153,6 +158,161 @@ TEST(PageCache, DeletePart) {
     EXPECT_EQ(TEST_LEN-1, it->second);
 }
 
+TEST(PageCache, BatchReadWrite) {
+    const std::string batchKey = "batch_";
+    const int pageCnt = 4;
+    std::vector<PageRequest> writes;
+    for (int i=0; i<pageCnt; ++i) {
+        // page 0 and 2 are full pages, page 1 is partial, page 3 is empty
+        if (i == 3) continue;
+        uint32_t len = (i == 1) ? 100 : TEST_LEN;
+        writes.emplace_back(batchKey + std::to_string(i), 0, len, bufIn.get());
+    }
+    EXPECT_EQ(0, page->WritePages(writes));
+    for (auto& it : writes) EXPECT_EQ(0, it.res);
+
+    std::unique_ptr<char[]> batchOut(new char[pageCnt * TEST_LEN]);
+    std::vector<PageRequest> reads;
+    for (int i=0; i<pageCnt; ++i) {
+        reads.emplace_back(batchKey + std::to_string(i), 0, TEST_LEN,
+                           batchOut.get() + i * TEST_LEN);
+    }
+    EXPECT_EQ(0, page->ReadPages(reads));
+    EXPECT_EQ(0, reads[0].res);
+    EXPECT_EQ(0, reads[1].res);
+    EXPECT_EQ(0, reads[2].res);
+    EXPECT_EQ(ErrCode::PAGE_NOT_FOUND, reads[3].res);
+
+    EXPECT_EQ(1, reads[0].dataBoundary.size());
+    EXPECT_EQ(TEST_LEN, reads[0].dataBoundary[0].second);
+    EXPECT_EQ(1, reads[1].dataBoundary.size());
+    EXPECT_EQ(0, reads[1].dataBoundary[0].first);
+    EXPECT_EQ(100, reads[1].dataBoundary[0].second);
+    EXPECT_EQ(0, reads[3].dataBoundary.size());
+    for (int i=0; i<TEST_LEN; ++i) {
+        EXPECT_EQ(bufIn[i], batchOut[2 * TEST_LEN + i]);
+    }
+
+    for (int i=0; i<3; ++i) {
+        EXPECT_EQ(0, page->Delete(batchKey + std::to_string(i)));
+    }
+}
+
+TEST(PageCache, BatchWriteFail) {
+    // cachelib keys are at most 255 bytes, the second page can not be allocated
+    const std::string longKey(300, 'k');
+    std::vector<PageRequest> writes;
+    writes.emplace_back("batch_ok_0", 0, TEST_LEN, bufIn.get());
+    writes.emplace_back(longKey, 0, TEST_LEN, bufIn.get());
+    writes.emplace_back("batch_ok_2", 0, TEST_LEN, bufIn.get());
+    EXPECT_EQ(ErrCode::PAGE_WRITE_FAIL, page->WritePages(writes));
+    EXPECT_EQ(0, writes[0].res);
+    EXPECT_EQ(ErrCode::PAGE_WRITE_FAIL, writes[1].res);
+    EXPECT_EQ(0, writes[2].res);
+    EXPECT_EQ(0, page->Delete("batch_ok_0"));
+    EXPECT_EQ(0, page->Delete("batch_ok_2"));
+}
+
+TEST(PageCache, ReadPinned) {
+    const std::string pinKey = "pinned";
+    EXPECT_EQ(0, page->Write(pinKey, 0, 100, bufIn.get()));
+    EXPECT_EQ(0, page->Write(pinKey, 200, 100, bufIn.get() + 200));
+
+    PinnedData pinned;
+    EXPECT_EQ(0, page->ReadPinned(pinKey, 10, 80, pinned));
+    EXPECT_EQ(80, pinned.data.len);
+    EXPECT_EQ(0, memcmp(bufIn.get() + 10, pinned.data.data, 80));
+    PinnedData partial;
+    EXPECT_EQ(ErrCode::PAGE_NOT_FOUND, page->ReadPinned(pinKey, 50, 200, partial));
+    EXPECT_EQ(ErrCode::PAGE_NOT_FOUND, page->ReadPinned("pinned_none", 0, 10, partial));
+
+    // a rewrite of the pinned range goes to a copy of the page
+    std::string rewrite(80, '#');
+    EXPECT_EQ(0, page->DeletePart(pinKey, 10, 80));
+    EXPECT_EQ(0, page->Write(pinKey, 10, 80, rewrite.data()));
+    EXPECT_EQ(0, memcmp(bufIn.get() + 10, pinned.data.data, 80));
+    std::vector<std::pair<size_t, size_t>> dataBoundary;
+    EXPECT_EQ(0, page->Read(pinKey, 10, 80, bufOut.get(), dataBoundary));
+    EXPECT_EQ(0, memcmp(rewrite.data(), bufOut.get(), 80));
+    PinnedData repinned;
+    EXPECT_EQ(0, page->ReadPinned(pinKey, 10, 80, repinned));
+    EXPECT_EQ(0, memcmp(rewrite.data(), repinned.data.data, 80));
+    repinned.pin.reset();
+
+    // the pinned memory outlives the deleted page
+    EXPECT_EQ(0, page->Delete(pinKey));
+    EXPECT_EQ(0, memcmp(bufIn.get() + 10, pinned.data.data, 80));
+    pinned.pin.reset();
+}
+
+TEST(PageCache, ConcurrentWriteRead) {
+    // every write fills the range with one byte value,
+    // so a torn read shows up as mixed bytes
+    const int writerNum = 4;
+    const int writeCnt = 2000;  // well past the 8-bit version wrap
+    const uint32_t writeLen = 512;
+    std::atomic<bool> stop{false};
+    std::atomic<int> tornCnt{0};
+
+    std::vector<std::thread> writers;
+    for (int t=0; t<writerNum; ++t) {
+        writers.emplace_back([&, t]() {
+            std::unique_ptr<char[]> buf(new char[writeLen]);
+            for (int i=0; i<writeCnt; ++i) {
+                memset(buf.get(), 'a' + (t * writeCnt + i) % 26, writeLen);
+                EXPECT_EQ(0, page->Write(key3, 0, writeLen, buf.get()));
+            }
+        });
+    }
+    std::thread reader([&]() {
+        std::unique_ptr<char[]> buf(new char[writeLen]);
+        while (!stop.load()) {
+            std::vector<std::pair<size_t, size_t>> dataBoundary;
+            if (0 != page->Read(key3, 0, writeLen, buf.get(), dataBoundary))
+                continue;
+            if (dataBoundary.size() != 1) continue;
+            for (uint32_t i=1; i<writeLen; ++i) {
+                if (buf[i] != buf[0]) {
+                    ++tornCnt;
+                    break;
+                }
+            }
+        }
+    });
+    for (auto& it : writers) it.join();
+    stop.store(true);
+    reader.join();
+    EXPECT_EQ(0, tornCnt.load());
+    EXPECT_EQ(0, page->Delete(key3));
+}
+
+TEST(PageCache, AllocateContention) {
+    // every thread allocates and removes its own pages, so a drop of
+    // per-thread throughput comes from shared locking, not data conflicts
+    const int opsPerThread = 2000;
+    const uint32_t writeLen = 64;
+    for (int threadNum : {1, 2, 4, 8}) {
+        auto startTime = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int t=0; t<threadNum; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i=0; i<opsPerThread; ++i) {
+                    std::string key = "contention_" + std::to_string(t) +
+                                      "_" + std::to_string(i);
+                    EXPECT_EQ(0, page->Write(key, 0, writeLen, bufIn.get()));
+                    EXPECT_EQ(0, page->Delete(key));
+                }
+            });
+        }
+        for (auto& it : threads) it.join();
+        double totalTime = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - startTime).count();
+        printf("[AllocateContention] threads:%d, ops:%d, time:%.2fms, ops/ms:%.2f\n",
+               threadNum, threadNum * opsPerThread, totalTime,
+               threadNum * opsPerThread / totalTime);
+    }
+}
+
 TEST(PageCache, Delete) {
     EXPECT_EQ(0, page->Delete(key1));
     std::vector<std::pair<size_t, size_t>> dataBoundary;
@@ -165,6 +325,98 @@ TEST(PageCache, Delete) {
               page->Read(key2, 0, TEST_LEN, bufOut.get(), dataBoundary));
 }
 
+TEST(PageCache, CompressedReadWrite) {
+    CacheConfig compressCfg = cfg;
+    compressCfg.CacheName = "ReadCompressed";
+    compressCfg.CompressType = COMPRESS_ZSTD;
+    auto compressPage = std::make_shared<PageCacheImpl>(compressCfg);
+    EXPECT_EQ(0, compressPage->Init());
+
+    std::string text;
+    while (text.size() < TEST_LEN)
+        text.append("id,name,city\n1,alice,beijing\n2,bob,shanghai\n");
+
+    // partial writes go through read-modify-write of the compressed body
+    EXPECT_EQ(0, compressPage->Write(key1, 0, 1024, text.data()));
+    EXPECT_EQ(0, compressPage->Write(key1, 2048, 1024, text.data() + 2048));
+    std::vector<std::pair<size_t, size_t>> dataBoundary;
+    EXPECT_EQ(0, compressPage->Read(key1, 0, 4096, bufOut.get(), dataBoundary));
+    EXPECT_EQ(2, dataBoundary.size());
+    EXPECT_EQ(0, memcmp(text.data(), bufOut.get(), 1024));
+    EXPECT_EQ(0, memcmp(text.data() + 2048, bufOut.get() + 2048, 1024));
+
+    std::vector<PageRequest> pages;
+    pages.emplace_back(key2, 0, TEST_LEN, const_cast<char*>(text.data()));
+    EXPECT_EQ(0, compressPage->WritePages(pages));
+    pages[0].buf = bufOut.get();
+    EXPECT_EQ(0, compressPage->ReadPages(pages));
+    EXPECT_EQ(0, pages[0].res);
+    EXPECT_EQ(0, memcmp(text.data(), bufOut.get(), TEST_LEN));
+    EXPECT_LT(1.0, compressPage->GetCompressRatio());
+    EXPECT_LT(compressPage->GetCacheMaxSize(),
+              compressPage->GetCacheEffectiveMaxSize());
+
+    // the bitmap is kept uncompressed
+    EXPECT_EQ(0, compressPage->DeletePart(key2, 0, TEST_LEN / 2));
+    dataBoundary.clear();
+    EXPECT_EQ(0, compressPage->Read(key2, 0, TEST_LEN, bufOut.get(), dataBoundary));
+    EXPECT_EQ(1, dataBoundary.size());
+    EXPECT_EQ(TEST_LEN / 2, dataBoundary[0].first);
+
+    EXPECT_EQ(0, compressPage->Delete(key1));
+    EXPECT_EQ(0, compressPage->Delete(key2));
+    compressPage->Close();
+}
+
+TEST(PageCache, NvmReadPagesAsync) {
+    CacheConfig nvmCfg = cfg;
+    nvmCfg.CacheName = "ReadNvm";
+    nvmCfg.MaxCacheSize = 64 * 1024 * 1024;
+    nvmCfg.CacheLibCfg.EnableNvmCache = true;
+    nvmCfg.CacheLibCfg.RaidPath = "/tmp/hybridcache_test_nvm_";
+    nvmCfg.CacheLibCfg.RaidFileNum = 1;
+    nvmCfg.CacheLibCfg.RaidFileSize = 512 * 1024 * 1024;
+    auto nvmPage = std::make_shared<PageCacheImpl>(nvmCfg);
+    EXPECT_EQ(0, nvmPage->Init());
+
+    // four times the DRAM size, the first pages end up in NVM only
+    const int pageCnt = 4 * nvmCfg.MaxCacheSize / TEST_LEN;
+    for (int i=0; i<pageCnt; ++i) {
+        EXPECT_EQ(0, nvmPage->Write("nvm_" + std::to_string(i), 0, TEST_LEN,
+                                    bufIn.get()));
+    }
+
+    const int readCnt = 32;
+    const int unset = INT32_MIN;
+    std::unique_ptr<char[]> batchOut(new char[readCnt * TEST_LEN]);
+    std::vector<PageRequest> reads;
+    for (int i=0; i<readCnt; ++i) {
+        reads.emplace_back("nvm_" + std::to_string(i), 0, TEST_LEN,
+                           batchOut.get() + i * TEST_LEN);
+        reads.back().res = unset;
+    }
+    auto future = nvmPage->ReadPagesAsync(reads);
+    // a page still unset was not waited for, its lookup is in flight
+    // while the following ones are issued
+    int pendingCnt = 0;
+    for (auto& it : reads) {
+        if (unset == it.res) ++pendingCnt;
+    }
+    EXPECT_LT(1, pendingCnt);
+    EXPECT_EQ(0, std::move(future).get());
+
+    int hitCnt = 0;
+    for (int i=0; i<readCnt; ++i) {
+        EXPECT_NE(unset, reads[i].res);
+        if (0 != reads[i].res) continue;
+        ++hitCnt;
+        EXPECT_EQ(0, memcmp(bufIn.get(), batchOut.get() + i * TEST_LEN,
+                            TEST_LEN));
+    }
+    EXPECT_LT(0, hitCnt);
+    nvmPage->Close();
+}
+
 int main(int argc, char **argv) {
     printf("Running PageCache test from %s\n", __FILE__);
     testing::InitGoogleTest(&argc, argv);
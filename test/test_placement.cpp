@@ -0,0 +1,82 @@
+#include <map>
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "Placement.h"
+
+const int KEY_COUNT = 100000;
+
+static PlacementRing BuildRing(int num_servers) {
+    PlacementRing ring;
+    for (int server_id = 0; server_id < num_servers; ++server_id)
+        ring.AddServer(server_id, "server" + std::to_string(server_id) + ":8000");
+    return ring;
+}
+
+TEST(PlacementRing, DistinctReplicas) {
+    auto ring = BuildRing(4);
+    auto replicas = ring.Locate("key", 3);
+    ASSERT_EQ(3, replicas.size());
+    EXPECT_NE(replicas[0], replicas[1]);
+    EXPECT_NE(replicas[1], replicas[2]);
+    EXPECT_NE(replicas[0], replicas[2]);
+
+    // more choices than servers wrap around
+    replicas = ring.Locate("key", 6);
+    ASSERT_EQ(6, replicas.size());
+    EXPECT_EQ(replicas[0], replicas[4]);
+    EXPECT_EQ(replicas[1], replicas[5]);
+}
+
+TEST(PlacementRing, Balance) {
+    auto ring = BuildRing(8);
+    std::map<int, int> count;
+    for (int i = 0; i < KEY_COUNT; ++i)
+        count[ring.Locate("chunk-" + std::to_string(i), 1)[0]]++;
+    ASSERT_EQ(8, count.size());
+    for (auto &entry : count) {
+        EXPECT_GT(entry.second, KEY_COUNT / 8 * 0.7);
+        EXPECT_LT(entry.second, KEY_COUNT / 8 * 1.3);
+    }
+}
+
+TEST(PlacementRing, Weight) {
+    PlacementRing ring;
+    ring.AddServer(0, "server0:8000", 1);
+    ring.AddServer(1, "server1:8000", 3);
+    int count = 0;
+    for (int i = 0; i < KEY_COUNT; ++i)
+        count += ring.Locate("chunk-" + std::to_string(i), 1)[0] == 1;
+    EXPECT_GT(count, KEY_COUNT * 0.65);
+    EXPECT_LT(count, KEY_COUNT * 0.85);
+}
+
+TEST(PlacementRing, MinimalMovement) {
+    auto ring = BuildRing(8);
+    std::vector<int> before;
+    for (int i = 0; i < KEY_COUNT; ++i)
+        before.push_back(ring.Locate("chunk-" + std::to_string(i), 1)[0]);
+
+    ring.AddServer(8, "server8:8000");
+    int moved = 0;
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        int server_id = ring.Locate("chunk-" + std::to_string(i), 1)[0];
+        if (server_id != before[i]) {
+            EXPECT_EQ(8, server_id);
+            moved++;
+        }
+    }
+    EXPECT_LT(moved, KEY_COUNT / 9 * 1.3);
+
+    ring.RemoveServer(8);
+    for (int i = 0; i < KEY_COUNT; ++i)
+        EXPECT_EQ(before[i], ring.Locate("chunk-" + std::to_string(i), 1)[0]);
+}
+
+int main(int argc, char **argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,166 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "SegmentStore.h"
+
+static const std::string kStoreDir = "/tmp/madfs_test_segment_store";
+
+class SegmentStoreTest : public testing::Test {
+protected:
+    void SetUp() override {
+        boost::filesystem::remove_all(kStoreDir);
+        FLAGS_write_segment_size = 64 * 1024;
+        FLAGS_write_segment_compact_ratio = 0.25;
+    }
+
+    void TearDown() override {
+        boost::filesystem::remove_all(kStoreDir);
+    }
+
+    static butil::IOBuf MakeData(char c, size_t len) {
+        butil::IOBuf buf;
+        buf.append(std::string(len, c));
+        return buf;
+    }
+
+    static size_t CountSegments() {
+        size_t count = 0;
+        for (auto &entry : boost::filesystem::directory_iterator(kStoreDir)) {
+            (void) entry;
+            count++;
+        }
+        return count;
+    }
+};
+
+TEST_F(SegmentStoreTest, AppendRead) {
+    SegmentStore store(kStoreDir);
+    ASSERT_EQ(OK, store.Open());
+    ASSERT_EQ(OK, store.Append("a-0", 0, MakeData('a', 1000)));
+    ASSERT_EQ(OK, store.Append("b-1", 1, MakeData('b', 3000)));
+
+    butil::IOBuf output;
+    ASSERT_EQ(OK, store.Read("b-1", 100, 200, output));
+    EXPECT_EQ(std::string(200, 'b'), output.to_string());
+    output.clear();
+    ASSERT_EQ(OK, store.Read("a-0", 0, 1000, output));
+    EXPECT_EQ(std::string(1000, 'a'), output.to_string());
+
+    output.clear();
+    EXPECT_EQ(NOT_FOUND, store.Read("c-2", 0, 1, output));
+    EXPECT_EQ(INVALID_ARGUMENT, store.Read("a-0", 900, 200, output));
+}
+
+TEST_F(SegmentStoreTest, DeleteReclaimsSegments) {
+    SegmentStore store(kStoreDir);
+    ASSERT_EQ(OK, store.Open());
+    // 16KB records in 64KB segments: three per segment
+    for (int i = 0; i < 12; ++i) {
+        ASSERT_EQ(OK, store.Append("key-" + std::to_string(i), i, MakeData('a' + i, 16 * 1024)));
+    }
+    EXPECT_EQ(4, CountSegments());
+
+    ASSERT_EQ(OK, store.Delete("", [](const std::string &key, uint64_t ts) { return ts < 9; }));
+    EXPECT_EQ(3, store.GetKeyCount());
+    EXPECT_EQ(1, CountSegments());
+
+    butil::IOBuf output;
+    ASSERT_EQ(OK, store.Read("key-10", 0, 16 * 1024, output));
+    EXPECT_EQ(std::string(16 * 1024, 'a' + 10), output.to_string());
+}
+
+TEST_F(SegmentStoreTest, DeleteByPrefix) {
+    SegmentStore store(kStoreDir);
+    ASSERT_EQ(OK, store.Open());
+    ASSERT_EQ(OK, store.Append("a/x-0", 0, MakeData('a', 1000)));
+    ASSERT_EQ(OK, store.Append("a/y-1", 1, MakeData('b', 1000)));
+    ASSERT_EQ(OK, store.Append("ab/z-2", 2, MakeData('c', 1000)));
+    ASSERT_EQ(OK, store.Append("b/x-3", 3, MakeData('d', 1000)));
+
+    ASSERT_EQ(OK, store.Delete("a/", [](const std::string &key, uint64_t ts) { return key != "a/y-1"; }));
+    EXPECT_EQ(3, store.GetKeyCount());
+    butil::IOBuf output;
+    EXPECT_EQ(NOT_FOUND, store.Read("a/x-0", 0, 1, output));
+    for (auto &key : {"a/y-1", "ab/z-2", "b/x-3"}) {
+        output.clear();
+        EXPECT_EQ(OK, store.Read(key, 0, 1, output)) << key;
+    }
+}
+
+TEST_F(SegmentStoreTest, CompactSparseSegments) {
+    SegmentStore store(kStoreDir);
+    ASSERT_EQ(OK, store.Open());
+    for (int i = 0; i < 6; ++i) {
+        ASSERT_EQ(OK, store.Append("key-" + std::to_string(i), i, MakeData('a' + i, 16 * 1024)));
+    }
+    // the first segment keeps one of its three records, below the ratio;
+    // the second one is still active and left alone
+    FLAGS_write_segment_compact_ratio = 0.5;
+    ASSERT_EQ(OK, store.Delete("", [](const std::string &key, uint64_t ts) { return ts != 0 && ts != 5; }));
+    EXPECT_EQ(2, store.GetKeyCount());
+
+    butil::IOBuf output;
+    ASSERT_EQ(OK, store.Read("key-0", 0, 16 * 1024, output));
+    EXPECT_EQ(std::string(16 * 1024, 'a'), output.to_string());
+    EXPECT_FALSE(boost::filesystem::exists(kStoreDir + "/segment-00000000000000000000"));
+}
+
+TEST_F(SegmentStoreTest, Recover) {
+    {
+        SegmentStore store(kStoreDir);
+        ASSERT_EQ(OK, store.Open());
+        for (int i = 0; i < 5; ++i) {
+            ASSERT_EQ(OK, store.Append("key-" + std::to_string(i), i + 100, MakeData('a' + i, 10000)));
+        }
+    }
+
+    SegmentStore store(kStoreDir);
+    ASSERT_EQ(OK, store.Open());
+    EXPECT_EQ(5, store.GetKeyCount());
+    EXPECT_EQ(104, store.GetMaxTS());
+    for (int i = 0; i < 5; ++i) {
+        butil::IOBuf output;
+        ASSERT_EQ(OK, store.Read("key-" + std::to_string(i), 0, 10000, output));
+        EXPECT_EQ(std::string(10000, 'a' + i), output.to_string());
+    }
+
+    // appends continue after the recovered records
+    ASSERT_EQ(OK, store.Append("key-5", 105, MakeData('f', 100)));
+    butil::IOBuf output;
+    ASSERT_EQ(OK, store.Read("key-4", 0, 10000, output));
+    EXPECT_EQ(std::string(10000, 'e'), output.to_string());
+}
+
+TEST(GroupCommitter, ConcurrentCommits) {
+    boost::filesystem::create_directories(kStoreDir);
+    int fd = open(kStoreDir.c_str(), O_RDONLY | O_DIRECTORY);
+    ASSERT_GE(fd, 0);
+    GroupCommitter committer(1000, 64 * 1024, std::make_shared<OpenFile>(fd));
+
+    std::vector<std::thread> writers;
+    std::atomic<int> committed(0);
+    for (int i = 0; i < 16; ++i) {
+        writers.emplace_back([&] {
+            for (int j = 0; j < 10; ++j) {
+                if (committer.Commit(nullptr, 4096) == OK) {
+                    committed++;
+                }
+            }
+        });
+    }
+    for (auto &writer : writers) {
+        writer.join();
+    }
+    EXPECT_EQ(160, committed.load());
+    boost::filesystem::remove_all(kStoreDir);
+}
+
+int main(int argc, char **argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "SlidingWindow.h"
+
+// requests complete only when the test fulfils them, in any order
+struct ManualIssuer {
+    std::vector<size_t> sizes;
+    std::vector<size_t> issued;                 // indexes in issue order
+    std::map<size_t, folly::Promise<int>> pending;
+    size_t inflight_size = 0;
+    size_t max_inflight_size = 0;
+
+    explicit ManualIssuer(std::vector<size_t> request_sizes) : sizes(std::move(request_sizes)) {}
+
+    folly::Future<int> Run(size_t window_size) {
+        return SlidingWindow::Run(sizes, window_size, [this](size_t index) {
+            issued.push_back(index);
+            inflight_size += sizes[index];
+            max_inflight_size = std::max(max_inflight_size, inflight_size);
+            return pending[index].getFuture();
+        });
+    }
+
+    void Complete(size_t index, int status) {
+        auto promise = std::move(pending.at(index));
+        pending.erase(index);
+        inflight_size -= sizes[index];
+        promise.setValue(status);
+    }
+};
+
+TEST(SlidingWindow, InflightBound) {
+    ManualIssuer issuer({ 4, 4, 4, 4, 4 });
+    auto future = issuer.Run(8);
+    EXPECT_EQ(std::vector<size_t>({ 0, 1 }), issuer.issued);
+
+    // a completion frees its slot for the next request in order
+    issuer.Complete(1, OK);
+    EXPECT_EQ(std::vector<size_t>({ 0, 1, 2 }), issuer.issued);
+    issuer.Complete(0, OK);
+    issuer.Complete(2, OK);
+    EXPECT_EQ(std::vector<size_t>({ 0, 1, 2, 3, 4 }), issuer.issued);
+    EXPECT_EQ(8u, issuer.max_inflight_size);
+
+    issuer.Complete(4, OK);
+    EXPECT_FALSE(future.isReady());     // request 3 still writes the buffer
+    issuer.Complete(3, OK);
+    ASSERT_TRUE(future.isReady());
+    EXPECT_EQ(OK, future.value());
+}
+
+TEST(SlidingWindow, OversizedRequest) {
+    // a request larger than the window goes out alone
+    ManualIssuer issuer({ 2, 10, 2 });
+    auto future = issuer.Run(4);
+    EXPECT_EQ(std::vector<size_t>({ 0 }), issuer.issued);
+    issuer.Complete(0, OK);
+    EXPECT_EQ(std::vector<size_t>({ 0, 1 }), issuer.issued);
+    issuer.Complete(1, OK);
+    EXPECT_EQ(std::vector<size_t>({ 0, 1, 2 }), issuer.issued);
+    issuer.Complete(2, OK);
+    ASSERT_TRUE(future.isReady());
+    EXPECT_EQ(OK, future.value());
+}
+
+TEST(SlidingWindow, FirstErrorAfterInflight) {
+    ManualIssuer issuer({ 1, 1, 1, 1 });
+    auto future = issuer.Run(2);
+    issuer.Complete(0, IO_ERROR);
+    // nothing is issued after an error, but the result waits for request 1
+    EXPECT_EQ(std::vector<size_t>({ 0, 1 }), issuer.issued);
+    EXPECT_FALSE(future.isReady());
+    issuer.Complete(1, RPC_FAILED);
+    ASSERT_TRUE(future.isReady());
+    EXPECT_EQ(IO_ERROR, future.value());
+}
+
+TEST(SlidingWindow, Exception) {
+    ManualIssuer issuer({ 1, 1 });
+    auto future = issuer.Run(2);
+    issuer.Complete(0, OK);
+    issuer.pending.at(1).setException(std::runtime_error("lost"));
+    ASSERT_TRUE(future.isReady());
+    EXPECT_EQ(FOLLY_ERROR, future.value());
+}
+
+TEST(SlidingWindow, InlineCompletion) {
+    // requests completing inline must neither recurse nor reorder
+    const size_t count = 100000;
+    std::vector<size_t> issued;
+    auto future = SlidingWindow::Run(std::vector<size_t>(count, 1), 1, [&issued](size_t index) {
+        issued.push_back(index);
+        return folly::makeFuture(OK);
+    });
+    ASSERT_TRUE(future.isReady());
+    EXPECT_EQ(OK, future.value());
+    ASSERT_EQ(count, issued.size());
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQ(i, issued[i]);
+    }
+}
+
+TEST(SlidingWindow, Empty) {
+    auto future = SlidingWindow::Run({}, 1, [](size_t index) { return folly::makeFuture(IO_ERROR); });
+    ASSERT_TRUE(future.isReady());
+    EXPECT_EQ(OK, future.value());
+}
+
+int main(int argc, char **argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
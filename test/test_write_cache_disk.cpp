@@ -0,0 +1,96 @@
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "WriteCache.h"
+
+DECLARE_string(write_cache_engine);
+DECLARE_bool(write_cache_sync);
+
+static const std::string kCacheDir = "/tmp/madfs_test_write_cache_disk";
+
+class WriteCacheDiskTest : public testing::Test {
+protected:
+    void SetUp() override {
+        boost::filesystem::remove_all(kCacheDir);
+        FLAGS_write_cache_engine = "disk";
+        FLAGS_write_cache_sync = false;
+        GetGlobalConfig().write_cache_dir = kCacheDir;
+        executor_ = std::make_shared<folly::CPUThreadPoolExecutor>(2);
+    }
+
+    void TearDown() override {
+        boost::filesystem::remove_all(kCacheDir);
+    }
+
+    std::string Put(WriteCache &cache, const std::string &key, char c, size_t len = 4096) {
+        butil::IOBuf buf;
+        buf.append(std::string(len, c));
+        auto output = cache.Put(key, len, buf);
+        EXPECT_EQ(OK, output.status);
+        return output.internal_key;
+    }
+
+    static bool Exists(WriteCache &cache, const std::string &internal_key) {
+        return cache.Get(internal_key, 0, 1).status == OK;
+    }
+
+    std::shared_ptr<folly::CPUThreadPoolExecutor> executor_;
+};
+
+TEST_F(WriteCacheDiskTest, RestartKeepsObjectIds) {
+    {
+        WriteCache cache(executor_);
+        EXPECT_EQ(0u, cache.QueryTS());
+        EXPECT_EQ("bucket/a-0", Put(cache, "bucket/a", 'a'));
+        EXPECT_EQ("bucket/a-1", Put(cache, "bucket/a", 'b'));
+        EXPECT_EQ("other/b-2", Put(cache, "other/b", 'c'));
+    }
+
+    WriteCache cache(executor_);
+    // the index is rebuilt from disk, ids continue after the largest ts
+    EXPECT_EQ(3u, cache.QueryTS());
+    EXPECT_EQ("bucket/a-3", Put(cache, "bucket/a", 'd'));
+    for (auto &key : {"bucket/a-0", "bucket/a-1", "other/b-2", "bucket/a-3"}) {
+        EXPECT_TRUE(Exists(cache, key)) << key;
+    }
+
+    auto output = cache.Get("bucket/a-1", 100, 10);
+    ASSERT_EQ(OK, output.status);
+    EXPECT_EQ(std::string(10, 'b'), output.buf.to_string());
+}
+
+TEST_F(WriteCacheDiskTest, DeleteMatchesPrefixAndTS) {
+    {
+        WriteCache cache(executor_);
+        Put(cache, "bucket/a", 'a');     // bucket/a-0
+        Put(cache, "bucket/b", 'b');     // bucket/b-1
+        Put(cache, "bucket2/c", 'c');    // bucket2/c-2
+        Put(cache, "bucket/d", 'd');     // bucket/d-3
+    }
+
+    // entries loaded from disk are deleted like the ones put by this run
+    WriteCache cache(executor_);
+    Put(cache, "bucket/e", 'e');         // bucket/e-4
+    std::unordered_set<std::string> except_keys = {"bucket/b-1"};
+    ASSERT_EQ(OK, cache.Delete("bucket/", 4, except_keys));
+
+    EXPECT_FALSE(Exists(cache, "bucket/a-0"));
+    EXPECT_TRUE(Exists(cache, "bucket/b-1"));      // kept by except_keys
+    EXPECT_TRUE(Exists(cache, "bucket2/c-2"));     // other prefix
+    EXPECT_FALSE(Exists(cache, "bucket/d-3"));
+    EXPECT_TRUE(Exists(cache, "bucket/e-4"));      // not older than ts
+
+    ASSERT_EQ(OK, cache.Delete("bucket", 5, {}));
+    for (auto &key : {"bucket/b-1", "bucket2/c-2", "bucket/e-4"}) {
+        EXPECT_FALSE(Exists(cache, key)) << key;
+    }
+}
+
+int main(int argc, char **argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}